@@ -0,0 +1,221 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// batch_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "batch.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (300)
+#define BENCH_INSTANCE_COUNT                (64)
+#define BENCH_FRAMES_PER_STEP               (4)
+#define BENCH_STEP_COUNT                    (16)
+#define BENCH_EPISODE_FRAMES                (600)
+#define BENCH_REWARD_SIZE                   (16)
+
+// Steps a batch of instances with random input on 1 to 64 threads and reports
+// the rate and scaling of each, along with where the threads and memory were 
+// placed. Every thread count is fed the same input, so the outputs must agree.
+//
+// syntax: batch_bench <rom filename> [instances] [frames per step] [-pin] [-huge-pages]
+
+static const char *rom_page_names[] = { "normal pages", "transparent huge pages", "huge pages" };
+
+static void print_placement(const batch_placement *placement)
+{
+    printf("            %s, %u node%s%s, rom on %s\n", placement->worker_pinned[0] ? "pinned" : "unpinned",
+           placement->node_count, (1 == placement->node_count) ? "" : "s", 
+           placement->nodes_detected ? "" : " (assumed)", rom_page_names[placement->rom_pages]);
+
+    for (uint32 i = 0; i < placement->worker_count; i++)
+    {
+        printf("            worker %2u: cpu %3u node %u %s, %u instances created\n", i, placement->worker_cpus[i], 
+               placement->worker_nodes[i], placement->worker_pinned[i] ? "pinned" : "unpinned", 
+               placement->worker_instances[i]);
+    }
+}
+
+static uint64 hash_outputs(uint64 combined, const uint8 *data, uint32 size)
+{
+    for (uint32 i = 0; i < size; i++)
+    {
+        combined = combined * 31 + data[i];
+    }
+
+    return combined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: batch_bench <rom filename> [instances] [frames per step] [-pin] [-huge-pages]");
+        return 1;
+    }
+
+    batch_config config;
+    memset(&config, 0, sizeof(batch_config));
+
+    config.instance_count = BENCH_INSTANCE_COUNT;
+    config.frames_per_step = BENCH_FRAMES_PER_STEP;
+
+    for (int32 i = 2, position = 0; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-pin"))
+        {
+            config.pin_threads = true;
+        }
+        else if (0 == strcmp(argv[i], "-huge-pages"))
+        {
+            config.huge_pages = true;
+        }
+        else if (0 == position++)
+        {
+            config.instance_count = atoi(argv[i]);
+        }
+        else
+        {
+            config.frames_per_step = atoi(argv[i]);
+        }
+    }
+    config.episode_frames = BENCH_EPISODE_FRAMES;
+    config.reward_size = BENCH_REWARD_SIZE;
+    config.observation.crop_width = PPU_DISPLAY_WIDTH;
+    config.observation.crop_height = PPU_DISPLAY_HEIGHT;
+    config.observation.output_width = OBSERVATION_DEFAULT_SIZE;
+    config.observation.output_height = OBSERVATION_DEFAULT_SIZE;
+    config.observation.max_pool = true;
+
+    // Instances start past the title screen.
+    famicom *system = new famicom;
+    controller keypad;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    system->attach_controller(0, &keypad);
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        keypad.set_button(3, 0 == (i / 30) % 4);
+        system->tick();
+    }
+
+    keypad.set_button(3, false);
+
+    famicom_state *state = new famicom_state;
+    system->save_state(state);
+    delete system;
+
+    uint32 observation_size = config.observation.output_width * config.observation.output_height;
+    uint8 *inputs = new uint8[2 * config.instance_count];
+    uint8 *observations = new uint8[config.instance_count * observation_size];
+    uint8 *rewards = new uint8[config.instance_count * config.reward_size];
+    uint8 *dones = new uint8[config.instance_count];
+
+    float64 base_rate = 0;
+    uint64 expected = 0;
+    bool matches = true;
+
+    printf("%u instances, %u frames per step, %u cores\n", config.instance_count, config.frames_per_step, 
+           std::thread::hardware_concurrency());
+
+    for (uint32 thread_count = 1; thread_count <= BATCH_MAX_THREADS; thread_count *= 2)
+    {
+        batch_engine *engine = new batch_engine;
+        config.thread_count = thread_count;
+
+        if (base_failed(engine->configure(argv[1], &config)) || base_failed(engine->load_start_state(state)))
+        {
+            base_msg("Failed to configure the batch engine");
+            delete engine;
+            return 1;
+        }
+
+        uint32 seed = 1;
+        uint64 combined = 0;
+
+        for (uint32 i = 0; i < BENCH_STEP_COUNT; i++)
+        {
+            for (uint32 j = 0; j < 2 * config.instance_count; j++)
+            {
+                seed = seed * 1103515245 + 12345;
+                inputs[j] = (j & 1) ? 0 : (uint8) (seed >> 16) & 0xF7;
+            }
+
+            engine->step(inputs, observations, rewards, dones);
+
+            combined = hash_outputs(combined, observations, config.instance_count * observation_size);
+            combined = hash_outputs(combined, rewards, config.instance_count * config.reward_size);
+            combined = hash_outputs(combined, dones, config.instance_count);
+        }
+
+        batch_stats stats;
+        engine->query_stats(&stats);
+
+        float64 rate = stats.frame_count / stats.step_seconds;
+
+        if (1 == thread_count)
+        {
+            base_rate = rate;
+            expected = combined;
+        }
+
+        matches = matches && (combined == expected);
+
+        printf("%2u threads: %9.1f frames/s, %5.2fx, %6.3f ms/step, %llu steals, outputs %s\n", 
+               thread_count, rate, rate / base_rate, stats.step_seconds * 1e3 / stats.step_count, 
+               (unsigned long long) stats.steal_count, (combined == expected) ? "match" : "DIFFER");
+
+        batch_placement placement;
+        engine->query_placement(&placement);
+        print_placement(&placement);
+
+        delete engine;
+    }
+
+    delete [] inputs;
+    delete [] observations;
+    delete [] rewards;
+    delete [] dones;
+    delete state;
+
+    return matches ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// boot_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "boot.h"
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_BOOT_FRAMES                   (600)
+#define BENCH_REPLAY_FRAMES                 (600)
+
+// Presses start on the title screen and holds right once the game begins.
+static const char *boot_input = "120 start\n"
+                                "130\n"
+                                "300 start\n"
+                                "310 right\n";
+
+// Boots a game through a short script with an empty cache and again from the
+// state the first boot left behind, then checks that both machines go on to
+// produce exactly the same frames.
+//
+// syntax: boot_bench <rom filename> <cache directory> [boot frames]
+
+static uint64 run_frames(famicom *system, uint32 count)
+{
+    uint64 combined = 0;
+
+    for (uint32 i = 0; i < count; i++)
+    {
+        system->tick();
+        combined = combined * 31 + system->query_frame_view().hash;
+    }
+
+    return combined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        base_msg("syntax: boot_bench <rom filename> <cache directory> [boot frames]");
+        return 1;
+    }
+
+    input_event events[16];
+    boot_script script;
+    boot_cache cache;
+
+    script.name = "start";
+    script.events = events;
+    script.frame_count = (argc > 3) ? atoi(argv[3]) : BENCH_BOOT_FRAMES;
+
+    if (base_failed(parse_input_script(boot_input, events, &script.event_count)) || base_failed(cache.configure(argv[2])))
+    {
+        base_msg("Failed to set up the boot cache in %s", argv[2]);
+        return 1;
+    }
+
+    famicom *cold = new famicom;
+    famicom *warm = new famicom;
+    controller cold_gamepads[2];
+    controller warm_gamepads[2];
+    char filename[BOOT_CACHE_MAX_PATH];
+
+    if (base_failed(cold->insert_rom(argv[1])) || base_failed(warm->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete warm;
+        delete cold;
+        return 1;
+    }
+
+    for (uint8 i = 0; i < 2; i++)
+    {
+        cold->attach_controller(i, &cold_gamepads[i]);
+        warm->attach_controller(i, &warm_gamepads[i]);
+    }
+
+    cache.query_filename(cold, &script, filename, sizeof(filename));
+    remove(filename);
+
+    boot_cache_stats stats;
+
+    if (base_failed(cache.boot(cold, &script, cold_gamepads)) || base_failed(cache.boot(warm, &script, warm_gamepads)))
+    {
+        base_msg("Failed to boot");
+        delete warm;
+        delete cold;
+        return 1;
+    }
+
+    cache.query_stats(&stats);
+
+    uint64 cold_run = run_frames(cold, BENCH_REPLAY_FRAMES);
+    uint64 warm_run = run_frames(warm, BENCH_REPLAY_FRAMES);
+    bool match = (cold_run == warm_run);
+
+    printf("%u boot frames: emulated in %.2f ms, loaded from the cache in %.3f ms, %u frames %s\n", 
+           script.frame_count, stats.run_seconds * 1e3 / max(1u, stats.miss_count), stats.load_seconds * 1e3 / max(1u, stats.hit_count),
+           BENCH_REPLAY_FRAMES, match ? "match" : "DIFFER");
+
+    if (1 != stats.hit_count)
+    {
+        base_msg("The second boot missed the cache (%u states could not be written)", stats.write_failure_count);
+    }
+
+    delete warm;
+    delete cold;
+
+    return (match && 1 == stats.hit_count) ? 0 : 1;
+}
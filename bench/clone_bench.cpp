@@ -0,0 +1,152 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// clone_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (300)
+#define BENCH_BRANCH_COUNT                  (2000)
+#define BENCH_REPLAY_FRAMES                 (600)
+
+// Compares branching a running game by cloning it against restoring a saved 
+// state, each followed by one frame, then checks that a clone produces exactly
+// the frames its source goes on to produce.
+//
+// syntax: clone_bench <rom filename> [branches]
+
+static uint64 run_frames(famicom *system, uint32 count)
+{
+    uint64 combined = 0;
+
+    for (uint32 i = 0; i < count; i++)
+    {
+        system->tick();
+        combined = combined * 31 + system->query_frame_view().hash;
+    }
+
+    return combined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: clone_bench <rom filename> [branches]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    famicom *branch = new famicom;
+    uint32 branches = (argc > 2) ? atoi(argv[2]) : BENCH_BRANCH_COUNT;
+
+    if (base_failed(system->insert_rom(argv[1])) || base_failed(branch->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete branch;
+        delete system;
+        return 1;
+    }
+
+    controller keypad;
+    system->attach_controller(0, &keypad);
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        // Press start now and then to get past the title screen.
+        keypad.set_button(3, 0 == (i / 30) % 4);
+        system->tick();
+    }
+
+    keypad.set_button(3, false);
+
+    famicom_state *state = new famicom_state;
+    system->save_state(state);
+
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i < branches; i++)
+    {
+        system->clone(branch);
+    }
+
+    float64 clone_seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    // The two ways of branching alternate so that both see the same machine 
+    // conditions. Loading alone is timed too, which leaves the time of the frame
+    // that follows a load, and each way is reported relative to that.
+    float64 clone_tick_seconds = 0;
+    float64 load_tick_seconds = 0;
+    float64 load_seconds = 0;
+
+    for (uint32 i = 0; i < branches; i++)
+    {
+        begin = std::chrono::steady_clock::now();
+        system->clone(branch);
+        branch->tick();
+
+        auto middle = std::chrono::steady_clock::now();
+        branch->load_state(state);
+        branch->tick();
+
+        auto end = std::chrono::steady_clock::now();
+        branch->load_state(state);
+
+        clone_tick_seconds += std::chrono::duration<float64>(middle - begin).count();
+        load_tick_seconds += std::chrono::duration<float64>(end - middle).count();
+        load_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - end).count();
+    }
+
+    float64 frame_us = (load_tick_seconds - load_seconds) * 1e6 / branches;
+
+    system->clone(branch);
+
+    uint64 source_run = run_frames(system, BENCH_REPLAY_FRAMES);
+    uint64 branch_run = run_frames(branch, BENCH_REPLAY_FRAMES);
+
+    printf("clone %.3f us, load state %.3f us, frame after a load %.1f us\n", clone_seconds * 1e6 / branches, load_seconds * 1e6 / branches, frame_us);
+    printf("clone and one frame %.1f us (%+.1f), load state and one frame %.1f us (%+.1f)\n", 
+           clone_tick_seconds * 1e6 / branches, clone_tick_seconds * 1e6 / branches - frame_us, 
+           load_tick_seconds * 1e6 / branches, load_tick_seconds * 1e6 / branches - frame_us);
+    printf("%u frames %s\n", BENCH_REPLAY_FRAMES, (source_run == branch_run) ? "match" : "DIFFER");
+
+    delete state;
+    delete branch;
+    delete system;
+
+    return (source_run == branch_run) ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// convert_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "convert.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (120)
+#define BENCH_ITERATIONS                    (5000)
+
+// Measures the throughput of each pixel format conversion on a frame from the
+// given rom. Output rows are padded to exercise the stride handling.
+//
+// syntax: convert_bench <rom filename> [iterations]
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: convert_bench <rom filename> [iterations]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    uint32 iterations = (argc > 2) ? atoi(argv[2]) : BENCH_ITERATIONS;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        system->tick();
+    }
+
+    ppu_frame_view view = system->query_frame_view();
+    uint32 stride = (view.width + 16) * 4;
+    uint8 *output = new uint8[stride * view.height];
+
+    const char *names[] = { "RGBA8888", "BGRA8888", "RGB565", "I420" };
+
+    for (uint8 format = PIXEL_FORMAT_RGBA8888; format <= PIXEL_FORMAT_I420; format++)
+    {
+        uint32 bytes = view.width * view.height * query_pixel_format_size(format);
+        auto begin = std::chrono::steady_clock::now();
+
+        for (uint32 i = 0; i < iterations; i++)
+        {
+            if (PIXEL_FORMAT_I420 == format)
+            {
+                uint8 *u_plane = output + stride * view.height / 2;
+                uint8 *v_plane = u_plane + stride * view.height / 4;
+
+                convert_frame_i420(&view, output, stride / 2, u_plane, stride / 4, v_plane, stride / 4);
+            }
+            else
+            {
+                convert_frame(&view, format, output, stride);
+            }
+        }
+
+        float64 seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+        if (PIXEL_FORMAT_I420 == format)
+        {
+            bytes += bytes / 2;
+        }
+
+        printf("%-10s %8.2f us/frame %8.1f Mpixel/s %8.2f GB/s\n", names[format], 
+               seconds * 1e6 / iterations, 
+               (float64) view.width * view.height * iterations / seconds / 1e6, 
+               (float64) bytes * iterations / seconds / 1e9);
+    }
+
+    delete [] output;
+    delete system;
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// hibernate_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "hibernate.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (300)
+#define BENCH_SESSION_COUNT                 (2000)
+#define BENCH_MEMORY_LIMIT                  (64)        // MB
+#define BENCH_REPLAY_FRAMES                 (600)
+
+// Fills a session pool with diverging copies of a game under a memory budget, 
+// then runs one frame at a time on sessions picked at random, reporting how 
+// much a hibernated session costs and how long hibernating and waking take.
+// Finally checks that a woken machine produces exactly the frames the machine
+// it was hibernated from goes on to produce.
+//
+// syntax: hibernate_bench <rom filename> [sessions] [memory limit in MB]
+
+static uint64 run_frames(famicom *system, uint32 count)
+{
+    uint64 combined = 0;
+
+    for (uint32 i = 0; i < count; i++)
+    {
+        system->tick();
+        combined = combined * 31 + system->query_frame_view().hash;
+    }
+
+    return combined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: hibernate_bench <rom filename> [sessions] [memory limit in MB]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    uint32 session_count = (argc > 2) ? atoi(argv[2]) : BENCH_SESSION_COUNT;
+    uint64 memory_limit = (uint64) ((argc > 3) ? atoi(argv[3]) : BENCH_MEMORY_LIMIT) * BASE_MB;
+
+    if (!session_count || !memory_limit || base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    controller keypad;
+    system->attach_controller(0, &keypad);
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        // Press start now and then to get past the title screen.
+        keypad.set_button(3, 0 == (i / 30) % 4);
+        system->tick();
+    }
+
+    keypad.set_button(3, false);
+
+    session_pool pool;
+    session_config config;
+
+    config.memory_limit = memory_limit;
+    pool.configure(&config);
+
+    uint32 *ids = new uint32[session_count];
+    uint32 awake_size = system->query_memory_usage();
+
+    for (uint32 i = 0; i < session_count; i++)
+    {
+        famicom *session = new famicom;
+
+        if (base_failed(system->clone(session)) || base_failed(pool.add_session(session, &ids[i])))
+        {
+            base_msg("Failed to create session %u", i);
+            delete [] ids;
+            delete system;
+            return 1;
+        }
+
+        // Each session drifts a few frames from the others.
+        for (uint32 j = 0; j < i % 8; j++)
+        {
+            session->tick();
+        }
+    }
+
+    uint32 seed = 1;
+    uint32 access_count = 2 * session_count;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i < access_count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        famicom *session = pool.acquire_session(ids[(seed >> 8) % session_count]);
+
+        if (!session)
+        {
+            base_msg("Failed to wake a session");
+            delete [] ids;
+            delete system;
+            return 1;
+        }
+
+        session->tick();
+    }
+
+    float64 access_seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    session_stats stats;
+    pool.query_stats(&stats);
+
+    uint32 hibernated_count = stats.session_count - stats.awake_count;
+
+    printf("%u sessions within %llu MB: %u awake using %.1f MB, %u hibernated using %.1f MB (%.0f bytes each, %u awake)\n", 
+           stats.session_count, (unsigned long long) (memory_limit / BASE_MB), stats.awake_count, stats.awake_bytes / (float64) BASE_MB,
+           hibernated_count, stats.hibernated_bytes / (float64) BASE_MB,
+           hibernated_count ? stats.hibernated_bytes / (float64) hibernated_count : 0.0, awake_size);
+
+    printf("hibernate %.3f us, wake %.3f us, acquire and one frame %.3f us\n",
+           stats.hibernate_count ? stats.hibernate_seconds * 1e6 / stats.hibernate_count : 0.0,
+           stats.wake_count ? stats.wake_seconds * 1e6 / stats.wake_count : 0.0, access_seconds * 1e6 / access_count);
+
+    // A woken machine must carry on exactly where the original left off.
+    famicom *original = new famicom;
+    famicom *woken = new famicom;
+    hibernated_famicom image;
+
+    system->clone(original);
+    system->hibernate(&image);
+    woken->wake(&image);
+    release_hibernated_famicom(&image);
+
+    uint64 original_run = run_frames(original, BENCH_REPLAY_FRAMES);
+    uint64 woken_run = run_frames(woken, BENCH_REPLAY_FRAMES);
+
+    printf("%u frames after waking %s\n", BENCH_REPLAY_FRAMES, (original_run == woken_run) ? "match" : "DIFFER");
+
+    delete woken;
+    delete original;
+    delete [] ids;
+    delete system;
+
+    return (original_run == woken_run) ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// interleave_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "batch.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (300)
+#define BENCH_INSTANCE_COUNT                (128)
+#define BENCH_FRAMES_PER_STEP               (4)
+#define BENCH_STEP_COUNT                    (8)
+#define BENCH_REWARD_SIZE                   (16)
+#define BENCH_ROUND_COUNT                   (3)         // the fastest is reported
+
+// Steps a batch of instances on one thread, running 1 to 16 of them side by 
+// side, and reports the rate of each against running them one at a time. 
+// Every round is fed the same input, so the outputs must agree.
+//
+// syntax: interleave_bench <rom filename> [instances] [frames per step]
+
+static uint64 hash_outputs(uint64 combined, const uint8 *data, uint32 size)
+{
+    for (uint32 i = 0; i < size; i++)
+    {
+        combined = combined * 31 + data[i];
+    }
+
+    return combined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: interleave_bench <rom filename> [instances] [frames per step]");
+        return 1;
+    }
+
+    batch_config config;
+    memset(&config, 0, sizeof(batch_config));
+
+    config.instance_count = (argc > 2) ? atoi(argv[2]) : BENCH_INSTANCE_COUNT;
+    config.frames_per_step = (argc > 3) ? atoi(argv[3]) : BENCH_FRAMES_PER_STEP;
+    config.thread_count = 1;
+    config.reward_size = BENCH_REWARD_SIZE;
+    config.observation.crop_width = PPU_DISPLAY_WIDTH;
+    config.observation.crop_height = PPU_DISPLAY_HEIGHT;
+    config.observation.output_width = OBSERVATION_DEFAULT_SIZE;
+    config.observation.output_height = OBSERVATION_DEFAULT_SIZE;
+    config.observation.max_pool = true;
+
+    // Instances start past the title screen.
+    famicom *system = new famicom;
+    controller keypad;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    system->attach_controller(0, &keypad);
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        keypad.set_button(3, 0 == (i / 30) % 4);
+        system->tick();
+    }
+
+    keypad.set_button(3, false);
+
+    famicom_state *state = new famicom_state;
+    system->save_state(state);
+    delete system;
+
+    uint32 observation_size = config.observation.output_width * config.observation.output_height;
+    uint8 *inputs = new uint8[2 * config.instance_count];
+    uint8 *observations = new uint8[config.instance_count * observation_size];
+    uint8 *rewards = new uint8[config.instance_count * config.reward_size];
+
+    float64 base_rate = 0;
+    uint64 expected = 0;
+    bool matches = true;
+
+    printf("%u instances, %u frames per step, %u scanlines per turn\n", config.instance_count, 
+           config.frames_per_step, BATCH_INTERLEAVE_SCANLINES);
+
+    for (uint32 interleave_count = 1; interleave_count <= BATCH_MAX_INTERLEAVE; interleave_count *= 2)
+    {
+        float64 rate = 0;
+        uint64 combined = 0;
+
+        config.interleave_count = interleave_count;
+
+        for (uint32 round = 0; round < BENCH_ROUND_COUNT; round++)
+        {
+            batch_engine *engine = new batch_engine;
+
+            if (base_failed(engine->configure(argv[1], &config)) || base_failed(engine->load_start_state(state)))
+            {
+                base_msg("Failed to configure the batch engine");
+                delete engine;
+                return 1;
+            }
+
+            uint32 seed = 1;
+            combined = 0;
+
+            for (uint32 i = 0; i < BENCH_STEP_COUNT; i++)
+            {
+                for (uint32 j = 0; j < 2 * config.instance_count; j++)
+                {
+                    seed = seed * 1103515245 + 12345;
+                    inputs[j] = (j & 1) ? 0 : (uint8) (seed >> 16) & 0xF7;
+                }
+
+                engine->step(inputs, observations, rewards, NULL);
+
+                combined = hash_outputs(combined, observations, config.instance_count * observation_size);
+                combined = hash_outputs(combined, rewards, config.instance_count * config.reward_size);
+            }
+
+            batch_stats stats;
+            engine->query_stats(&stats);
+
+            rate = max(rate, stats.frame_count / stats.step_seconds);
+
+            if (1 == interleave_count && !round)
+            {
+                expected = combined;
+            }
+
+            matches = matches && (combined == expected);
+
+            delete engine;
+        }
+
+        if (1 == interleave_count)
+        {
+            base_rate = rate;
+        }
+
+        printf("%2u side by side: %8.1f frames/s per core, %5.3fx, outputs %s\n", interleave_count, rate, 
+               rate / base_rate, (combined == expected) ? "match" : "DIFFER");
+    }
+
+    delete [] inputs;
+    delete [] observations;
+    delete [] rewards;
+    delete state;
+
+    return matches ? 0 : 1;
+}
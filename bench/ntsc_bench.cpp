@@ -0,0 +1,110 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// ntsc_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "ntsc.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (120)
+#define BENCH_FRAME_COUNT                   (1000)
+
+// Runs a sequence of frames through the ntsc filter, timing the filter apart 
+// from emulation. The burst phase advances every frame as on the console.
+//
+// syntax: ntsc_bench <rom filename> [threads] [frames]
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: ntsc_bench <rom filename> [threads] [frames]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    uint32 frames = (argc > 3) ? atoi(argv[3]) : BENCH_FRAME_COUNT;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        system->tick();
+    }
+
+    ntsc_filter filter;
+    ntsc_config config;
+
+    filter.query_config(&config);
+    config.thread_count = (argc > 2) ? atoi(argv[2]) : 1;
+    filter.configure(&config);
+
+    uint32 stride = NTSC_OUTPUT_WIDTH * 3;
+    uint8 *output = new uint8[stride * PPU_DISPLAY_HEIGHT];
+    float64 filter_seconds = 0.0;
+    uint64 checksum = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i < frames; i++)
+    {
+        system->tick();
+
+        ppu_frame_view view = system->query_frame_view();
+        auto filter_begin = std::chrono::steady_clock::now();
+
+        filter.filter(&view, i % NTSC_PHASE_COUNT, output, stride);
+
+        filter_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - filter_begin).count();
+        checksum += output[(i * 7919) % (stride * PPU_DISPLAY_HEIGHT)];
+    }
+
+    float64 seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("%u frames, %u thread(s): filter %.3f ms/frame (%.0f fps), emulation and filter %.3f ms/frame, checksum %llu\n",
+           frames, config.thread_count, filter_seconds * 1e3 / frames, frames / filter_seconds, 
+           seconds * 1e3 / frames, (unsigned long long) checksum);
+
+    delete [] output;
+    delete system;
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// pipeline_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_FRAME_COUNT                   (1200)
+
+#define BENCH_MODE_EAGER                    (0)
+#define BENCH_MODE_THREAD_SYNCHRONOUS       (1)
+#define BENCH_MODE_THREAD_LATEST            (2)
+
+static const char *mode_names[] = { "eager", "render thread, synchronous reads", "render thread, latest frame reads" };
+
+// Runs a game while reading every frame, drawn eagerly on the cpu thread or 
+// on the render thread. Synchronous reads wait for the frame the cpu just 
+// finished, while latest frame reads take whatever the render thread last 
+// completed and let the cpu run on. Reports frames per second and the mean 
+// latency from the start of emulating a frame until a read first returns it.
+//
+// syntax: pipeline_bench <rom filename> [frames]
+
+typedef std::chrono::steady_clock::time_point bench_time;
+
+static void run_mode(const char *filename, uint8 mode, uint32 frame_count, bench_time *frame_starts)
+{
+    famicom *system = new famicom;
+
+    if (base_failed(system->insert_rom(filename)) || 
+        (BENCH_MODE_EAGER != mode && base_failed(system->set_render_thread_enabled(true))))
+    {
+        base_msg("Failed to set up %s", mode_names[mode]);
+        delete system;
+        return;
+    }
+
+    float64 latency_seconds = 0.0;
+    uint64 lag_frames = 0;
+    uint32 delivered = 0;
+    bool synchronous = (BENCH_MODE_THREAD_LATEST != mode);
+    bench_time begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i <= frame_count; i++)
+    {
+        if (i < frame_count)
+        {
+            frame_starts[i] = std::chrono::steady_clock::now();
+            system->tick();
+        }
+
+        // One extra synchronous read collects the frames still being drawn.
+        ppu_frame_view view = system->query_frame_view(synchronous || i == frame_count);
+        bench_time now = std::chrono::steady_clock::now();
+
+        for (; delivered <= view.frame && delivered < frame_count; delivered++)
+        {
+            latency_seconds += std::chrono::duration<float64>(now - frame_starts[delivered]).count();
+        }
+
+        lag_frames += system->query_frame_count() - (view.frame + 1);
+    }
+
+    float64 seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("%-34s %8.1f frames/sec, latency %.3f ms, %.2f frames behind\n", mode_names[mode], frame_count / seconds,
+           latency_seconds * 1e3 / frame_count, lag_frames / (float64) (frame_count + 1));
+
+    delete system;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: pipeline_bench <rom filename> [frames]");
+        return 1;
+    }
+
+    uint32 frame_count = (argc > 2) ? atoi(argv[2]) : BENCH_FRAME_COUNT;
+    bench_time *frame_starts = new bench_time[max(1u, frame_count)];
+
+    for (uint8 mode = BENCH_MODE_EAGER; mode <= BENCH_MODE_THREAD_LATEST; mode++)
+    {
+        run_mode(argv[1], mode, frame_count, frame_starts);
+    }
+
+    delete [] frame_starts;
+
+    return 0;
+}
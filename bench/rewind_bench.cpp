@@ -0,0 +1,159 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// rewind_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "hash.h"
+#include "rewind.h"
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (300)
+#define BENCH_RECORD_FRAMES                 (7200)
+#define BENCH_STEP_FRAMES                   (600)
+#define BENCH_JUMP_FRAMES                   (1000)
+
+// Records a game into a rewind buffer for longer than it can hold, then steps
+// back frame by frame and jumps back further, checking every restored state
+// against the one recorded. Buttons change every few frames to keep the game
+// busy.
+//
+// syntax: rewind_bench <rom filename> [memory limit in KB] [keyframe interval]
+
+static void press_buttons(controller *keypad, uint32 frame)
+{
+    for (uint8 i = 0; i < 8; i++)
+    {
+        keypad->set_button(i, 0 != ((frame / 10 + i * 3) % 7 < 2));
+    }
+}
+
+static uint64 hash_state(famicom *system, famicom_state *state)
+{
+    system->save_state(state);
+    return compute_hash64(state, sizeof(famicom_state));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: rewind_bench <rom filename> [memory limit in KB] [keyframe interval]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    controller keypad;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    system->attach_controller(0, &keypad);
+
+    rewind_buffer rewind;
+    rewind_config config;
+
+    rewind.query_config(&config);
+    config.memory_limit = (argc > 2) ? atoi(argv[2]) * 1024 : config.memory_limit;
+    config.keyframe_interval = (argc > 3) ? atoi(argv[3]) : config.keyframe_interval;
+
+    if (base_failed(rewind.configure(&config)))
+    {
+        base_msg("Invalid rewind configuration");
+        delete system;
+        return 1;
+    }
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        press_buttons(&keypad, i);
+        system->tick();
+    }
+
+    // The state is zeroed so that its padding hashes the same every time.
+    famicom_state *state = new famicom_state;
+    uint64 *hashes = new uint64[BENCH_RECORD_FRAMES];
+
+    memset(state, 0, sizeof(famicom_state));
+
+    for (uint32 i = 0; i < BENCH_RECORD_FRAMES; i++)
+    {
+        press_buttons(&keypad, BENCH_WARMUP_FRAMES + i);
+        system->tick();
+        rewind.record(system);
+        hashes[i] = hash_state(system, state);
+    }
+
+    rewind_stats stats;
+    rewind.query_stats(&stats);
+
+    printf("recorded %llu frames: %.2f us/frame, %u frames held (%u keyframes) in %u KB, %.0f bytes/frame, %u KB per session\n",
+           (unsigned long long) stats.record_count, stats.record_seconds * 1e6 / stats.record_count, stats.frame_count, 
+           stats.keyframe_count, stats.memory_used / 1024, (float64) stats.memory_used / stats.frame_count, 
+           stats.session_bytes / 1024);
+
+    uint32 latest = BENCH_RECORD_FRAMES - 1;
+    uint32 mismatches = 0;
+    uint32 steps = min(BENCH_STEP_FRAMES, stats.frame_count - 1);
+
+    for (uint32 i = 1; i <= steps; i++)
+    {
+        rewind.rewind(system);
+        mismatches += (hash_state(system, state) != hashes[latest - i]);
+    }
+
+    float64 step_seconds = 0.0;
+    
+    rewind.query_stats(&stats);
+    step_seconds = stats.restore_seconds;
+
+    uint32 jump = min(BENCH_JUMP_FRAMES, stats.frame_count - 1);
+
+    rewind.rewind(system, jump);
+    mismatches += (hash_state(system, state) != hashes[latest - steps - jump]);
+    rewind.query_stats(&stats);
+
+    printf("stepped back %u frames: %.2f us/frame, jumped back %u frames: %.2f us, %u mismatches\n", 
+           steps, step_seconds * 1e6 / steps, jump, (stats.restore_seconds - step_seconds) * 1e6, mismatches);
+
+    delete [] hashes;
+    delete state;
+    delete system;
+
+    return mismatches ? 1 : 0;
+}
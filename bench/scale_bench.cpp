@@ -0,0 +1,133 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// scale_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "convert.h"
+#include "scale.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (120)
+#define BENCH_ITERATIONS                    (1000)
+#define BENCH_OUTPUT_WIDTH                  (1920)
+#define BENCH_OUTPUT_HEIGHT                 (1080)
+
+// Measures each scaler filling a 1080p frame, with the integer scale option 
+// (a 4x, 1024x896 image) and with a letterboxed fit, on one and two threads.
+//
+// syntax: scale_bench <rom filename> [iterations]
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: scale_bench <rom filename> [iterations]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    uint32 iterations = (argc > 2) ? atoi(argv[2]) : BENCH_ITERATIONS;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        system->tick();
+    }
+
+    ppu_frame_view view = system->query_frame_view();
+    uint32 *source = new uint32[view.width * view.height];
+    uint32 *output = new uint32[BENCH_OUTPUT_WIDTH * BENCH_OUTPUT_HEIGHT];
+
+    convert_frame(&view, PIXEL_FORMAT_RGBA8888, (uint8 *) source, view.width * 4);
+
+    const char *names[] = { "nearest", "scale2x", "scale3x", "scale4x" };
+    frame_scaler scaler;
+
+    for (uint8 filter = SCALER_FILTER_NEAREST; filter < SCALER_FILTER_COUNT; filter++)
+    {
+        for (uint32 fit = 0; fit < 2; fit++)
+        {
+            for (uint8 threads = 1; threads <= 2; threads++)
+            {
+                scaler_config config;
+                memset(&config, 0, sizeof(scaler_config));
+
+                config.filter = filter;
+                config.source_width = view.width;
+                config.source_height = view.height;
+                config.output_width = BENCH_OUTPUT_WIDTH;
+                config.output_height = BENCH_OUTPUT_HEIGHT;
+                config.integer_scale = (0 == fit);
+                config.letterbox = true;
+                config.border_color = 0xFF000000;
+                config.thread_count = threads;
+
+                if (base_failed(scaler.configure(&config)))
+                {
+                    continue;
+                }
+
+                uint16 width, height;
+                scaler.query_target(NULL, NULL, &width, &height);
+
+                auto begin = std::chrono::steady_clock::now();
+
+                for (uint32 i = 0; i < iterations; i++)
+                {
+                    scaler.scale(source, view.width * 4, output, BENCH_OUTPUT_WIDTH * 4);
+                }
+
+                float64 seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+                printf("%-8s %4ix%-4i %-9s %i thread%s %8.3f ms/frame %8.1f fps\n", names[filter], width, height, 
+                       fit ? "letterbox" : "integer", threads, (threads > 1) ? "s" : " ",
+                       seconds * 1e3 / iterations, iterations / seconds);
+            }
+        }
+    }
+
+    delete [] output;
+    delete [] source;
+    delete system;
+
+    return 0;
+}
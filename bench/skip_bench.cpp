@@ -0,0 +1,140 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// skip_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_FRAME_COUNT                   (5000)
+#define BENCH_RUN_COUNT                     (3)
+
+// Runs a game while skipping the rendering of none, half, three quarters or
+// all of its frames, and reports the best frame rate of several runs. Every
+// frame that is rendered is checked against the same frame of a run that 
+// renders them all.
+//
+// syntax: skip_bench <rom filename> [frames]
+
+static float64 run_frames(const char *filename, uint32 frame_count, uint32 render_every, 
+                          uint64 *hashes, uint32 *mismatches)
+{
+    // Renders one frame of each render_every, or none when it is zero.
+    famicom *system = new famicom;
+
+    if (base_failed(system->insert_rom(filename)))
+    {
+        delete system;
+        return 0.0;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i < frame_count; i++)
+    {
+        bool render = render_every && (0 == i % render_every);
+        system->tick(render);
+
+        if (render && hashes)
+        {
+            uint64 hash = system->query_frame_view().hash;
+
+            if (1 == render_every)
+            {
+                hashes[i] = hash;
+            }
+            else if (hash != hashes[i])
+            {
+                (*mismatches)++;
+            }
+        }
+    }
+
+    float64 seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    delete system;
+
+    return frame_count / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: skip_bench <rom filename> [frames]");
+        return 1;
+    }
+
+    uint32 frame_count = (argc > 2) ? atoi(argv[2]) : BENCH_FRAME_COUNT;
+    uint64 *hashes = new uint64[frame_count];
+    uint32 mismatches = 0;
+
+    // Skipped shares of 0%, 50%, 75% and 100%.
+    const uint32 render_every[] = { 1, 2, 4, 0 };
+
+    if (0.0 == run_frames(argv[1], frame_count, 1, hashes, &mismatches))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete [] hashes;
+        return 1;
+    }
+
+    for (uint32 i = 0; i < sizeof(render_every) / sizeof(render_every[0]); i++)
+    {
+        float64 best = 0.0;
+
+        for (uint32 run = 0; run < BENCH_RUN_COUNT; run++)
+        {
+            // Hashing is left out of the timed runs.
+            best = max(best, run_frames(argv[1], frame_count, render_every[i], NULL, NULL));
+        }
+
+        uint32 skipped = render_every[i] ? 100 - 100 / render_every[i] : 100;
+        uint32 previous = mismatches;
+
+        if (render_every[i] > 1)
+        {
+            run_frames(argv[1], frame_count, render_every[i], hashes, &mismatches);
+        }
+
+        printf("%3u%% skipped %8.0f fps  rendered frames %s\n", skipped, best, 
+               (previous == mismatches) ? "match" : "DIFFER");
+    }
+
+    delete [] hashes;
+
+    return mismatches ? 1 : 0;
+}
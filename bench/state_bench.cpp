@@ -0,0 +1,123 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// state_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_WARMUP_FRAMES                 (300)
+#define BENCH_SNAPSHOT_COUNT                (100000)
+#define BENCH_REPLAY_FRAMES                 (600)
+
+// Times save_state and load_state, then checks that a game resumed from a state
+// produces exactly the frames it produced the first time.
+//
+// syntax: state_bench <rom filename> [snapshots]
+
+static uint64 run_frames(famicom *system, uint32 count)
+{
+    uint64 combined = 0;
+
+    for (uint32 i = 0; i < count; i++)
+    {
+        system->tick();
+        combined = combined * 31 + system->query_frame_view().hash;
+    }
+
+    return combined;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        base_msg("syntax: state_bench <rom filename> [snapshots]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    uint32 snapshots = (argc > 2) ? atoi(argv[2]) : BENCH_SNAPSHOT_COUNT;
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    controller keypad;
+    system->attach_controller(0, &keypad);
+
+    for (uint32 i = 0; i < BENCH_WARMUP_FRAMES; i++)
+    {
+        // Press start now and then to get past the title screen.
+        keypad.set_button(3, 0 == (i / 30) % 4);
+        system->tick();
+    }
+
+    famicom_state *state = new famicom_state;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i < snapshots; i++)
+    {
+        system->save_state(state);
+    }
+
+    float64 save_seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    begin = std::chrono::steady_clock::now();
+
+    for (uint32 i = 0; i < snapshots; i++)
+    {
+        system->load_state(state);
+    }
+
+    float64 load_seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    uint64 first_run = run_frames(system, BENCH_REPLAY_FRAMES);
+    system->load_state(state);
+    uint64 second_run = run_frames(system, BENCH_REPLAY_FRAMES);
+
+    printf("%u byte state: save %.3f us, load %.3f us, replay of %u frames %s\n", 
+           (uint32) sizeof(famicom_state), save_seconds * 1e6 / snapshots, load_seconds * 1e6 / snapshots, 
+           BENCH_REPLAY_FRAMES, (first_run == second_run) ? "matches" : "DIFFERS");
+
+    delete state;
+    delete system;
+
+    return (first_run == second_run) ? 0 : 1;
+}
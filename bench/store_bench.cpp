@@ -0,0 +1,170 @@
+
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// store_bench.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "store.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define BENCH_STATE_COUNT                   (2000)
+#define BENCH_FRAMES_PER_STATE              (2)
+
+// Builds a corpus of states by playing a game with changing input, stores it
+// in a fresh pack file and reports the put rate and how well pages were 
+// shared. The pack is then opened again and every state read back in random
+// order and compared with the original.
+//
+// syntax: store_bench <rom filename> <pack filename> [states]
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        base_msg("syntax: store_bench <rom filename> <pack filename> [states]");
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    uint32 state_count = (argc > 3) ? atoi(argv[3]) : BENCH_STATE_COUNT;
+
+    if (!state_count || base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        return 1;
+    }
+
+    controller keypad;
+    system->attach_controller(0, &keypad);
+
+    famicom_state *corpus = new famicom_state[state_count];
+    uint64 *keys = new uint64[state_count];
+    uint32 seed = 1;
+
+    memset(corpus, 0, state_count * sizeof(famicom_state));
+
+    for (uint32 i = 0; i < state_count; i++)
+    {
+        // Hold a new random set of buttons every half second, with start 
+        // pressed now and then to get past the title screen.
+        if (0 == i % 30)
+        {
+            seed = seed * 1103515245 + 12345;
+
+            for (uint8 button = 0; button < 8; button++)
+            {
+                keypad.set_button(button, (3 == button) ? 0 == (i / 30) % 8 : !!((seed >> (16 + button)) & 1));
+            }
+        }
+
+        for (uint32 j = 0; j < BENCH_FRAMES_PER_STATE; j++)
+        {
+            system->tick(false);
+        }
+
+        system->save_state(&corpus[i]);
+    }
+
+    remove(argv[2]);
+
+    state_store store;
+    store_stats stats;
+
+    if (base_failed(store.open(argv[2])))
+    {
+        base_msg("Failed to create %s", argv[2]);
+        delete [] keys;
+        delete [] corpus;
+        delete system;
+        return 1;
+    }
+
+    for (uint32 i = 0; i < state_count; i++)
+    {
+        if (base_failed(store.put(&corpus[i], &keys[i])))
+        {
+            base_msg("Failed to store state %u", i);
+            delete [] keys;
+            delete [] corpus;
+            delete system;
+            return 1;
+        }
+    }
+
+    store.query_stats(&stats);
+    store.close();
+
+    uint64 raw_size = (uint64) state_count * sizeof(famicom_state);
+
+    printf("put %u states (%u distinct): %.2f us each, %.1f MB/s\n", state_count, stats.state_count, 
+           stats.put_seconds * 1e6 / state_count, raw_size / (float64) BASE_MB / stats.put_seconds);
+    printf("%u distinct pages, %.1f MB of states in %.2f MB of pack, %.1fx smaller\n", stats.page_count, 
+           raw_size / (float64) BASE_MB, stats.file_size / (float64) BASE_MB, raw_size / (float64) stats.file_size);
+
+    uint32 mismatches = 0;
+    famicom_state *loaded = new famicom_state;
+
+    if (base_failed(store.open(argv[2])))
+    {
+        base_msg("Failed to open %s", argv[2]);
+        mismatches = state_count;
+    }
+
+    for (uint32 i = 0; i < state_count && !mismatches; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32 index = (seed >> 8) % state_count;
+
+        if (base_failed(store.get(keys[index], loaded)) || memcmp(loaded, &corpus[index], sizeof(famicom_state)))
+        {
+            mismatches++;
+        }
+    }
+
+    store.query_stats(&stats);
+
+    printf("opened in %.2f ms, get %.2f us each, %.1f MB/s, %u mismatches\n", stats.open_seconds * 1e3,
+           stats.get_count ? stats.get_seconds * 1e6 / stats.get_count : 0.0, 
+           stats.get_count * sizeof(famicom_state) / (float64) BASE_MB / stats.get_seconds, mismatches);
+
+    delete loaded;
+    delete [] keys;
+    delete [] corpus;
+    delete system;
+
+    return mismatches ? 1 : 0;
+}
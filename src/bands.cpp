@@ -0,0 +1,159 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// bands.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "bands.h"
+
+namespace nes {
+
+band_pool::band_pool()
+{
+    worker_count = 0;
+    generation = 0;
+    pending_bands = 0;
+    quitting = false;
+
+    function = NULL;
+    context = NULL;
+    rows = 0;
+}
+
+band_pool::~band_pool()
+{
+    stop();
+}
+
+void band_pool::start(uint32 thread_count)
+{
+    stop();
+
+    quitting = false;
+    worker_count = min(max(thread_count, 1), BAND_POOL_MAX_THREADS) - 1;
+
+    // The generation is handed over at creation, since a job may be started
+    // before a worker gets to run.
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        workers[i] = std::thread(&band_pool::run_worker, this, i + 1, generation);
+    }
+}
+
+void band_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quitting = true;
+    }
+
+    wake.notify_all();
+
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        workers[i].join();
+    }
+
+    worker_count = 0;
+}
+
+uint32 band_pool::query_thread_count()
+{
+    return worker_count + 1;
+}
+
+void band_pool::run(uint32 row_count, band_function job, void *job_context)
+{
+    function = job;
+    context = job_context;
+    rows = row_count;
+
+    if (!worker_count)
+    {
+        run_band(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending_bands = worker_count;
+        generation++;
+    }
+
+    wake.notify_all();
+    run_band(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&] { return 0 == pending_bands; });
+}
+
+void band_pool::run_worker(uint32 band, uint32 first_generation)
+{
+    uint32 seen = first_generation;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return quitting || seen != generation; });
+
+            if (quitting)
+            {
+                return;
+            }
+
+            seen = generation;
+        }
+
+        run_band(band);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            if (0 == --pending_bands)
+            {
+                done.notify_one();
+            }
+        }
+    }
+}
+
+void band_pool::run_band(uint32 band)
+{
+    uint32 bands = worker_count + 1;
+    uint32 first_row = rows * band / bands;
+    uint32 last_row = rows * (band + 1) / bands;
+
+    if (first_row < last_row)
+    {
+        function(context, first_row, last_row);
+    }
+}
+
+} // namespace nes
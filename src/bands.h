@@ -0,0 +1,92 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// bands.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __BAND_POOL_H__
+#define __BAND_POOL_H__
+
+#include "base.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define BAND_POOL_MAX_THREADS               (16)
+
+namespace nes {
+
+using namespace base;
+
+typedef void (*band_function)(void *context, uint32 first_row, uint32 last_row);
+
+// Runs a function over the rows of an image split into horizontal bands, one 
+// per thread. The calling thread takes the first band and the others go to a
+// small pool of workers that sleep between jobs. Each job returns only after
+// every band is complete, so jobs that read each other's output can simply be
+// run one after another.
+
+class band_pool
+{
+    std::thread workers[BAND_POOL_MAX_THREADS];
+    uint32 worker_count;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint32 generation;
+    uint32 pending_bands;
+    bool quitting;
+
+    band_function function;
+    void *context;
+    uint32 rows;
+
+public:
+
+    band_pool();
+    ~band_pool();
+
+    void start(uint32 thread_count);
+    void stop();
+    uint32 query_thread_count();
+
+    void run(uint32 row_count, band_function job, void *job_context);
+
+private:
+
+    void run_worker(uint32 band, uint32 first_generation);
+    void run_band(uint32 band);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(band_pool);
+};
+
+} // namespace nes
+
+#endif // __BAND_POOL_H__
@@ -60,10 +60,41 @@
     #elif TARGET_OS_MAC
         #define BASE_PLATFORM_MACOSX                      // building a Mac OSX application
     #endif
+
+#elif defined (__linux__) || defined (__unix__)
+    #include "unistd.h"
+    #include "sys/types.h"
+    #include "ctype.h"
+    #include "stdint.h"
+
+    #define BASE_PLATFORM_POSIX                           // building a Linux or other POSIX application
 #else
     #error "Unsupported target platform detected."
 #endif
 
+/**********************************************************************************
+//
+// SIMD definitions
+//
+**********************************************************************************/
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #define BASE_SIMD_SSE2                                // SSE2 intrinsics are available
+#endif
+
+#if defined (__AVX2__)
+    #define BASE_SIMD_AVX2                                // AVX2 intrinsics are available
+#endif
+
+// Hints that a cache line will be read soon. It never faults, so any address 
+// may be passed.
+#if defined (_MSC_VER)
+    #include <xmmintrin.h>
+    #define BASE_PREFETCH(address)                        _mm_prefetch((const char *) (address), _MM_HINT_T0)
+#else
+    #define BASE_PREFETCH(address)                        __builtin_prefetch(address)
+#endif
+
 /**********************************************************************************
 //
 // Debug definitions
@@ -80,7 +111,7 @@
         #define debug_break __debugbreak
     #endif
     #define __BASE_FUNCTION__  __FUNCTION__
-#elif defined (BASE_PLATFORM_IOS) || defined (BASE_PLATFORM_MACOSX)
+#elif defined (BASE_PLATFORM_IOS) || defined (BASE_PLATFORM_MACOSX) || defined (BASE_PLATFORM_POSIX)
    #ifdef DEBUG
        #define BASE_DEBUG DEBUG
        #if !defined(debug_break)
@@ -129,6 +160,16 @@ namespace base {
     typedef u_int32_t uint32;	    
     typedef u_int16_t uint16;	    
     typedef u_int8_t uint8;	 
+#elif defined (BASE_PLATFORM_POSIX)
+    typedef int64_t int64;
+    typedef int32_t int32;
+    typedef int16_t int16;
+    typedef int8_t  int8;
+
+    typedef uint64_t uint64;
+    typedef uint32_t uint32;
+    typedef uint16_t uint16;
+    typedef uint8_t uint8;
 #endif
 
 typedef float float32;         
@@ -234,6 +275,20 @@ inline uint32 post_error_i(uint8 error, const char *error_string, const char *fu
 #define BASE_TEMPLATE_T                         template <class T>
 #define BASE_TEMPLATE_SPEC                      template <>
 
+#if !defined (BASE_PLATFORM_WINDOWS)
+
+namespace base {
+
+// Windows supplies min and max as macros. Elsewhere these stand in for them,
+// accepting mixed argument types and yielding their common type just as the
+// macros do, without breaking standard headers that use std::min.
+template <class A, class B> inline auto min(A a, B b) -> decltype(a + b) { return (a < b) ? a : b; }
+template <class A, class B> inline auto max(A a, B b) -> decltype(a + b) { return (a > b) ? a : b; }
+
+} // namespace base
+
+#endif
+
 #define BASE_VARG(fmt)                          va_list argptr;                               \
                                                 char text[1*BASE_KB] = {0};                   \
                                                 va_start(argptr, fmt);                        \
@@ -0,0 +1,632 @@
+
+#include "batch.h"
+
+#include <chrono>
+
+namespace nes {
+
+static uint64 pack_range(uint32 begin, uint32 end)
+{
+    return ((uint64) begin << 32) | end;
+}
+
+batch_engine::batch_engine()
+{
+    memset(&config, 0, sizeof(batch_config));
+    memset(&stats, 0, sizeof(batch_stats));
+
+    start_system = NULL;
+    instances = NULL;
+    keypads = NULL;
+    instance_frames = NULL;
+    observation_size = 0;
+    interleave_count = 1;
+
+    workers = NULL;
+    worker_count = 0;
+    generation = 0;
+    task = BATCH_TASK_STEP;
+    running = false;
+    active_count = 0;
+    pending_count = 0;
+    failure_count = 0;
+    episode_count = 0;
+
+    memset(&placement, 0, sizeof(batch_placement));
+    caller_affinity.valid = false;
+
+    step_inputs = NULL;
+    step_observations = NULL;
+    step_rewards = NULL;
+    step_dones = NULL;
+}
+
+batch_engine::~batch_engine()
+{
+    release();
+}
+
+void batch_engine::release()
+{
+    if (running)
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_lock);
+            running = false;
+        }
+
+        wake_signal.notify_all();
+
+        for (uint32 i = 1; i < worker_count; i++)
+        {
+            workers[i].thread.join();
+        }
+    }
+
+    // The calling thread was pinned along with the pool.
+    restore_thread_affinity(&caller_affinity);
+    caller_affinity.valid = false;
+
+    if (instances)
+    {
+        for (uint32 i = 0; i < config.instance_count; i++)
+        {
+            delete instances[i];
+        }
+    }
+
+    delete [] instances;
+    delete [] keypads;
+    delete [] instance_frames;
+    delete [] workers;
+    delete start_system;
+
+    instances = NULL;
+    keypads = NULL;
+    instance_frames = NULL;
+    workers = NULL;
+    worker_count = 0;
+    start_system = NULL;
+}
+
+status batch_engine::configure(const char *rom_filename, const batch_config *input)
+{
+    if (!rom_filename || !input || !input->instance_count || !input->frames_per_step)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    release();
+
+    config = *input;
+    observation_size = config.observation.output_width * config.observation.output_height;
+    interleave_count = max(1u, min(config.interleave_count, (uint32) BATCH_MAX_INTERLEAVE));
+
+    // There is no point in more threads than instances.
+    worker_count = config.thread_count ? config.thread_count : std::thread::hardware_concurrency();
+    worker_count = max(1u, min(worker_count, min(config.instance_count, (uint32) BATCH_MAX_THREADS)));
+
+    start_system = new famicom;
+    instances = new famicom *[config.instance_count];
+    keypads = new controller[2 * config.instance_count];
+    instance_frames = new uint32[config.instance_count];
+    workers = new batch_worker[worker_count];
+
+    if (!start_system || !instances || !keypads || !instance_frames || !workers)
+    {
+        release();
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    memset(instances, 0, config.instance_count * sizeof(famicom *));
+
+    if (base_failed(start_system->insert_rom(rom_filename, config.huge_pages)))
+    {
+        release();
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    place_workers();
+
+    memset(&stats, 0, sizeof(batch_stats));
+    episode_count = 0;
+    generation = 0;
+    running = true;
+
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        workers[i].range = 0;
+        workers[i].steal_count = 0;
+    }
+
+    // The calling thread is worker zero, and is only pinned if its previous 
+    // affinity can be restored afterwards.
+    if (config.pin_threads)
+    {
+        save_thread_affinity(&caller_affinity);
+        placement.worker_pinned[0] = caller_affinity.valid && pin_current_thread(placement.worker_cpus[0]);
+    }
+
+    for (uint32 i = 1; i < worker_count; i++)
+    {
+        workers[i].thread = std::thread(&batch_engine::run, this, i);
+    }
+
+    if (base_failed(dispatch(BATCH_TASK_CREATE)))
+    {
+        release();
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void batch_engine::place_workers()
+{
+    // Workers are spread across nodes before doubling up on any, so that every
+    // node's memory bandwidth is in use. Within a node they take its cpus in 
+    // order.
+    cpu_topology topology;
+    uint8 nodes[TOPOLOGY_MAX_NODES];
+    uint32 node_first[TOPOLOGY_MAX_NODES];
+    uint32 node_cpu_count[TOPOLOGY_MAX_NODES];
+    uint32 node_count = 0;
+
+    query_cpu_topology(&topology);
+
+    for (uint32 i = 0; i < topology.cpu_count; i++)
+    {
+        if (!node_count || nodes[node_count - 1] != topology.cpu_nodes[i])
+        {
+            nodes[node_count] = topology.cpu_nodes[i];
+            node_first[node_count] = i;
+            node_cpu_count[node_count] = 0;
+            node_count++;
+        }
+
+        node_cpu_count[node_count - 1]++;
+    }
+
+    memset(&placement, 0, sizeof(batch_placement));
+
+    placement.worker_count = worker_count;
+    placement.node_count = min(node_count, worker_count);
+    placement.nodes_detected = topology.nodes_detected;
+    placement.rom_pages = start_system->query_rom_page_kind();
+
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        uint32 node = i % node_count;
+        uint32 cpu = node_first[node] + (i / node_count) % node_cpu_count[node];
+
+        placement.worker_cpus[i] = topology.cpus[cpu];
+        placement.worker_nodes[i] = nodes[node];
+    }
+
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        uint32 count = 0;
+
+        for (uint32 j = 1; j < worker_count; j++)
+        {
+            uint32 victim = (i + j) % worker_count;
+
+            if (placement.worker_nodes[victim] == placement.worker_nodes[i])
+            {
+                workers[i].steal_order[count++] = victim;
+            }
+        }
+
+        for (uint32 j = 1; j < worker_count; j++)
+        {
+            uint32 victim = (i + j) % worker_count;
+
+            if (placement.worker_nodes[victim] != placement.worker_nodes[i])
+            {
+                workers[i].steal_order[count++] = victim;
+            }
+        }
+    }
+}
+
+void batch_engine::query_config(batch_config *output)
+{
+    *output = config;
+    output->thread_count = worker_count;
+    output->interleave_count = interleave_count;
+}
+
+void batch_engine::query_placement(batch_placement *output)
+{
+    *output = placement;
+}
+
+void batch_engine::query_stats(batch_stats *output)
+{
+    *output = stats;
+
+    output->steal_count = 0;
+    output->episode_count = episode_count.load(std::memory_order_relaxed);
+
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        output->steal_count += workers[i].steal_count.load(std::memory_order_relaxed);
+    }
+}
+
+uint32 batch_engine::query_observation_size()
+{
+    return observation_size;
+}
+
+status batch_engine::load_start_state(const famicom_state *input)
+{
+    if (!start_system)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    if (base_failed(start_system->load_state(input)))
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    return reset();
+}
+
+status batch_engine::reset()
+{
+    if (!workers)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    return dispatch(BATCH_TASK_RESTART);
+}
+
+status batch_engine::create_instance(uint32 index)
+{
+    famicom *system = new famicom;
+
+    if (!system)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    instances[index] = system;
+    system->attach_controller(0, &keypads[2 * index]);
+    system->attach_controller(1, &keypads[2 * index + 1]);
+
+    if (observation_size && base_failed(system->configure_observation(&config.observation)))
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    return restart_instance(index);
+}
+
+status batch_engine::restart_instance(uint32 index)
+{
+    // Clones only read from the start machine, so instances may restart on 
+    // several threads at once.
+    instance_frames[index] = 0;
+
+    return start_system->clone(instances[index]);
+}
+
+status batch_engine::step(const uint8 *inputs, uint8 *observations, uint8 *rewards, uint8 *dones)
+{
+    if (!workers)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    step_inputs = inputs;
+    step_observations = observations;
+    step_rewards = rewards;
+    step_dones = dones;
+
+    dispatch(BATCH_TASK_STEP);
+
+    stats.step_count++;
+    stats.frame_count += (uint64) config.instance_count * config.frames_per_step;
+    stats.step_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+status batch_engine::dispatch(uint8 input_task)
+{
+    // Runs a task over every instance and returns once every worker is done 
+    // with it, so that none is still looking for work when the next begins.
+    task = input_task;
+    pending_count.store(config.instance_count, std::memory_order_relaxed);
+    failure_count.store(0, std::memory_order_relaxed);
+
+    // Each thread starts out with an equal share, and the balance is left to
+    // stealing.
+    for (uint32 i = 0; i < worker_count; i++)
+    {
+        uint32 first = (uint32) ((uint64) config.instance_count * i / worker_count);
+        uint32 last = (uint32) ((uint64) config.instance_count * (i + 1) / worker_count);
+
+        workers[i].range.store(pack_range(first, last), std::memory_order_release);
+    }
+
+    if (worker_count > 1)
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_lock);
+            active_count.store(worker_count - 1, std::memory_order_relaxed);
+            generation++;
+        }
+
+        wake_signal.notify_all();
+    }
+
+    work(0);
+
+    while (pending_count.load(std::memory_order_acquire) || active_count.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    if (failure_count.load(std::memory_order_relaxed))
+    {
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void batch_engine::run(uint32 worker_index)
+{
+    uint32 last_generation = 0;
+
+    if (config.pin_threads)
+    {
+        placement.worker_pinned[worker_index] = pin_current_thread(placement.worker_cpus[worker_index]);
+    }
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(wake_lock);
+            wake_signal.wait(lock, [&] { return !running || generation != last_generation; });
+
+            if (!running)
+            {
+                return;
+            }
+
+            last_generation = generation;
+        }
+
+        work(worker_index);
+        active_count.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void batch_engine::work(uint32 worker_index)
+{
+    uint32 first = 0;
+    uint32 count = 0;
+
+    if (BATCH_TASK_STEP != task)
+    {
+        // Instances are created and restarted by the thread that starts out 
+        // with them, without stealing, so that their memory is local to it.
+        while (take_instances(worker_index, &first, &count))
+        {
+            for (uint32 i = first; i < first + count; i++)
+            {
+                status result = (BATCH_TASK_CREATE == task) ? create_instance(i) : restart_instance(i);
+
+                if (base_failed(result))
+                {
+                    failure_count.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            if (BATCH_TASK_CREATE == task)
+            {
+                placement.worker_instances[worker_index] += count;
+            }
+
+            pending_count.fetch_sub(count, std::memory_order_acq_rel);
+        }
+
+        return;
+    }
+
+    while (true)
+    {
+        if (take_instances(worker_index, &first, &count))
+        {
+            run_instances(first, count);
+            pending_count.fetch_sub(count, std::memory_order_acq_rel);
+        }
+        else if (!steal_instances(worker_index))
+        {
+            return;
+        }
+    }
+}
+
+bool batch_engine::take_instances(uint32 worker_index, uint32 *first_output, uint32 *count_output)
+{
+    // Takes up to interleave_count instances from the front of our range.
+    std::atomic<uint64> *range = &workers[worker_index].range;
+    uint64 current = range->load(std::memory_order_acquire);
+
+    while (true)
+    {
+        uint32 first = (uint32) (current >> 32);
+        uint32 last = (uint32) current;
+
+        if (first >= last)
+        {
+            return false;
+        }
+
+        uint32 count = min(last - first, interleave_count);
+
+        if (range->compare_exchange_weak(current, pack_range(first + count, last), std::memory_order_acq_rel, 
+                                         std::memory_order_acquire))
+        {
+            *first_output = first;
+            *count_output = count;
+            return true;
+        }
+    }
+}
+
+bool batch_engine::steal_instances(uint32 worker_index)
+{
+    // Takes the back half of the first range found, rounding up so that a
+    // single remaining instance can be taken. Our own range is empty, and no 
+    // thief touches an empty range, so it is simply replaced.
+    for (uint32 i = 0; i + 1 < worker_count; i++)
+    {
+        std::atomic<uint64> *range = &workers[workers[worker_index].steal_order[i]].range;
+        uint64 current = range->load(std::memory_order_acquire);
+
+        while (true)
+        {
+            uint32 first = (uint32) (current >> 32);
+            uint32 last = (uint32) current;
+
+            if (first >= last)
+            {
+                break;
+            }
+
+            uint32 split = last - (last - first + 1) / 2;
+
+            if (range->compare_exchange_weak(current, pack_range(first, split), std::memory_order_acq_rel, 
+                                             std::memory_order_acquire))
+            {
+                workers[worker_index].range.store(pack_range(split, last), std::memory_order_release);
+                workers[worker_index].steal_count.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void batch_engine::run_instances(uint32 first, uint32 count)
+{
+    for (uint32 i = first; i < first + count; i++)
+    {
+        apply_input(i);
+    }
+
+    // Only frames that are observed need to be drawn. With max pooling that 
+    // includes the one before the last.
+    uint32 frame_count = config.frames_per_step;
+    uint32 drawn_frames = 0;
+
+    if (observation_size && step_observations)
+    {
+        drawn_frames = (config.observation.max_pool && frame_count > 1) ? 2 : 1;
+    }
+
+    for (uint32 i = 0; i < frame_count; i++)
+    {
+        bool render = (i + drawn_frames >= frame_count);
+
+        if (1 == count)
+        {
+            instances[first]->tick(render);
+        }
+        else
+        {
+            // Machines take turns a few scanlines at a time. Before each turn the
+            // next machine's memory is requested, so that it is in cache by the
+            // time its turn comes.
+            for (uint32 j = 0; j < PPU_FRAME_SCANLINE_COUNT; j += BATCH_INTERLEAVE_SCANLINES)
+            {
+                uint32 scanline_count = min(BATCH_INTERLEAVE_SCANLINES, PPU_FRAME_SCANLINE_COUNT - j);
+
+                for (uint32 k = 0; k < count; k++)
+                {
+                    instances[first + (k + 1) % count]->prefetch();
+                    instances[first + k]->tick_scanlines(j, scanline_count, render);
+                }
+            }
+        }
+
+        if (2 == drawn_frames && i + 2 == frame_count)
+        {
+            for (uint32 k = 0; k < count; k++)
+            {
+                instances[first + k]->read_observation(NULL);
+            }
+        }
+    }
+
+    for (uint32 i = first; i < first + count; i++)
+    {
+        finish_step(i, drawn_frames);
+    }
+}
+
+void batch_engine::apply_input(uint32 index)
+{
+    if (step_inputs)
+    {
+        for (uint8 i = 0; i < 2; i++)
+        {
+            uint8 buttons = step_inputs[2 * index + i];
+
+            for (uint8 j = 0; j < 8; j++)
+            {
+                keypads[2 * index + i].set_button(j, (buttons >> j) & 0x1);
+            }
+        }
+    }
+}
+
+void batch_engine::finish_step(uint32 index, uint32 drawn_frames)
+{
+    famicom *system = instances[index];
+
+    if (drawn_frames)
+    {
+        system->read_observation(step_observations + index * observation_size);
+    }
+
+    if (step_rewards && config.reward_size)
+    {
+        system->read_system_ram(config.reward_address, step_rewards + index * config.reward_size, config.reward_size);
+    }
+
+    instance_frames[index] += config.frames_per_step;
+
+    bool done = config.episode_frames && instance_frames[index] >= config.episode_frames;
+
+    if (!done && config.done_mask)
+    {
+        uint8 value = 0;
+
+        system->read_system_ram(config.done_address, &value, 1);
+        done = (value & config.done_mask) == config.done_value;
+    }
+
+    if (done)
+    {
+        restart_instance(index);
+        episode_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (step_dones)
+    {
+        step_dones[index] = done;
+    }
+}
+
+} // namespace nes
@@ -0,0 +1,204 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// batch.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __BATCH_ENGINE_H__
+#define __BATCH_ENGINE_H__
+
+#include "base.h"
+#include "nes.h"
+#include "input.h"
+#include "topology.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define BATCH_MAX_THREADS                   (64)
+#define BATCH_MAX_INTERLEAVE                (16)
+#define BATCH_INTERLEAVE_SCANLINES          (8u)        // run by each machine per turn
+
+#define BATCH_TASK_CREATE                   (0)
+#define BATCH_TASK_RESTART                  (1)
+#define BATCH_TASK_STEP                     (2)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct batch_config
+{
+    uint32 instance_count;
+    uint32 thread_count;        // including the caller, zero for one per core
+    uint32 frames_per_step;     // only the last is observed
+    uint32 interleave_count;    // instances each thread runs side by side, zero for one at a time
+    uint32 episode_frames;      // instances restart after this many frames, zero for never
+    uint16 reward_address;      // system ram copied out after every step
+    uint16 reward_size;
+    uint16 done_address;        // an episode also ends once (ram & done_mask) == done_value
+    uint8 done_mask;            // zero to end episodes on the frame limit alone
+    uint8 done_value;
+    bool pin_threads;           // one cpu per thread, spread across memory nodes
+    bool huge_pages;            // back the shared rom with huge pages
+    observation_config observation;
+
+} batch_config;
+
+typedef struct batch_stats
+{
+    uint64 step_count;
+    uint64 frame_count;         // emulated across all instances
+    uint64 steal_count;         // ranges of instances taken from another thread
+    uint64 episode_count;       // completed episodes
+    float64 step_seconds;       // total time spent in step
+
+} batch_stats;
+
+typedef struct batch_placement
+{
+    uint32 worker_count;
+    uint32 node_count;          // memory nodes the workers were placed on
+    bool nodes_detected;        // false when every cpu was assumed to share one node
+    uint8 rom_pages;            // SHARED_PAGES_*
+    uint16 worker_cpus[BATCH_MAX_THREADS];
+    uint8 worker_nodes[BATCH_MAX_THREADS];
+    bool worker_pinned[BATCH_MAX_THREADS];
+    uint32 worker_instances[BATCH_MAX_THREADS];     // created on the node of each worker
+
+} batch_placement;
+
+// Each worker owns a range of instances packed as (begin << 32) | end. The 
+// owner takes instances from the front and idle workers steal the back half, 
+// both through compare and swap. Workers on the same node are stolen from 
+// first.
+typedef struct batch_worker
+{
+    std::atomic<uint64> range;
+    std::atomic<uint64> steal_count;
+    std::thread thread;
+    uint8 steal_order[BATCH_MAX_THREADS];
+
+} batch_worker;
+
+// Steps many instances of one game in parallel, for agents that train on 
+// batches of episodes. A step applies the input of every instance, emulates 
+// frames_per_step frames and writes out observations, reward ram and done 
+// flags into contiguous arrays indexed by instance. The cost of a frame varies
+// widely with what is on screen, so instances are not statically divided: 
+// threads that run out of work steal from those that have not. The calling 
+// thread works alongside the pool, which sleeps between steps.
+//
+// A thread may also take several instances at once and run them in turns of 
+// a few scanlines, prefetching the memory of each before its turn. Switching
+// between instances then overlaps cache misses with emulation instead of
+// stalling on them.
+//
+// Every instance is a clone of a start machine, sharing its rom, and returns
+// to it when its episode ends. Instances are created by the thread that 
+// starts out with them, so that with pinned threads their memory is allocated 
+// on that thread's node.
+
+class batch_engine
+{
+    batch_config config;
+    famicom *start_system;
+    famicom **instances;
+    controller *keypads;        // two per instance
+    uint32 *instance_frames;    // since each last restarted
+    uint32 observation_size;
+    uint32 interleave_count;
+
+    batch_worker *workers;
+    uint32 worker_count;
+    batch_placement placement;
+    thread_affinity caller_affinity;
+    std::mutex wake_lock;
+    std::condition_variable wake_signal;
+    uint32 generation;
+    uint8 task;
+    bool running;
+    std::atomic<uint32> active_count;
+    std::atomic<uint32> pending_count;
+    std::atomic<uint32> failure_count;
+    std::atomic<uint32> episode_count;
+
+    // Arrays of the step in progress.
+    const uint8 *step_inputs;
+    uint8 *step_observations;
+    uint8 *step_rewards;
+    uint8 *step_dones;
+
+    batch_stats stats;
+
+public:
+
+    batch_engine();
+    ~batch_engine();
+
+    status configure(const char *rom_filename, const batch_config *input);
+    void query_config(batch_config *output);
+    void query_stats(batch_stats *output);
+    void query_placement(batch_placement *output);
+    uint32 query_observation_size();
+
+    // Every instance starts from the given state instead of power on.
+    status load_start_state(const famicom_state *input);
+    status reset();
+
+    // inputs holds two bytes per instance, the buttons of each controller with
+    // bit n holding button n. observations receive query_observation_size 
+    // bytes per instance, rewards reward_size bytes and dones one byte, which
+    // is set when the instance has restarted after this step. Any output may 
+    // be null.
+    status step(const uint8 *inputs, uint8 *observations, uint8 *rewards, uint8 *dones);
+
+private:
+
+    void release();
+    void place_workers();
+    status dispatch(uint8 input_task);
+    void run(uint32 worker_index);
+    void work(uint32 worker_index);
+    bool take_instances(uint32 worker_index, uint32 *first_output, uint32 *count_output);
+    bool steal_instances(uint32 worker_index);
+    void run_instances(uint32 first, uint32 count);
+    void apply_input(uint32 index);
+    void finish_step(uint32 index, uint32 drawn_frames);
+    status create_instance(uint32 index);
+    status restart_instance(uint32 index);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(batch_engine);
+};
+
+} // namespace nes
+
+#endif // __BATCH_ENGINE_H__
@@ -0,0 +1,206 @@
+
+#include "boot.h"
+#include "hash.h"
+
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#if defined (_WIN32)
+#include <process.h>
+#define BOOT_CACHE_PROCESS_ID               _getpid
+#else
+#include <unistd.h>
+#define BOOT_CACHE_PROCESS_ID               getpid
+#endif
+
+// Room past the cache file name for the suffix of its temporary file.
+#define BOOT_CACHE_SUFFIX_LENGTH            (64)
+
+// Room left in a path for the file name that follows the directory.
+#define BOOT_CACHE_NAME_LENGTH              (64)
+
+namespace nes {
+
+boot_cache::boot_cache()
+{
+    directory[0] = 0;
+    memset(&stats, 0, sizeof(boot_cache_stats));
+}
+
+status boot_cache::configure(const char *cache_directory)
+{
+    if (!cache_directory || !cache_directory[0] || strlen(cache_directory) >= BOOT_CACHE_MAX_PATH - BOOT_CACHE_NAME_LENGTH)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    strcpy(directory, cache_directory);
+
+    return BASE_SUCCESS;
+}
+
+void boot_cache::query_stats(boot_cache_stats *output)
+{
+    *output = stats;
+}
+
+status boot_cache::query_filename(famicom *system, const boot_script *script, char *output, uint32 output_size)
+{
+    if (!system || !script || !output)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    uint64 rom_hash = system->query_rom_hash();
+
+    if (!directory[0] || !rom_hash)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    // Events from the last frame on are never applied, so they do not change
+    // the state.
+    uint32 version = FAMICOM_STATE_VERSION;
+    uint64 key = compute_hash64(&version, sizeof(uint32));
+
+    key = compute_hash64(&script->frame_count, sizeof(uint32), key);
+
+    if (script->name)
+    {
+        key = compute_hash64(script->name, (uint32) strlen(script->name), key);
+    }
+
+    for (uint32 i = 0; i < script->event_count && script->events[i].frame < script->frame_count; i++)
+    {
+        key = compute_hash64(&script->events[i].frame, sizeof(uint32), key);
+        key = compute_hash64(script->events[i].buttons, 2, key);
+    }
+
+    if (snprintf(output, output_size, "%s/%016llx-%016llx.boot", directory, 
+                 (unsigned long long) rom_hash, (unsigned long long) key) >= (int32) output_size)
+    {
+        return base_post_error(BASE_ERROR_CAPACITY_LIMIT);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void boot_cache::run_script(famicom *system, const boot_script *script, controller *gamepads)
+{
+    // Nothing drawn while booting is ever seen, so frames are only emulated.
+    uint32 next_event = 0;
+
+    for (uint32 frame = 0; frame < script->frame_count; frame++)
+    {
+        while (next_event < script->event_count && script->events[next_event].frame <= frame)
+        {
+            apply_input_event(&script->events[next_event++], gamepads);
+        }
+
+        system->tick(false);
+    }
+}
+
+status boot_cache::boot(famicom *system, const boot_script *script, controller *gamepads)
+{
+    if (!system || !script || !gamepads || (script->event_count && !script->events))
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    // A cached state is only the same as running the script from power on.
+    if (system->query_frame_count())
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    // Without a directory the cache keeps nothing and every script is run.
+    if (!directory[0])
+    {
+        run_script(system, script, gamepads);
+
+        stats.miss_count++;
+        stats.run_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+        return BASE_SUCCESS;
+    }
+
+    char filename[BOOT_CACHE_MAX_PATH];
+
+    if (base_failed(query_filename(system, script, filename, sizeof(filename))))
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    famicom_state *state = new famicom_state;
+
+    if (!state)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    FILE *file = fopen(filename, "rb");
+
+    if (file)
+    {
+        bool loaded = 1 == fread(state, sizeof(famicom_state), 1, file) && base_succeeded(system->load_state(state));
+
+        fclose(file);
+
+        if (loaded)
+        {
+            stats.hit_count++;
+            stats.load_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+            delete state;
+            return BASE_SUCCESS;
+        }
+    }
+
+    run_script(system, script, gamepads);
+
+    stats.miss_count++;
+    stats.run_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    system->save_state(state);
+
+    // Other processes, or other threads of this one, may miss on the same 
+    // script at the same time, so the temporary name tells all of them apart.
+    char temporary[BOOT_CACHE_MAX_PATH + BOOT_CACHE_SUFFIX_LENGTH];
+    uint64 thread_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+    int32 length = snprintf(temporary, sizeof(temporary), "%s.%u.%llx.%llx", filename, (uint32) BOOT_CACHE_PROCESS_ID(),
+                            (unsigned long long) thread_id, 
+                            (unsigned long long) std::chrono::steady_clock::now().time_since_epoch().count());
+
+    if (length < 0 || length >= (int32) sizeof(temporary))
+    {
+        stats.write_failure_count++;
+        delete state;
+
+        return BASE_SUCCESS;
+    }
+
+    file = fopen(temporary, "wb");
+
+    bool written = file && 1 == fwrite(state, sizeof(famicom_state), 1, file);
+
+    if (file && fclose(file))
+    {
+        written = false;
+    }
+
+    if (!written || rename(temporary, filename))
+    {
+        remove(temporary);
+        stats.write_failure_count++;
+    }
+
+    delete state;
+
+    return BASE_SUCCESS;
+}
+
+} // namespace nes
@@ -0,0 +1,99 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// boot.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __BOOT_CACHE_H__
+#define __BOOT_CACHE_H__
+
+#include "base.h"
+#include "nes.h"
+#include "input.h"
+
+#define BOOT_CACHE_MAX_PATH                 (1 * BASE_KB)
+
+namespace nes {
+
+using namespace base;
+
+// Input that takes a game from power on to where the useful work starts.
+typedef struct boot_script
+{
+    const char *name;
+    const input_event *events;
+    uint32 event_count;
+    uint32 frame_count;         // the machine is kept as it is after this many frames
+
+} boot_script;
+
+typedef struct boot_cache_stats
+{
+    uint32 hit_count;
+    uint32 miss_count;
+    uint32 write_failure_count; // states that could not be kept, which does not fail the boot
+    float64 load_seconds;       // total time spent on hits
+    float64 run_seconds;        // total time spent running scripts
+
+} boot_cache_stats;
+
+// Keeps the state a game is in at the end of a boot script, so that later 
+// runs start from it instead of emulating the same frames again. A state is
+// a file in the cache directory named after the rom hash and a hash of the 
+// script, its name, its length and the state layout, so changing any of them
+// runs the script afresh. Files are written under a temporary name and then
+// renamed, so processes sharing a directory never read a partial state. 
+// Until a directory is configured every script is simply run.
+
+class boot_cache
+{
+    char directory[BOOT_CACHE_MAX_PATH];
+    boot_cache_stats stats;
+
+public:
+
+    boot_cache();
+
+    status configure(const char *cache_directory);
+    void query_stats(boot_cache_stats *output);
+
+    // Takes a machine with a rom just inserted to the end of the script, with
+    // gamepads being the two controllers attached to it. After a hit the 
+    // picture is blank until the next frame is drawn.
+    status boot(famicom *system, const boot_script *script, controller *gamepads);
+    status query_filename(famicom *system, const boot_script *script, char *output, uint32 output_size);
+
+private:
+
+    void run_script(famicom *system, const boot_script *script, controller *gamepads);
+};
+
+} // namespace nes
+
+#endif // __BOOT_CACHE_H__
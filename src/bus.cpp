@@ -8,6 +8,8 @@ namespace nes {
 system_bus::system_bus()
 {
     game_cart = NULL;
+    cpu = NULL;
+    ppu = NULL;
     system_ram = new uint8[SYSTEM_RAM_SIZE];
     video_ram = new uint8[VIDEO_RAM_SIZE];
     palette_ram = new uint8[PALETTE_RAM_SIZE];
@@ -45,7 +47,8 @@ uint32 system_bus::query_current_scanline()
 
 void system_bus::load_cartridge_into_memory(cartridge *input)
 {
-    if (!ppu || !cpu)
+    // A bus may serve ppu memory alone, as it does for the render pipeline.
+    if (!ppu)
     {
         base_post_error(BASE_ERROR_INVALID_RESOURCE);
     }
@@ -60,6 +63,108 @@ rom_header *system_bus::query_rom_header()
     return &game_cart->header;
 }
 
+const uint8 *system_bus::query_video_ram()
+{
+    // Physical nametables sit 0x400 bytes apart, at the offsets mirroring maps to.
+    return video_ram;
+}
+
+void system_bus::save_state(bus_state *output)
+{
+    memcpy(output->system_ram, system_ram, SYSTEM_RAM_SIZE);
+    memcpy(output->video_ram, video_ram, VIDEO_RAM_SIZE);
+    memcpy(output->palette_ram, palette_ram, PALETTE_RAM_SIZE);
+    memcpy(output->save_ram, game_cart->save_ram, CARTRIDGE_SAVE_RAM_SIZE);
+    memcpy(output->tile_ram, game_cart->tile_rom, TILE_PAGE_SIZE);
+
+    for (uint8 i = 0; i < 2; i++)
+    {
+        if (keypads[i])
+        {
+            keypads[i]->save_state(&output->keypads[i]);
+        }
+        else
+        {
+            memset(&output->keypads[i], 0, sizeof(controller_state));
+        }
+    }
+}
+
+status system_bus::load_state(const bus_state *input)
+{
+    // Memory is replaced without notifying the ppu, which rebuilds whatever it 
+    // derives from it when its own state is loaded. Tile rom shared with a clone
+    // is claimed first, so that nothing is replaced if it cannot be.
+    bool tiles_changed = 0 != memcmp(game_cart->tile_rom, input->tile_ram, TILE_PAGE_SIZE);
+
+    if (tiles_changed && game_cart->tile_block && game_cart->tile_block->is_shared() && 
+        base_failed(claim_tile_rom(game_cart)))
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    memcpy(system_ram, input->system_ram, SYSTEM_RAM_SIZE);
+    memcpy(video_ram, input->video_ram, VIDEO_RAM_SIZE);
+    memcpy(palette_ram, input->palette_ram, PALETTE_RAM_SIZE);
+    memcpy(game_cart->save_ram, input->save_ram, CARTRIDGE_SAVE_RAM_SIZE);
+
+    if (tiles_changed)
+    {
+        memcpy(game_cart->tile_rom, input->tile_ram, TILE_PAGE_SIZE);
+    }
+
+    for (uint8 i = 0; i < 2; i++)
+    {
+        if (keypads[i])
+        {
+            keypads[i]->load_state(&input->keypads[i]);
+        }
+    }
+
+    return BASE_SUCCESS;
+}
+
+void system_bus::clone_from(const system_bus *source)
+{
+    // Cartridge memory comes with the cloned cartridge. Our controllers take on
+    // the state of the source's, but stay our own.
+    memcpy(system_ram, source->system_ram, SYSTEM_RAM_SIZE);
+    memcpy(video_ram, source->video_ram, VIDEO_RAM_SIZE);
+    memcpy(palette_ram, source->palette_ram, PALETTE_RAM_SIZE);
+
+    for (uint8 i = 0; i < 2; i++)
+    {
+        if (keypads[i] && source->keypads[i])
+        {
+            controller_state state;
+
+            source->keypads[i]->save_state(&state);
+            keypads[i]->load_state(&state);
+        }
+    }
+}
+
+void system_bus::prefetch(uint16 program_address)
+{
+    // All of system ram is only 32 lines, and code about to run is near the 
+    // program counter.
+    for (uint32 i = 0; i < SYSTEM_RAM_SIZE; i += 64)
+    {
+        BASE_PREFETCH(system_ram + i);
+    }
+
+    BASE_PREFETCH(palette_ram);
+
+    if (game_cart && program_address >= 0x8000)
+    {
+        uint32 program_size = PROGRAM_PAGE_SIZE * game_cart->header.prg_page_count;
+        const uint8 *program = &game_cart->program_rom[(program_address - 0x8000) % program_size];
+
+        BASE_PREFETCH(program);
+        BASE_PREFETCH(program + 64);
+    }
+}
+
 void system_bus::attach_ppu(virtual_ppu *input)
 {
     ppu = input;
@@ -293,6 +398,7 @@ void system_bus::write_ppu_byte(uint16 address, uint8 input)
 	    }
 
         palette_ram[(address - 0x3F00) & 0x1F] = input;
+        ppu->update_palette_cache((address - 0x3F00) & 0x1F, input);
     }
     else if (address >= 0x2000)
     {
@@ -310,10 +416,19 @@ void system_bus::write_ppu_byte(uint16 address, uint8 input)
         }
 
         video_ram[address] = input;
+        ppu->update_nametable_cache(address, input);
     }
     else
     {
+        // Tile rom shared with a clone is copied before it is changed. If it 
+        // cannot be, the write is dropped rather than seen by every clone.
+        if (game_cart->tile_block && game_cart->tile_block->is_shared() && base_failed(claim_tile_rom(game_cart)))
+        {
+            return;
+        }
+
         game_cart->tile_rom[address] = input;
+        ppu->invalidate_pattern_tile(address);
     }
 }
 
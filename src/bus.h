@@ -65,6 +65,20 @@ using namespace base;
 class virtual_cpu;
 class virtual_ppu;
 
+// Everything the bus and cartridge hold that a running game can change. Only
+// the first page of pattern memory and save ram is reachable, so that is all
+// that is kept.
+typedef struct bus_state
+{
+    uint8 system_ram[SYSTEM_RAM_SIZE];
+    uint8 video_ram[VIDEO_RAM_SIZE];
+    uint8 palette_ram[PALETTE_RAM_SIZE];
+    uint8 save_ram[CARTRIDGE_SAVE_RAM_SIZE];
+    uint8 tile_ram[TILE_PAGE_SIZE];
+    controller_state keypads[2];
+
+} bus_state;
+
 class system_bus
 {
     uint8 *system_ram;
@@ -104,6 +118,12 @@ public:
 
     uint32 query_current_scanline();
     rom_header *query_rom_header();
+    const uint8 *query_video_ram();
+
+    void save_state(bus_state *output);
+    status load_state(const bus_state *input);
+    void clone_from(const system_bus *source);
+    void prefetch(uint16 program_address);
 };
 
 } // namespace nes
@@ -29,7 +29,7 @@ static bool rom_file_has_unsupported_features(const rom_header &header)
     return (header.trainer || header.sram_avail || header.vram_expansion);
 }
 
-status load_game_cartridge(const char *filename, cartridge *output)
+status load_game_cartridge(const char *filename, cartridge *output, bool huge_pages)
 {
     if (BASE_PARAM_CHECK)
     {
@@ -39,6 +39,12 @@ status load_game_cartridge(const char *filename, cartridge *output)
         }
     }
 
+    output->program_rom = NULL;
+    output->tile_rom = NULL;
+    output->save_ram = NULL;
+    output->program_block = NULL;
+    output->tile_block = NULL;
+
     FILE *rom_file = fopen(filename, "rb");
 
     if (!rom_file)
@@ -68,17 +74,20 @@ status load_game_cartridge(const char *filename, cartridge *output)
     uint32 tile_data_size = TILE_PAGE_SIZE * output->header.tile_page_count;
     uint32 save_ram_size = SAVE_RAM_PAGE_SIZE * max(1, output->header.sram_page_count);
 
-    output->program_rom = new uint8[program_data_size];
-    output->tile_rom = new uint8[tile_data_size];
+    output->program_block = shared_block::create(program_data_size, huge_pages);
+    output->tile_block = shared_block::create(tile_data_size, huge_pages);
     output->save_ram = new uint8[save_ram_size];
 
-    if (!output->program_rom || !output->tile_rom || !output->save_ram)
+    if (!output->program_block || !output->tile_block || !output->save_ram)
     {
         fclose(rom_file);
         unload_game_cartridge(output);
         return base_post_error(BASE_ERROR_OUTOFMEMORY);
     }
 
+    output->program_rom = output->program_block->query_data();
+    output->tile_rom = output->tile_block->query_data();
+
     memset(output->program_rom, 0, program_data_size);
     memset(output->tile_rom, 0, tile_data_size);
     memset(output->save_ram, 0, save_ram_size);
@@ -91,6 +100,67 @@ status load_game_cartridge(const char *filename, cartridge *output)
         return base_post_error(BASE_ERROR_OUTOFMEMORY);
     }
 
+    fclose(rom_file);
+
+    return BASE_SUCCESS;
+}
+
+status clone_game_cartridge(const cartridge *input, cartridge *output)
+{
+    // Rom is shared with the input and save ram is copied, since games write 
+    // to it freely. An input without save ram yields cleared save ram.
+
+    if (BASE_PARAM_CHECK)
+    {
+        if (!input || !output || !input->program_block || !input->tile_block)
+        {
+            return base_post_error(BASE_ERROR_INVALIDARG);
+        }
+    }
+
+    uint32 save_ram_size = SAVE_RAM_PAGE_SIZE * max(1, input->header.sram_page_count);
+
+    output->header = input->header;
+    output->program_rom = NULL;
+    output->tile_rom = NULL;
+    output->program_block = NULL;
+    output->tile_block = NULL;
+    output->save_ram = new uint8[save_ram_size];
+
+    if (!output->save_ram)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    if (input->save_ram)
+    {
+        memcpy(output->save_ram, input->save_ram, save_ram_size);
+    }
+    else
+    {
+        memset(output->save_ram, 0, save_ram_size);
+    }
+
+    output->program_block = input->program_block->acquire();
+    output->tile_block = input->tile_block->acquire();
+    output->program_rom = output->program_block->query_data();
+    output->tile_rom = output->tile_block->query_data();
+
+    return BASE_SUCCESS;
+}
+
+status claim_tile_rom(cartridge *input)
+{
+    shared_block *block = claim_shared_block(input->tile_block);
+
+    if (!block)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    input->tile_block = block;
+    input->tile_rom = block->query_data();
+
     return BASE_SUCCESS;
 }
 
@@ -105,13 +175,23 @@ void unload_game_cartridge(cartridge *input)
         }
     }
 
-    delete [] input->program_rom;
-    delete [] input->tile_rom;
+    if (input->program_block)
+    {
+        input->program_block->release();
+    }
+
+    if (input->tile_block)
+    {
+        input->tile_block->release();
+    }
+
     delete [] input->save_ram;
 
     input->program_rom = NULL;
     input->tile_rom = NULL;
     input->save_ram = NULL;
+    input->program_block = NULL;
+    input->tile_block = NULL;
 }
 
 } // namespace nes
\ No newline at end of file
@@ -34,6 +34,7 @@
 #define __CARTRIDGE_H__
 
 #include "base.h"
+#include "shared.h"
 
 #define PROGRAM_PAGE_SIZE               (0x4000)
 #define TILE_PAGE_SIZE                  (0x2000)
@@ -68,16 +69,25 @@ typedef struct rom_header
 
 #pragma pack(pop)
 
+// Program and tile rom live in shared blocks so that clones of a running game
+// refer to the same memory. The pointers are their data, for fast access, and
+// tile rom is claimed before it is written since games may write to it.
 typedef struct cartridge 
 {
     rom_header header;
     uint8 *program_rom;
     uint8 *tile_rom;
     uint8 *save_ram;
+    shared_block *program_block;
+    shared_block *tile_block;
 
 } cartridge;
 
-status load_game_cartridge(const char *filename, cartridge *output);
+status load_game_cartridge(const char *filename, cartridge *output, bool huge_pages = false);
+
+status clone_game_cartridge(const cartridge *input, cartridge *output);
+
+status claim_tile_rom(cartridge *input);
 
 void unload_game_cartridge(cartridge *input);
 
@@ -0,0 +1,287 @@
+
+#include "convert.h"
+
+#if defined (BASE_SIMD_SSE2)
+#include "emmintrin.h"
+#endif
+
+#if defined (BASE_SIMD_AVX2)
+#include "immintrin.h"
+#endif
+
+namespace nes {
+
+typedef struct pixel_format_tables
+{
+    uint32 rgba[64];
+    uint32 bgra[64];
+    uint32 rgb565[64];          // widened so that every table can be gathered alike
+    uint32 yuv[64];             // y, u and v in the three lowest bytes
+
+} pixel_format_tables;
+
+static pixel_format_tables *create_format_tables()
+{
+    static pixel_format_tables tables;
+    const ppu_color *palette = query_system_palette();
+
+    for (int32 i = 0; i < 64; i++)
+    {
+        int32 r = palette[i].red;
+        int32 g = palette[i].green;
+        int32 b = palette[i].blue;
+
+        // Packed formats are stored little endian, so the first byte is lowest.
+        tables.rgba[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
+        tables.bgra[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        tables.rgb565[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+
+        // Rec. 601 limited range.
+        int32 y = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+        int32 u = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+        int32 v = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+
+        tables.yuv[i] = (v << 16) | (u << 8) | y;
+    }
+
+    return &tables;
+}
+
+static const pixel_format_tables *fetch_format_tables()
+{
+    static const pixel_format_tables *tables = create_format_tables();
+    return tables;
+}
+
+static void convert_row_32(const uint8 *indices, const uint32 *table, uint8 *output, uint32 width)
+{
+    // Rows start at an arbitrary caller stride, so every store is unaligned.
+    uint32 x = 0;
+
+#if defined (BASE_SIMD_AVX2)
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i slots = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (indices + x)));
+        slots = _mm256_and_si256(slots, _mm256_set1_epi32(0x3F));
+        _mm256_storeu_si256((__m256i *) (output + x * 4), _mm256_i32gather_epi32((const int *) table, slots, 4));
+    }
+#elif defined (BASE_SIMD_SSE2)
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i pixels = _mm_setr_epi32(table[indices[x] & 0x3F], table[indices[x + 1] & 0x3F], 
+                                        table[indices[x + 2] & 0x3F], table[indices[x + 3] & 0x3F]);
+
+        _mm_storeu_si128((__m128i *) (output + x * 4), pixels);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        uint32 pixel = table[indices[x] & 0x3F];
+        memcpy(output + x * 4, &pixel, 4);
+    }
+}
+
+static void convert_row_16(const uint8 *indices, const uint32 *table, uint8 *output, uint32 width)
+{
+    uint32 x = 0;
+
+#if defined (BASE_SIMD_AVX2)
+    __m256i mask = _mm256_set1_epi32(0x3F);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256i low = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (indices + x)));
+        __m256i high = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (indices + x + 8)));
+
+        low = _mm256_i32gather_epi32((const int *) table, _mm256_and_si256(low, mask), 4);
+        high = _mm256_i32gather_epi32((const int *) table, _mm256_and_si256(high, mask), 4);
+
+        // Packing works within 128 bit lanes, so the quarters are reordered after.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+        _mm256_storeu_si256((__m256i *) (output + x * 2), packed);
+    }
+#elif defined (BASE_SIMD_SSE2)
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i pixels = _mm_setr_epi16(table[indices[x] & 0x3F], table[indices[x + 1] & 0x3F], 
+                                        table[indices[x + 2] & 0x3F], table[indices[x + 3] & 0x3F], 
+                                        table[indices[x + 4] & 0x3F], table[indices[x + 5] & 0x3F], 
+                                        table[indices[x + 6] & 0x3F], table[indices[x + 7] & 0x3F]);
+
+        _mm_storeu_si128((__m128i *) (output + x * 2), pixels);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        uint16 pixel = table[indices[x] & 0x3F];
+        memcpy(output + x * 2, &pixel, 2);
+    }
+}
+
+static void convert_row_yuv(const uint8 *indices, const uint32 *table, uint8 *y_row, uint8 *u_row, uint8 *v_row, uint32 width)
+{
+    uint32 x = 0;
+
+#if defined (BASE_SIMD_AVX2)
+    // Bytes are grouped as yyyy uuuu vvvv within each lane, and the lanes are
+    // then interleaved so that each plane holds eight consecutive samples.
+    __m256i group = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                     0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i slots = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (indices + x)));
+        __m256i samples = _mm256_i32gather_epi32((const int *) table, _mm256_and_si256(slots, _mm256_set1_epi32(0x3F)), 4);
+
+        samples = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(samples, group), order);
+
+        __m128i luma = _mm256_castsi256_si128(samples);
+        __m128i chroma = _mm256_extracti128_si256(samples, 1);
+
+        _mm_storel_epi64((__m128i *) (y_row + x), luma);
+        _mm_storel_epi64((__m128i *) (u_row + x), _mm_srli_si128(luma, 8));
+        _mm_storel_epi64((__m128i *) (v_row + x), chroma);
+    }
+#elif defined (BASE_SIMD_SSE2)
+    __m128i low_byte = _mm_set1_epi32(0xFF);
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i low = _mm_setr_epi32(table[indices[x] & 0x3F], table[indices[x + 1] & 0x3F], 
+                                     table[indices[x + 2] & 0x3F], table[indices[x + 3] & 0x3F]);
+        __m128i high = _mm_setr_epi32(table[indices[x + 4] & 0x3F], table[indices[x + 5] & 0x3F], 
+                                      table[indices[x + 6] & 0x3F], table[indices[x + 7] & 0x3F]);
+
+        // Every component is below 256, so the signed packs never saturate.
+        __m128i luma = _mm_packs_epi32(_mm_and_si128(low, low_byte), _mm_and_si128(high, low_byte));
+        __m128i u = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(low, 8), low_byte), 
+                                    _mm_and_si128(_mm_srli_epi32(high, 8), low_byte));
+        __m128i v = _mm_packs_epi32(_mm_srli_epi32(low, 16), _mm_srli_epi32(high, 16));
+
+        _mm_storel_epi64((__m128i *) (y_row + x), _mm_packus_epi16(luma, luma));
+        _mm_storel_epi64((__m128i *) (u_row + x), _mm_packus_epi16(u, u));
+        _mm_storel_epi64((__m128i *) (v_row + x), _mm_packus_epi16(v, v));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        uint32 sample = table[indices[x] & 0x3F];
+
+        y_row[x] = sample & 0xFF;
+        u_row[x] = (sample >> 8) & 0xFF;
+        v_row[x] = (sample >> 16) & 0xFF;
+    }
+}
+
+static void average_chroma_rows(const uint8 *top, const uint8 *bottom, uint8 *output, uint32 width)
+{
+    // Each output sample is the rounded mean of a 2x2 block.
+    uint32 x = 0;
+
+#if defined (BASE_SIMD_SSE2)
+    __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    __m128i rounding = _mm_set1_epi16(2);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (top + x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (bottom + x));
+
+        __m128i sum = _mm_add_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8));
+        sum = _mm_add_epi16(sum, _mm_and_si128(b, low_bytes));
+        sum = _mm_add_epi16(sum, _mm_srli_epi16(b, 8));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+
+        _mm_storel_epi64((__m128i *) (output + x / 2), _mm_packus_epi16(sum, sum));
+    }
+#endif
+
+    for (; x + 1 < width; x += 2)
+    {
+        output[x / 2] = (top[x] + top[x + 1] + bottom[x] + bottom[x + 1] + 2) >> 2;
+    }
+
+    if (x < width)
+    {
+        output[x / 2] = (top[x] + bottom[x] + 1) >> 1;
+    }
+}
+
+uint32 query_pixel_format_size(uint8 format)
+{
+    // Bytes per pixel of the packed formats, or of the luma plane for I420.
+    switch (format)
+    {
+        case PIXEL_FORMAT_RGBA8888: 
+        case PIXEL_FORMAT_BGRA8888: return 4;
+        case PIXEL_FORMAT_RGB565: return 2;
+        case PIXEL_FORMAT_I420: return 1;
+    }
+
+    return 0;
+}
+
+status convert_frame(const ppu_frame_view *view, uint8 format, uint8 *output, uint32 stride)
+{
+    if (!view || !output || stride < view->width * query_pixel_format_size(format) || PIXEL_FORMAT_I420 == format)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    const pixel_format_tables *tables = fetch_format_tables();
+
+    for (uint32 y = 0; y < view->height; y++)
+    {
+        const uint8 *indices = view->indices + y * view->index_stride;
+        uint8 *dest = output + y * stride;
+
+        switch (format)
+        {
+            case PIXEL_FORMAT_RGBA8888: convert_row_32(indices, tables->rgba, dest, view->width); break;
+            case PIXEL_FORMAT_BGRA8888: convert_row_32(indices, tables->bgra, dest, view->width); break;
+            case PIXEL_FORMAT_RGB565: convert_row_16(indices, tables->rgb565, dest, view->width); break;
+        }
+    }
+
+    return BASE_SUCCESS;
+}
+
+status convert_frame_i420(const ppu_frame_view *view, uint8 *y_plane, uint32 y_stride, 
+                          uint8 *u_plane, uint32 u_stride, uint8 *v_plane, uint32 v_stride)
+{
+    uint32 chroma_width = (view ? (view->width + 1) / 2 : 0);
+
+    if (!view || !y_plane || !u_plane || !v_plane || y_stride < view->width || 
+        u_stride < chroma_width || v_stride < chroma_width)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    const pixel_format_tables *tables = fetch_format_tables();
+    uint8 u_rows[2][PPU_FRAME_WIDTH];
+    uint8 v_rows[2][PPU_FRAME_WIDTH];
+
+    for (uint32 y = 0; y < view->height; y += 2)
+    {
+        // An odd final row is paired with itself.
+        uint32 rows = min(view->height - y, 2);
+
+        for (uint32 i = 0; i < rows; i++)
+        {
+            const uint8 *indices = view->indices + (y + i) * view->index_stride;
+
+            convert_row_yuv(indices, tables->yuv, y_plane + (y + i) * y_stride, u_rows[i], v_rows[i], view->width);
+        }
+
+        average_chroma_rows(u_rows[0], u_rows[rows - 1], u_plane + (y / 2) * u_stride, view->width);
+        average_chroma_rows(v_rows[0], v_rows[rows - 1], v_plane + (y / 2) * v_stride, view->width);
+    }
+
+    return BASE_SUCCESS;
+}
+
+} // namespace nes
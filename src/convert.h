@@ -0,0 +1,62 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// convert.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __PIXEL_CONVERT_H__
+#define __PIXEL_CONVERT_H__
+
+#include "base.h"
+#include "ppu.h"
+
+#define PIXEL_FORMAT_RGBA8888               (0)
+#define PIXEL_FORMAT_BGRA8888               (1)
+#define PIXEL_FORMAT_RGB565                 (2)
+#define PIXEL_FORMAT_I420                   (3)    // planar, chroma subsampled 2x2
+
+namespace nes {
+
+using namespace base;
+
+// Converts a frame into the formats our consumers want, writing directly into
+// caller owned memory with any row stride. Conversion starts from the system 
+// palette indices of the frame, so every format is a table lookup per pixel 
+// plus, for I420, a 2x2 chroma average.
+
+uint32 query_pixel_format_size(uint8 format);
+
+status convert_frame(const ppu_frame_view *view, uint8 format, uint8 *output, uint32 stride);
+
+status convert_frame_i420(const ppu_frame_view *view, uint8 *y_plane, uint32 y_stride, 
+                          uint8 *u_plane, uint32 u_stride, uint8 *v_plane, uint32 v_stride);
+
+} // namespace nes
+
+#endif // __PIXEL_CONVERT_H__
@@ -75,6 +75,33 @@ void virtual_cpu::step()
     }
 }
 
+uint64 virtual_cpu::query_cycle_count()
+{
+    return cycle_count;
+}
+
+void virtual_cpu::prefetch()
+{
+    BASE_PREFETCH(&registers);
+    bus->prefetch(registers.pc);
+}
+
+void virtual_cpu::save_state(cpu_state *output)
+{
+    output->registers = registers;
+    output->interrupt_signal = interrupt_signal;
+    output->instruction_count = instruction_count;
+    output->cycle_count = cycle_count;
+}
+
+void virtual_cpu::load_state(const cpu_state *input)
+{
+    registers = input->registers;
+    interrupt_signal = input->interrupt_signal;
+    instruction_count = input->instruction_count;
+    cycle_count = input->cycle_count;
+}
+
 void virtual_cpu::fire_interrupt(uint16 input)
 {
     if (registers.status_flags.interrupt_disable)
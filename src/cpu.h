@@ -76,12 +76,21 @@ typedef struct cpu_register_set
 
 } cpu_register_set;
 
+typedef struct cpu_state
+{
+    cpu_register_set registers;
+    uint16 interrupt_signal;
+    uint32 instruction_count;
+    uint64 cycle_count;
+
+} cpu_state;
+
 class virtual_cpu
 {
     cpu_register_set registers;
     uint16 interrupt_signal;
     system_bus *bus;
-    uint32 cycle_count;
+    uint64 cycle_count;
     uint32 instruction_count;
 
 public:
@@ -93,6 +102,11 @@ public:
     void fire_interrupt(uint16 input);
     void reset();
     void step();
+    uint64 query_cycle_count();
+    void prefetch();
+
+    void save_state(cpu_state *output);
+    void load_state(const cpu_state *input);
 
 private:
 
@@ -0,0 +1,104 @@
+
+#include "delta.h"
+
+#if defined (BASE_SIMD_SSE2)
+#include "emmintrin.h"
+#endif
+
+namespace nes {
+
+static uint8 *write_varint(uint8 *output, uint32 value)
+{
+    while (value >= 0x80)
+    {
+        *output++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    *output++ = value;
+
+    return output;
+}
+
+static const uint8 *read_varint(const uint8 *input, uint32 *value)
+{
+    uint32 shift = 0;
+
+    *value = 0;
+
+    do
+    {
+        *value |= (*input & 0x7F) << shift;
+        shift += 7;
+    } while (*input++ & 0x80);
+
+    return input;
+}
+
+uint32 encode_difference(const uint8 *input, const uint8 *previous, uint32 size, uint8 *output)
+{
+    // Blocks tend to be mostly equal, so the equal runs are skipped sixteen 
+    // bytes at a time.
+
+    uint8 *start = output;
+    uint32 i = 0;
+
+    while (i < size)
+    {
+        uint32 run_start = i;
+
+#if defined (BASE_SIMD_SSE2)
+        while (i + 16 <= size && 0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (input + i)),
+                                                                            _mm_loadu_si128((const __m128i *) (previous + i)))))
+        {
+            i += 16;
+        }
+#endif
+        while (i < size && input[i] == previous[i])
+        {
+            i++;
+        }
+
+        uint32 literal_start = i;
+
+        while (i < size && !(input[i] == previous[i] && (i + 1 == size || input[i + 1] == previous[i + 1])))
+        {
+            i++;
+        }
+
+        output = write_varint(output, literal_start - run_start);
+        output = write_varint(output, i - literal_start);
+
+        for (uint32 j = literal_start; j < i; j++)
+        {
+            *output++ = input[j] ^ previous[j];
+        }
+    }
+
+    return (uint32) (output - start);
+}
+
+void apply_difference(uint8 *output, const uint8 *input, uint32 input_size)
+{
+    const uint8 *end = input + input_size;
+
+    while (input < end)
+    {
+        uint32 run = 0;
+        uint32 literal = 0;
+
+        input = read_varint(input, &run);
+        input = read_varint(input, &literal);
+        output += run;
+
+        for (uint32 i = 0; i < literal; i++)
+        {
+            output[i] ^= input[i];
+        }
+
+        output += literal;
+        input += literal;
+    }
+}
+
+} // namespace nes
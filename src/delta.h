@@ -0,0 +1,58 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// delta.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __DELTA_CODER_H__
+#define __DELTA_CODER_H__
+
+#include "base.h"
+
+// Worst case size of an encoded block. Literals continue across single equal
+// bytes, so each token covers at least two bytes more than its literals.
+#define DELTA_ENCODE_BOUND(size)            ((size) + (size) / 64 + 16)
+
+namespace nes {
+
+using namespace base;
+
+// Writes the xor of two equally sized blocks as a series of tokens, each 
+// holding the length of a run of equal bytes followed by a count of differing
+// bytes and their xor. Returns the number of bytes written, which is at most 
+// DELTA_ENCODE_BOUND(size).
+uint32 encode_difference(const uint8 *input, const uint8 *previous, uint32 size, uint8 *output);
+
+// Applies an encoded difference in place. The difference works in both 
+// directions, so applying it to either block yields the other.
+void apply_difference(uint8 *output, const uint8 *input, uint32 input_size);
+
+} // namespace nes
+
+#endif // __DELTA_CODER_H__
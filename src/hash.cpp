@@ -0,0 +1,138 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// hash.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "hash.h"
+
+#define HASH_PRIME64_1                      (0x9E3779B185EBCA87ULL)
+#define HASH_PRIME64_2                      (0xC2B2AE3D27D4EB4FULL)
+#define HASH_PRIME64_3                      (0x165667B19E3779F9ULL)
+#define HASH_PRIME64_4                      (0x85EBCA77C2B2AE63ULL)
+#define HASH_PRIME64_5                      (0x27D4EB2F165667C5ULL)
+
+namespace nes {
+
+static inline uint64 rotate_left(uint64 value, uint32 count)
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+static inline uint64 read_uint64(const uint8 *data)
+{
+    uint64 value;
+    memcpy(&value, data, sizeof(uint64));
+    return value;
+}
+
+static inline uint32 read_uint32(const uint8 *data)
+{
+    uint32 value;
+    memcpy(&value, data, sizeof(uint32));
+    return value;
+}
+
+static inline uint64 mix_round(uint64 accumulator, uint64 input)
+{
+    accumulator += input * HASH_PRIME64_2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * HASH_PRIME64_1;
+}
+
+static inline uint64 merge_round(uint64 accumulator, uint64 value)
+{
+    accumulator ^= mix_round(0, value);
+    return accumulator * HASH_PRIME64_1 + HASH_PRIME64_4;
+}
+
+uint64 compute_hash64(const void *data, uint32 size, uint64 seed)
+{
+    // Four independent lanes consume 32 bytes per step, which keeps several 
+    // multiplies in flight. Reads are little endian on every supported target.
+    const uint8 *input = (const uint8 *) data;
+    const uint8 *end = input + size;
+    uint64 hash;
+
+    if (size >= 32)
+    {
+        uint64 lanes[4] = { seed + HASH_PRIME64_1 + HASH_PRIME64_2, seed + HASH_PRIME64_2, seed, seed - HASH_PRIME64_1 };
+
+        for (; input + 32 <= end; input += 32)
+        {
+            lanes[0] = mix_round(lanes[0], read_uint64(input + 0));
+            lanes[1] = mix_round(lanes[1], read_uint64(input + 8));
+            lanes[2] = mix_round(lanes[2], read_uint64(input + 16));
+            lanes[3] = mix_round(lanes[3], read_uint64(input + 24));
+        }
+
+        hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+
+        for (uint32 i = 0; i < 4; i++)
+        {
+            hash = merge_round(hash, lanes[i]);
+        }
+    }
+    else
+    {
+        hash = seed + HASH_PRIME64_5;
+    }
+
+    hash += size;
+
+    for (; input + 8 <= end; input += 8)
+    {
+        hash ^= mix_round(0, read_uint64(input));
+        hash = rotate_left(hash, 27) * HASH_PRIME64_1 + HASH_PRIME64_4;
+    }
+
+    if (input + 4 <= end)
+    {
+        hash ^= read_uint32(input) * HASH_PRIME64_1;
+        hash = rotate_left(hash, 23) * HASH_PRIME64_2 + HASH_PRIME64_3;
+        input += 4;
+    }
+
+    for (; input < end; input++)
+    {
+        hash ^= (*input) * HASH_PRIME64_5;
+        hash = rotate_left(hash, 11) * HASH_PRIME64_1;
+    }
+
+    // Final avalanche.
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+} // namespace nes
@@ -0,0 +1,356 @@
+
+#include "hibernate.h"
+
+#include <chrono>
+
+#define SESSION_INITIAL_CAPACITY            (64)
+
+namespace nes {
+
+session_pool::session_pool()
+{
+    config.memory_limit = SESSION_DEFAULT_MEMORY_LIMIT;
+
+    entries = NULL;
+    entry_capacity = 0;
+    free_entry = SESSION_NONE;
+    recent_entry = SESSION_NONE;
+    stale_entry = SESSION_NONE;
+
+    memset(&stats, 0, sizeof(session_stats));
+}
+
+session_pool::~session_pool()
+{
+    release();
+}
+
+void session_pool::release()
+{
+    for (uint32 i = 0; i < entry_capacity; i++)
+    {
+        if (entries[i].in_use)
+        {
+            remove_session(i);
+        }
+    }
+
+    delete [] entries;
+
+    entries = NULL;
+    entry_capacity = 0;
+    free_entry = SESSION_NONE;
+}
+
+status session_pool::configure(const session_config *input)
+{
+    if (!input || !input->memory_limit)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    config = *input;
+    enforce_memory_limit(SESSION_NONE);
+
+    return BASE_SUCCESS;
+}
+
+void session_pool::query_config(session_config *output)
+{
+    *output = config;
+}
+
+void session_pool::query_stats(session_stats *output)
+{
+    *output = stats;
+}
+
+status session_pool::allocate_entry(uint32 *output_index)
+{
+    // Ids index the entries, so the array grows rather than moving anyone.
+    if (SESSION_NONE == free_entry)
+    {
+        uint32 capacity = entry_capacity ? 2 * entry_capacity : SESSION_INITIAL_CAPACITY;
+        session_entry *grown = new session_entry[capacity];
+
+        if (!grown)
+        {
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+
+        if (entries)
+        {
+            memcpy(grown, entries, entry_capacity * sizeof(session_entry));
+        }
+
+        memset(grown + entry_capacity, 0, (capacity - entry_capacity) * sizeof(session_entry));
+
+        for (uint32 i = capacity; i > entry_capacity; i--)
+        {
+            grown[i - 1].next = free_entry;
+            free_entry = i - 1;
+        }
+
+        delete [] entries;
+
+        entries = grown;
+        entry_capacity = capacity;
+    }
+
+    *output_index = free_entry;
+    free_entry = entries[free_entry].next;
+
+    return BASE_SUCCESS;
+}
+
+bool session_pool::is_valid_session(uint32 id)
+{
+    return id < entry_capacity && entries[id].in_use;
+}
+
+void session_pool::link_recent(uint32 index)
+{
+    session_entry *entry = &entries[index];
+
+    entry->previous = SESSION_NONE;
+    entry->next = recent_entry;
+
+    if (SESSION_NONE != recent_entry)
+    {
+        entries[recent_entry].previous = index;
+    }
+    else
+    {
+        stale_entry = index;
+    }
+
+    recent_entry = index;
+}
+
+void session_pool::unlink(uint32 index)
+{
+    session_entry *entry = &entries[index];
+
+    if (SESSION_NONE != entry->previous)
+    {
+        entries[entry->previous].next = entry->next;
+    }
+    else
+    {
+        recent_entry = entry->next;
+    }
+
+    if (SESSION_NONE != entry->next)
+    {
+        entries[entry->next].previous = entry->previous;
+    }
+    else
+    {
+        stale_entry = entry->previous;
+    }
+
+    entry->previous = SESSION_NONE;
+    entry->next = SESSION_NONE;
+}
+
+void session_pool::measure(uint32 index)
+{
+    session_entry *entry = &entries[index];
+    uint32 memory_used = entry->system->query_memory_usage();
+
+    stats.awake_bytes += memory_used;
+    stats.awake_bytes -= entry->memory_used;
+    entry->memory_used = memory_used;
+}
+
+status session_pool::add_session(famicom *system, uint32 *output_id)
+{
+    if (!system || !output_id)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    uint32 index = 0;
+
+    if (base_failed(allocate_entry(&index)))
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    if (SESSION_NONE != recent_entry)
+    {
+        measure(recent_entry);
+    }
+
+    session_entry *entry = &entries[index];
+
+    memset(entry, 0, sizeof(session_entry));
+
+    entry->system = system;
+    entry->in_use = true;
+
+    link_recent(index);
+    measure(index);
+
+    stats.session_count++;
+    stats.awake_count++;
+
+    enforce_memory_limit(index);
+
+    *output_id = index;
+
+    return BASE_SUCCESS;
+}
+
+void session_pool::remove_session(uint32 id)
+{
+    if (!is_valid_session(id))
+    {
+        base_post_error(BASE_ERROR_INVALIDARG);
+        return;
+    }
+
+    session_entry *entry = &entries[id];
+
+    if (entry->system)
+    {
+        unlink(id);
+        delete entry->system;
+
+        stats.awake_bytes -= entry->memory_used;
+        stats.awake_count--;
+    }
+    else
+    {
+        release_hibernated_famicom(&entry->image);
+        stats.hibernated_bytes -= entry->memory_used;
+    }
+
+    memset(entry, 0, sizeof(session_entry));
+
+    entry->next = free_entry;
+    free_entry = id;
+
+    stats.session_count--;
+}
+
+famicom *session_pool::acquire_session(uint32 id)
+{
+    if (!is_valid_session(id))
+    {
+        base_post_error(BASE_ERROR_INVALIDARG);
+        return NULL;
+    }
+
+    session_entry *entry = &entries[id];
+
+    if (recent_entry == id)
+    {
+        return entry->system;
+    }
+
+    // The session acquired before this one has most likely been run since, 
+    // and drawn into frame buffers of its own.
+    if (SESSION_NONE != recent_entry)
+    {
+        measure(recent_entry);
+    }
+
+    if (entry->system)
+    {
+        unlink(id);
+    }
+    else
+    {
+        auto begin = std::chrono::steady_clock::now();
+        famicom *system = new famicom;
+
+        if (!system || base_failed(system->wake(&entry->image)))
+        {
+            delete system;
+            base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+
+            return NULL;
+        }
+
+        release_hibernated_famicom(&entry->image);
+
+        stats.hibernated_bytes -= entry->memory_used;
+        stats.awake_count++;
+
+        entry->system = system;
+        entry->memory_used = 0;
+
+        measure(id);
+
+        stats.wake_count++;
+        stats.wake_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    link_recent(id);
+    enforce_memory_limit(id);
+
+    return entry->system;
+}
+
+status session_pool::hibernate_session(uint32 id)
+{
+    if (!is_valid_session(id))
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!entries[id].system)
+    {
+        return BASE_SUCCESS;
+    }
+
+    return hibernate_entry(id);
+}
+
+bool session_pool::is_session_awake(uint32 id)
+{
+    return is_valid_session(id) && entries[id].system;
+}
+
+status session_pool::hibernate_entry(uint32 index)
+{
+    auto begin = std::chrono::steady_clock::now();
+    session_entry *entry = &entries[index];
+
+    if (base_failed(entry->system->hibernate(&entry->image)))
+    {
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    unlink(index);
+    delete entry->system;
+
+    stats.awake_bytes -= entry->memory_used;
+    stats.awake_count--;
+
+    entry->system = NULL;
+    entry->memory_used = sizeof(session_entry) + entry->image.size;
+
+    stats.hibernated_bytes += entry->memory_used;
+    stats.hibernate_count++;
+    stats.hibernate_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+void session_pool::enforce_memory_limit(uint32 keep_index)
+{
+    // The session being handed out is never hibernated, even when it alone
+    // exceeds the budget.
+    while (stats.awake_bytes + stats.hibernated_bytes > config.memory_limit && 
+           SESSION_NONE != stale_entry && keep_index != stale_entry)
+    {
+        if (base_failed(hibernate_entry(stale_entry)))
+        {
+            break;
+        }
+    }
+}
+
+} // namespace nes
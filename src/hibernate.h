@@ -0,0 +1,134 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// hibernate.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __SESSION_POOL_H__
+#define __SESSION_POOL_H__
+
+#include "base.h"
+#include "nes.h"
+
+#define SESSION_DEFAULT_MEMORY_LIMIT        (0x10000000)    // 256 MB
+#define SESSION_NONE                        (0xFFFFFFFF)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct session_config
+{
+    uint64 memory_limit;        // bytes of awake machines and hibernated states together
+
+} session_config;
+
+typedef struct session_stats
+{
+    uint32 session_count;
+    uint32 awake_count;
+    uint64 awake_bytes;         // as each machine was last measured
+    uint64 hibernated_bytes;
+    uint64 hibernate_count;
+    uint64 wake_count;
+    float64 hibernate_seconds;  // total time spent hibernating
+    float64 wake_seconds;       // total time spent waking
+
+} session_stats;
+
+typedef struct session_entry
+{
+    famicom *system;            // null while hibernated
+    hibernated_famicom image;
+    uint32 memory_used;
+    uint32 previous;            // neighbours among the awake sessions, or the next free entry
+    uint32 next;
+    bool in_use;
+
+} session_entry;
+
+// Holds many mostly idle machines within a memory budget. Awake sessions are 
+// kept in order of use, and whenever the budget is exceeded the least 
+// recently used are hibernated, which frees everything but a few kilobytes of
+// compressed state and a share of the rom. Acquiring a hibernated session 
+// wakes it into a new machine. A machine is measured when it is added or 
+// woken, and again when another session is acquired after it, since that is
+// when its caller has finished running it. The pool is not thread safe.
+
+class session_pool
+{
+    session_config config;
+
+    session_entry *entries;
+    uint32 entry_capacity;
+    uint32 free_entry;
+    uint32 recent_entry;        // most recently used awake session
+    uint32 stale_entry;         // least recently used
+
+    session_stats stats;
+
+public:
+
+    session_pool();
+    ~session_pool();
+
+    status configure(const session_config *input);
+    void query_config(session_config *output);
+    void query_stats(session_stats *output);
+
+    // Takes ownership of a machine created with new that has a rom inserted.
+    status add_session(famicom *system, uint32 *output_id);
+    void remove_session(uint32 id);
+
+    // Returns the machine of a session, waking it if needed, or null if it 
+    // could not be woken. The machine is only valid until the next call that
+    // adds or acquires a session, which may hibernate it. A woken machine has
+    // no controllers attached and its settings are the defaults.
+    famicom *acquire_session(uint32 id);
+    status hibernate_session(uint32 id);
+    bool is_session_awake(uint32 id);
+
+private:
+
+    void release();
+    status allocate_entry(uint32 *output_index);
+    bool is_valid_session(uint32 id);
+
+    void link_recent(uint32 index);
+    void unlink(uint32 index);
+    void measure(uint32 index);
+    status hibernate_entry(uint32 index);
+    void enforce_memory_limit(uint32 keep_index);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(session_pool);
+};
+
+} // namespace nes
+
+#endif // __SESSION_POOL_H__
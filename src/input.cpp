@@ -1,8 +1,13 @@
 
 #include "input.h"
 
+#define INPUT_MAX_LINE_LENGTH               (1 * BASE_KB)
+
 namespace nes {
 
+// Button names in controller order.
+static const char *button_names[] = { "a", "b", "select", "start", "up", "down", "left", "right" };
+
 controller::controller()
 {
     memset(buttons, 0, 8 * sizeof(bool));
@@ -55,6 +60,168 @@ bool controller::get_button(uint8 index)
     {
         return buttons[index];
     }
+
+    return false;
+}
+
+void controller::save_state(controller_state *output)
+{
+    output->buttons = 0;
+
+    for (uint8 i = 0; i < 8; i++)
+    {
+        output->buttons |= buttons[i] << i;
+    }
+
+    output->index = index;
+    output->strobe = strobe;
+}
+
+void controller::load_state(const controller_state *input)
+{
+    for (uint8 i = 0; i < 8; i++)
+    {
+        buttons[i] = (input->buttons >> i) & 0x1;
+    }
+
+    index = input->index;
+    strobe = input->strobe;
+}
+
+static status parse_input_line(char *line, input_event *events, uint32 *event_count)
+{
+    // Lines holding only a comment or nothing at all add no event.
+    char *comment = strchr(line, '#');
+    char *token = NULL;
+
+    if (comment)
+    {
+        *comment = 0;
+    }
+
+    if (!(token = strtok(line, " \t\r\n")))
+    {
+        return BASE_SUCCESS;
+    }
+
+    if (*event_count >= INPUT_MAX_SCRIPT_EVENTS)
+    {
+        return base_post_error(BASE_ERROR_CAPACITY_LIMIT);
+    }
+
+    input_event *event = &events[*event_count];
+    uint8 player = 0;
+
+    event->frame = atoi(token);
+    event->buttons[0] = 0;
+    event->buttons[1] = 0;
+
+    while ((token = strtok(NULL, " \t\r\n")))
+    {
+        if (0 == strcmp(token, "|"))
+        {
+            player = 1;
+            continue;
+        }
+
+        uint8 button = 0;
+
+        while (button < 8 && strcmp(token, button_names[button]))
+        {
+            button++;
+        }
+
+        if (8 == button)
+        {
+            base_msg("Unknown button '%s' in input script", token);
+            return base_post_error(BASE_ERROR_INVALIDARG);
+        }
+
+        event->buttons[player] |= (1 << button);
+    }
+
+    if (*event_count && event->frame < events[*event_count - 1].frame)
+    {
+        base_msg("Input frames must be in ascending order");
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    (*event_count)++;
+
+    return BASE_SUCCESS;
+}
+
+status load_input_script(const char *filename, input_event *events, uint32 *event_count)
+{
+    if (!filename || !events || !event_count)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    FILE *file = fopen(filename, "r");
+    char line[INPUT_MAX_LINE_LENGTH];
+
+    if (!file)
+    {
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+
+    *event_count = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (base_failed(parse_input_line(line, events, event_count)))
+        {
+            fclose(file);
+            return base_post_error(BASE_ERROR_INVALIDARG);
+        }
+    }
+
+    fclose(file);
+
+    return BASE_SUCCESS;
+}
+
+status parse_input_script(const char *text, input_event *events, uint32 *event_count)
+{
+    if (!text || !events || !event_count)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    char line[INPUT_MAX_LINE_LENGTH];
+
+    *event_count = 0;
+
+    while (*text)
+    {
+        const char *end = strchr(text, '\n');
+        uint32 length = end ? (uint32) (end - text) : (uint32) strlen(text);
+        uint32 copied = min(length, (uint32) sizeof(line) - 1);
+
+        memcpy(line, text, copied);
+        line[copied] = 0;
+
+        if (base_failed(parse_input_line(line, events, event_count)))
+        {
+            return base_post_error(BASE_ERROR_INVALIDARG);
+        }
+
+        text += length + (end ? 1 : 0);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void apply_input_event(const input_event *event, controller *gamepads)
+{
+    for (uint8 player = 0; player < 2; player++)
+    {
+        for (uint8 button = 0; button < 8; button++)
+        {
+            gamepads[player].set_button(button, 0 != (event->buttons[player] & (1 << button)));
+        }
+    }
 }
 
-} // namespace nes
\ No newline at end of file
+} // namespace nes
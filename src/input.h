@@ -35,10 +35,20 @@
 
 #include "base.h"
 
+#define INPUT_MAX_SCRIPT_EVENTS             (0x10000)
+
 namespace nes {
 
 using namespace base;
 
+typedef struct controller_state
+{
+    uint8 buttons;              // bit n holds button n
+    uint8 index;
+    uint8 strobe;
+
+} controller_state;
+
 class controller
 {
     bool buttons[8];
@@ -55,8 +65,28 @@ public:
     void write(uint8 value);
     void set_button(uint8 index, bool state);
     bool get_button(uint8 index);
+
+    void save_state(controller_state *output);
+    void load_state(const controller_state *input);
 };
 
+// The buttons held on both controllers from a frame on.
+typedef struct input_event
+{
+    uint32 frame;
+    uint8 buttons[2];           // bit n holds button n
+
+} input_event;
+
+// Each line of a script holds a frame number followed by the buttons held 
+// from that frame on, for example "120 start" or "300 right a | left". Buttons
+// after a '|' belong to the second controller, and '#' begins a comment. 
+// Events must hold INPUT_MAX_SCRIPT_EVENTS.
+status load_input_script(const char *filename, input_event *events, uint32 *event_count);
+status parse_input_script(const char *text, input_event *events, uint32 *event_count);
+
+void apply_input_event(const input_event *event, controller *gamepads);
+
 } // namespace nes
 
 #endif // __CARTRIDGE_H__
\ No newline at end of file
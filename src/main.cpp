@@ -30,9 +30,21 @@ uint8 frame_data[FAMICOM_VIDEO_WIDTH * FAMICOM_VIDEO_HEIGHT * 3] = {0};
 
 void _prepare_frame_texture()
 {
+    // The emulator's completed frame is uploaded straight from its own buffer.
+    // Only the displayed rows are updated, and the rest of the texture stays black.
+    const uint8 *pixels = frame_data;
+    uint32 top = 0;
+    uint32 height = FAMICOM_VIDEO_HEIGHT;
+    uint32 row_length = FAMICOM_VIDEO_WIDTH;
+
     if (has_valid_rom)
     {
-        nes_system.read_frame_buffer(frame_data + 8 * FAMICOM_VIDEO_WIDTH * 3);
+        ppu_frame_view view = nes_system.query_frame_view();
+
+        pixels = view.pixels;
+        top = (FAMICOM_VIDEO_HEIGHT - view.height) / 2;
+        height = view.height;
+        row_length = view.stride / 3;
     }
     else
     {
@@ -58,11 +70,11 @@ void _prepare_frame_texture()
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, FAMICOM_VIDEO_WIDTH, FAMICOM_VIDEO_HEIGHT, 0,
                      GL_RGB, GL_UNSIGNED_BYTE, frame_data);
     }
-    else
-    {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FAMICOM_VIDEO_WIDTH, FAMICOM_VIDEO_HEIGHT, 
-                        GL_RGB, GL_UNSIGNED_BYTE, frame_data);
-    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, top, FAMICOM_VIDEO_WIDTH, height, 
+                    GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
 void update_input()
@@ -1,12 +1,18 @@
 
 #include "nes.h"
+#include "hash.h"
+#include "delta.h"
 
 namespace nes {
 
+static const uint8 zero_state[sizeof(famicom_state)] = { 0 };
+
 famicom::famicom()
 {
     frame = 0;
     game = NULL;
+    rom_hash = 0;
+    pipeline = NULL;
 
     cpu.attach_system_bus(&bus);
     ppu.attach_system_bus(&bus);
@@ -20,8 +26,10 @@ famicom::~famicom()
     eject_rom();
 }
 
-status famicom::insert_rom(const char *filename)
+status famicom::insert_rom(const char *filename, bool huge_pages)
 {
+    // Huge pages suit a rom that many clones will share.
+
     eject_rom();
     
     game = new cartridge;
@@ -31,11 +39,14 @@ status famicom::insert_rom(const char *filename)
         return base_post_error(BASE_ERROR_OUTOFMEMORY);
     }
 
-    if (base_failed(load_game_cartridge(filename, game)))
+    if (base_failed(load_game_cartridge(filename, game, huge_pages)))
     {
         return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
     }
 
+    rom_hash = compute_hash64(game->program_rom, PROGRAM_PAGE_SIZE * game->header.prg_page_count,
+                              compute_hash64(game->tile_rom, TILE_PAGE_SIZE * game->header.tile_page_count));
+
     bus.reset();
     bus.load_cartridge_into_memory(game);
 
@@ -49,6 +60,10 @@ status famicom::insert_rom(const char *filename)
 
 void famicom::eject_rom()
 {
+    // The render thread draws from a copy of the cartridge chr, so it is stopped
+    // along with the cartridge.
+    set_render_thread_enabled(false);
+
     if (game)
     {
         unload_game_cartridge(game);
@@ -57,23 +72,388 @@ void famicom::eject_rom()
     }
 }
 
-void famicom::read_frame_buffer(void *output_rgb_image)
+void famicom::read_frame_buffer(void *output_rgb_image, bool synchronous)
+{
+    ppu.read_frame_buffer(output_rgb_image, synchronous);
+}
+
+ppu_frame_view famicom::query_frame_view(bool synchronous)
+{
+    // With the render thread running, the latest frame it has finished is
+    // returned unless synchronous asks for the frame the cpu just completed.
+    return ppu.query_frame_view(synchronous);
+}
+
+status famicom::configure_observation(const observation_config *config)
+{
+    return observer.configure(config);
+}
+
+void famicom::read_observation(uint8 *output)
 {
-    ppu.read_frame_buffer(output_rgb_image);
+    // Writes output_width * output_height bytes of luma for the latest frame. 
+    // With max pooling, pass a null output for the next to last frame of a 
+    // frame skip so that it is remembered without being downsampled.
+    ppu_frame_view view = ppu.query_frame_view(true);
+    observer.build(&view, output);
 }
 
-void famicom::tick()
+void famicom::tick(bool render)
 {
+    // When render is false the frame is emulated without producing any pixels. 
+    // Everything the cpu can observe, including sprite zero hits, is still kept 
+    // accurate, and the frame buffer retains the last rendered frame. With 
+    // deferred rendering enabled the flag is ignored, since no frame is drawn 
+    // until read_frame_buffer asks for it.
+
+    tick_scanlines(0, PPU_FRAME_SCANLINE_COUNT, render);
+}
+
+void famicom::tick_scanlines(uint32 first_scanline, uint32 count, bool render)
+{
+    // Runs part of a frame, for callers that switch between machines within a
+    // frame. The frame is complete once its last scanline has run.
+
     if (game)
     {
-        for (uint32 i = 0; i < PPU_FRAME_SCANLINE_COUNT; i++)
+        for (uint32 i = 0; i < count; i++)
         {
             cpu.step();
-            ppu.step();
+            ppu.step(render);
         }
     }
 
-    frame++;
+    if (first_scanline + count >= PPU_FRAME_SCANLINE_COUNT)
+    {
+        frame++;
+    }
+}
+
+void famicom::prefetch()
+{
+    // Requests what the next scanline is likely to touch, so that it arrives
+    // while another machine runs.
+    cpu.prefetch();
+    ppu.prefetch();
+}
+
+uint32 famicom::query_frame_count()
+{
+    return frame;
+}
+
+uint64 famicom::query_cycle_count()
+{
+    return cpu.query_cycle_count();
+}
+
+uint64 famicom::query_rom_hash()
+{
+    // Zero when there is no rom.
+    return game ? rom_hash : 0;
+}
+
+uint8 famicom::query_rom_page_kind()
+{
+    if (!game)
+    {
+        return SHARED_PAGES_NORMAL;
+    }
+
+    return game->program_block->query_page_kind();
+}
+
+void famicom::read_system_ram(uint16 address, uint8 *output, uint32 size)
+{
+    // Addresses wrap around the 2 KB of ram, as they do for the cpu.
+    for (uint32 i = 0; i < size; i++)
+    {
+        output[i] = bus.read_cpu_byte((address + i) & (SYSTEM_RAM_SIZE - 1));
+    }
+}
+
+status famicom::save_state(famicom_state *output)
+{
+    // Copies memory and registers only, so this is cheap enough to call every 
+    // frame. Nothing pending for the frame buffer needs to be drawn first.
+
+    if (!output)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!game)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    // Padding within the state is never written, and is cleared so that equal
+    // machines always give byte for byte equal states.
+    memset(output, 0, sizeof(famicom_state));
+
+    output->magic = FAMICOM_STATE_MAGIC;
+    output->version = FAMICOM_STATE_VERSION;
+    output->size = sizeof(famicom_state);
+    output->frame = frame;
+    output->rom_hash = rom_hash;
+
+    cpu.save_state(&output->cpu);
+    ppu.save_state(&output->ppu);
+    bus.save_state(&output->bus);
+
+    return BASE_SUCCESS;
+}
+
+status famicom::load_state(const famicom_state *input)
+{
+    if (!input)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!game)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    if (FAMICOM_STATE_MAGIC != input->magic || FAMICOM_STATE_VERSION != input->version || 
+        sizeof(famicom_state) != input->size || rom_hash != input->rom_hash)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    // Lines still waiting to be drawn were recorded against the memory that is
+    // about to be replaced, so detaching draws them first. Attaching again then
+    // hands the loaded memory to the render thread, if there is one, and starts
+    // recording from the loaded scanline.
+    ppu.attach_render_pipeline(NULL);
+
+    if (base_failed(bus.load_state(&input->bus)))
+    {
+        ppu.attach_render_pipeline(pipeline);
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    cpu.load_state(&input->cpu);
+    ppu.load_state(&input->ppu);
+
+    ppu.attach_render_pipeline(pipeline);
+
+    frame = input->frame;
+
+    return BASE_SUCCESS;
+}
+
+status famicom::clone(famicom *output)
+{
+    // Turns the output into a copy of this machine that runs on independently.
+    // Rom, chr and the frame buffers are shared until either side writes to 
+    // them, and the remaining memory is small enough to copy outright. The 
+    // output keeps its own controllers and observation settings, and does not
+    // inherit the render thread.
+
+    if (!output || output == this)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!game)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    output->eject_rom();
+    output->game = new cartridge;
+
+    if (!output->game)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    if (base_failed(clone_game_cartridge(game, output->game)))
+    {
+        delete output->game;
+        output->game = NULL;
+
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    output->rom_hash = rom_hash;
+    output->frame = frame;
+
+    output->bus.load_cartridge_into_memory(output->game);
+    output->bus.clone_from(&bus);
+
+    cpu_state registers;
+
+    cpu.save_state(&registers);
+    output->cpu.load_state(&registers);
+
+    // With a render thread our frames are drawn by its ppu, so the lines it has 
+    // been handed must be drawn before its frames can be shared.
+    if (pipeline)
+    {
+        ppu.flush_deferred_lines();
+        pipeline->wait_until_idle();
+    }
+
+    output->ppu.clone_from(&ppu);
+
+    if (pipeline)
+    {
+        output->ppu.share_frame_buffers(pipeline->query_ppu());
+    }
+
+    return BASE_SUCCESS;
+}
+
+status famicom::hibernate(hibernated_famicom *output)
+{
+    // Leaves this machine running as it was. Deleting it afterwards frees all
+    // but the rom, which the output holds on to.
+
+    if (!output)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!game)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    famicom_state *state = new famicom_state;
+    uint8 *encoded = new uint8[DELTA_ENCODE_BOUND(sizeof(famicom_state))];
+
+    if (!state || !encoded)
+    {
+        delete state;
+        delete [] encoded;
+
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    save_state(state);
+
+    for (uint32 i = 0; i < TILE_PAGE_SIZE; i++)
+    {
+        state->bus.tile_ram[i] ^= game->tile_rom[i];
+    }
+
+    uint32 size = encode_difference((const uint8 *) state, zero_state, sizeof(famicom_state), encoded);
+
+    delete state;
+
+    output->data = new uint8[size];
+
+    if (!output->data)
+    {
+        delete [] encoded;
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    memcpy(output->data, encoded, size);
+    delete [] encoded;
+
+    output->size = size;
+    output->rom_hash = rom_hash;
+    output->rom.header = game->header;
+    output->rom.save_ram = NULL;
+    output->rom.program_block = game->program_block->acquire();
+    output->rom.tile_block = game->tile_block->acquire();
+    output->rom.program_rom = output->rom.program_block->query_data();
+    output->rom.tile_rom = output->rom.tile_block->query_data();
+
+    return BASE_SUCCESS;
+}
+
+status famicom::wake(const hibernated_famicom *input)
+{
+    // Replaces whatever this machine held with the hibernated one. The picture
+    // is blank until the next frame is drawn, and the render thread is not 
+    // kept. Attached controllers stay attached and take on the saved state.
+
+    if (!input || !input->data || !input->rom.program_block || !input->rom.tile_block)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    famicom_state *state = new famicom_state;
+
+    if (!state)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    eject_rom();
+    game = new cartridge;
+
+    if (!game || base_failed(clone_game_cartridge(&input->rom, game)))
+    {
+        delete game;
+        delete state;
+        game = NULL;
+
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    rom_hash = input->rom_hash;
+
+    bus.reset();
+    bus.load_cartridge_into_memory(game);
+
+    cpu.reset();
+    ppu.reset();
+
+    memset(state, 0, sizeof(famicom_state));
+    apply_difference((uint8 *) state, input->data, input->size);
+
+    for (uint32 i = 0; i < TILE_PAGE_SIZE; i++)
+    {
+        state->bus.tile_ram[i] ^= game->tile_rom[i];
+    }
+
+    status result = load_state(state);
+
+    delete state;
+
+    if (base_failed(result))
+    {
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    return BASE_SUCCESS;
+}
+
+uint32 famicom::query_memory_usage()
+{
+    // Rom is shared between machines running the same game and is left out.
+    uint32 result = sizeof(famicom) + SYSTEM_RAM_SIZE + VIDEO_RAM_SIZE + PALETTE_RAM_SIZE + ppu.query_memory_usage();
+
+    if (game)
+    {
+        result += sizeof(cartridge) + SAVE_RAM_PAGE_SIZE * max(1, game->header.sram_page_count);
+    }
+
+    return result;
+}
+
+void release_hibernated_famicom(hibernated_famicom *input)
+{
+    if (BASE_PARAM_CHECK)
+    {
+        if (!input)
+        {
+            base_post_error(BASE_ERROR_INVALIDARG);
+            return;
+        }
+    }
+
+    unload_game_cartridge(&input->rom);
+    delete [] input->data;
+
+    input->data = NULL;
+    input->size = 0;
 }
 
 void famicom::attach_controller(uint8 index, controller *keypad)
@@ -81,4 +461,76 @@ void famicom::attach_controller(uint8 index, controller *keypad)
     bus.attach_controller(index, keypad);
 }
 
+void famicom::set_background_cache_enabled(bool enabled)
+{
+    ppu.set_background_cache_enabled(enabled);
+}
+
+ppu_background_cache_stats famicom::query_background_cache_stats()
+{
+    return ppu.query_background_cache_stats();
+}
+
+void famicom::set_scanline_cache_mode(uint8 mode)
+{
+    ppu.set_scanline_cache_mode(mode);
+}
+
+ppu_scanline_stats famicom::query_scanline_stats()
+{
+    return ppu.query_scanline_stats();
+}
+
+void famicom::set_deferred_rendering_enabled(bool enabled)
+{
+    ppu.set_deferred_rendering_enabled(enabled);
+}
+
+status famicom::set_render_thread_enabled(bool enabled)
+{
+    // Scanlines are drawn by a second thread while the cpu carries on. Frames
+    // read back are identical to eager rendering. A synchronous read waits for
+    // the render thread to catch up, while any other returns the latest frame
+    // it has finished.
+
+    if (enabled == (NULL != pipeline))
+    {
+        return BASE_SUCCESS;
+    }
+
+    if (!enabled)
+    {
+        ppu.attach_render_pipeline(NULL);
+
+        delete pipeline;
+        pipeline = NULL;
+
+        return BASE_SUCCESS;
+    }
+
+    if (!game)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    pipeline = new render_pipeline;
+
+    if (!pipeline)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    if (base_failed(pipeline->start(game)))
+    {
+        delete pipeline;
+        pipeline = NULL;
+
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    ppu.attach_render_pipeline(pipeline);
+
+    return BASE_SUCCESS;
+}
+
 } // namespace nes
\ No newline at end of file
@@ -37,15 +37,58 @@
 #include "bus.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "pipeline.h"
+#include "observe.h"
+
+#define FAMICOM_STATE_MAGIC                 (0x5453454E)   // 'NEST'
+#define FAMICOM_STATE_VERSION               (1)
 
 namespace nes {
 
+// A complete snapshot of the running machine. It holds no pointers and is the 
+// same size for every game, so it may be copied, compared or written out as is. 
+// The version changes whenever the layout does. Only the NROM mapper is 
+// supported, which has no registers of its own to keep. Memory directly 
+// follows the header so that the large arrays stay 8 byte aligned, which 
+// keeps copying them fast.
+typedef struct famicom_state
+{
+    uint32 magic;
+    uint32 version;
+    uint32 size;
+    uint32 frame;
+    uint64 rom_hash;            // identifies the game the state belongs to
+    bus_state bus;
+    ppu_state ppu;
+    cpu_state cpu;
+
+} famicom_state;
+
+// A sleeping machine, reduced to its rom and a compressed copy of its state.
+// The rom is shared with the machine it came from and with any other machine
+// running the same game, and nothing of the frame buffers is kept. The state 
+// is stored as its difference from a cleared state holding the cartridge chr,
+// so memory the game never touched costs next to nothing.
+typedef struct hibernated_famicom
+{
+    cartridge rom;              // without save ram, which is part of the state
+    uint64 rom_hash;
+    uint32 size;
+    uint8 *data;
+
+} hibernated_famicom;
+
+void release_hibernated_famicom(hibernated_famicom *input);
+
 class famicom
 {
     cartridge *game;
+    uint64 rom_hash;
     virtual_cpu cpu;
     virtual_ppu ppu;
     system_bus bus;
+    render_pipeline *pipeline;
+    observation_builder observer;
     uint32 frame;
 
 public:
@@ -53,12 +96,41 @@ public:
     famicom();
     ~famicom();
 
-    status insert_rom(const char *filename);
-    void read_frame_buffer(void *output_rgb_image);
+    status insert_rom(const char *filename, bool huge_pages = false);
+    void read_frame_buffer(void *output_rgb_image, bool synchronous = false);
+    ppu_frame_view query_frame_view(bool synchronous = false);
+
+    status configure_observation(const observation_config *config);
+    void read_observation(uint8 *output);
     void attach_controller(uint8 index, controller *keypad);
 
+    void set_background_cache_enabled(bool enabled);
+    ppu_background_cache_stats query_background_cache_stats();
+
+    void set_scanline_cache_mode(uint8 mode);
+    ppu_scanline_stats query_scanline_stats();
+
+    void set_deferred_rendering_enabled(bool enabled);
+    status set_render_thread_enabled(bool enabled);
+
     void eject_rom();
-    void tick();
+    void tick(bool render = true);
+    void tick_scanlines(uint32 first_scanline, uint32 count, bool render = true);
+    void prefetch();
+
+    uint32 query_frame_count();
+    uint64 query_cycle_count();
+    uint64 query_rom_hash();
+    uint8 query_rom_page_kind();
+    void read_system_ram(uint16 address, uint8 *output, uint32 size);
+
+    status save_state(famicom_state *output);
+    status load_state(const famicom_state *input);
+    status clone(famicom *output);
+
+    status hibernate(hibernated_famicom *output);
+    status wake(const hibernated_famicom *input);
+    uint32 query_memory_usage();
 };
 
 } // namespace nes
@@ -0,0 +1,318 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// ntsc.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "ntsc.h"
+
+#include <math.h>
+
+#if defined (BASE_SIMD_SSE2)
+#include "emmintrin.h"
+#endif
+
+#if defined (BASE_SIMD_AVX2)
+#include "immintrin.h"
+#endif
+
+#define NTSC_SAMPLES_PER_PIXEL              (8)
+#define NTSC_SAMPLES_PER_CYCLE              (12)
+#define NTSC_GROUP_PIXELS                   (3)
+#define NTSC_GROUP_OUTPUT                   (7)
+#define NTSC_KERNEL_LEAD                    (4)    // taps before the first output pixel of a group
+#define NTSC_LUMA_WIDTH                     (12.0)
+#define NTSC_CHROMA_WIDTH                   (12.0) // half width of the triangular chroma filter
+#define NTSC_CHROMA_GAIN                    (1.5)
+#define NTSC_TWO_PI                         (6.28318530717958647692)
+
+namespace nes {
+
+// Signal voltages of the four luma levels at the low and high points of the
+// square wave, and the attenuation applied by the emphasis bits.
+static const float64 ntsc_signal_low[4] = { 0.350, 0.518, 0.962, 1.550 };
+static const float64 ntsc_signal_high[4] = { 1.094, 1.506, 1.962, 1.962 };
+static const float64 ntsc_black = 0.518;
+static const float64 ntsc_white = 1.962;
+static const float64 ntsc_attenuation = 0.746;
+
+static inline bool in_color_phase(uint8 hue, uint32 phase)
+{
+    return ((hue + phase) % NTSC_SAMPLES_PER_CYCLE) < 6;
+}
+
+static float64 query_signal_level(uint32 color, uint32 phase)
+{
+    // color holds the palette index in its low six bits and the emphasis bits 
+    // above them. Hues 14 and 15 are black, hue 0 stays high and hue 13 low.
+    uint8 hue = color & 0xF;
+    uint8 level = (color >> 4) & 0x3;
+    uint8 emphasis = (color >> 6) & 0x7;
+
+    if (hue > 13)
+    {
+        level = 1;
+    }
+
+    float64 low = ntsc_signal_low[level];
+    float64 high = ntsc_signal_high[level];
+
+    if (0 == hue) low = high;
+    if (hue > 12) high = low;
+
+    float64 signal = in_color_phase(hue, phase) ? high : low;
+
+    if (hue < 0xE && (((emphasis & 0x1) && in_color_phase(0, phase)) ||
+                      ((emphasis & 0x2) && in_color_phase(4, phase)) ||
+                      ((emphasis & 0x4) && in_color_phase(8, phase))))
+    {
+        signal *= ntsc_attenuation;
+    }
+
+    return (signal - ntsc_black) / (ntsc_white - ntsc_black);
+}
+
+static inline int16 quantize_kernel_tap(float64 value)
+{
+    return (int16) floor(value * 255.0 * (1 << NTSC_FRACTION_BITS) + 0.5);
+}
+
+ntsc_filter::ntsc_filter()
+{
+    memset(&config, 0, sizeof(ntsc_config));
+    kernels = new int16[NTSC_COLOR_COUNT * NTSC_PHASE_COUNT * NTSC_GROUP_PIXELS * NTSC_KERNEL_SIZE];
+
+    job_view = NULL;
+    job_phase = 0;
+    job_output = NULL;
+    job_stride = 0;
+
+    if (!kernels)
+    {
+        base_post_error(BASE_ERROR_OUTOFMEMORY);
+        return;
+    }
+
+    config.saturation = 1.0f;
+    config.thread_count = 1;
+
+    build_kernels();
+}
+
+ntsc_filter::~ntsc_filter()
+{
+    pool.stop();
+    delete [] kernels;
+}
+
+status ntsc_filter::configure(const ntsc_config *input)
+{
+    if (!input || !kernels || input->saturation < 0.0f)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    config = *input;
+    config.thread_count = min(max(input->thread_count, 1), BAND_POOL_MAX_THREADS);
+
+    build_kernels();
+    pool.start(config.thread_count);
+
+    return BASE_SUCCESS;
+}
+
+void ntsc_filter::query_config(ntsc_config *output)
+{
+    if (output)
+    {
+        *output = config;
+    }
+}
+
+void ntsc_filter::build_kernels()
+{
+    // Eight signal samples per pixel and twelve per subcarrier cycle, so a group
+    // of three pixels spans 24 samples and is decoded into seven output pixels.
+    // Luma is a box filter over one cycle, which cancels the carrier, and chroma
+    // is demodulated and then low passed over two cycles.
+    float64 chroma_gain = NTSC_CHROMA_GAIN * config.saturation;
+    float64 hue_offset = config.hue * NTSC_TWO_PI / 360.0;
+    float64 output_pitch = (float64) (NTSC_GROUP_PIXELS * NTSC_SAMPLES_PER_PIXEL) / NTSC_GROUP_OUTPUT;
+    int16 *kernel = kernels;
+
+    for (uint32 color = 0; color < NTSC_COLOR_COUNT; color++)
+    {
+        for (uint32 phase = 0; phase < NTSC_PHASE_COUNT; phase++)
+        {
+            for (uint32 position = 0; position < NTSC_GROUP_PIXELS; position++)
+            {
+                for (int32 tap = 0; tap < NTSC_KERNEL_TAPS; tap++)
+                {
+                    float64 center = (tap - NTSC_KERNEL_LEAD + 0.5) * output_pitch;
+                    float64 y = 0.0, u = 0.0, v = 0.0;
+
+                    for (uint32 i = 0; i < NTSC_SAMPLES_PER_PIXEL; i++)
+                    {
+                        // Each line begins a third of a cycle later than the last.
+                        uint32 sample = position * NTSC_SAMPLES_PER_PIXEL + i;
+                        uint32 carrier = sample + phase * (NTSC_SAMPLES_PER_CYCLE / NTSC_PHASE_COUNT);
+                        float64 signal = query_signal_level(color, carrier % NTSC_SAMPLES_PER_CYCLE);
+                        float64 distance = sample + 0.5 - center;
+
+                        float64 luma_weight = min(distance + 0.5, NTSC_LUMA_WIDTH / 2) - max(distance - 0.5, -NTSC_LUMA_WIDTH / 2);
+                        float64 chroma_weight = 1.0 - fabs(distance) / NTSC_CHROMA_WIDTH;
+                        float64 angle = NTSC_TWO_PI * carrier / NTSC_SAMPLES_PER_CYCLE + hue_offset;
+
+                        y += signal * max(luma_weight, 0.0) / NTSC_LUMA_WIDTH;
+                        u += signal * max(chroma_weight, 0.0) / NTSC_CHROMA_WIDTH * cos(angle);
+                        v -= signal * max(chroma_weight, 0.0) / NTSC_CHROMA_WIDTH * sin(angle);
+                    }
+
+                    u *= chroma_gain;
+                    v *= chroma_gain;
+
+                    kernel[tap * 3 + 0] = quantize_kernel_tap(y + 1.13983 * v);
+                    kernel[tap * 3 + 1] = quantize_kernel_tap(y - 0.39465 * u - 0.58060 * v);
+                    kernel[tap * 3 + 2] = quantize_kernel_tap(y + 2.03211 * u);
+                }
+
+                kernel += NTSC_KERNEL_SIZE;
+            }
+        }
+    }
+}
+
+status ntsc_filter::filter(const ppu_frame_view *view, uint8 burst_phase, uint8 *output, uint32 stride)
+{
+    if (!view || !output || !kernels || view->width != PPU_DISPLAY_WIDTH || stride < NTSC_OUTPUT_WIDTH * 3)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    job_view = view;
+    job_phase = burst_phase % NTSC_PHASE_COUNT;
+    job_output = output;
+    job_stride = stride;
+
+    pool.run(view->height, &ntsc_filter::run_band, this);
+
+    return BASE_SUCCESS;
+}
+
+void ntsc_filter::run_band(void *context, uint32 first_row, uint32 last_row)
+{
+    ntsc_filter *filter = (ntsc_filter *) context;
+    const ppu_frame_view *view = filter->job_view;
+
+    for (uint32 y = first_row; y < last_row; y++)
+    {
+        filter->filter_line(view->indices + y * view->index_stride, view->emphasis[y], 
+                            (filter->job_phase + y) % NTSC_PHASE_COUNT, filter->job_output + y * filter->job_stride);
+    }
+}
+
+void ntsc_filter::filter_line(const uint8 *indices, uint8 emphasis, uint8 phase, uint8 *output)
+{
+    // The accumulator begins NTSC_KERNEL_LEAD pixels left of the line and is 
+    // padded so that the last kernel may be added in whole vectors.
+    const uint32 groups = (PPU_DISPLAY_WIDTH + NTSC_GROUP_PIXELS - 1) / NTSC_GROUP_PIXELS;
+    const uint32 accumulator_size = (groups * NTSC_GROUP_OUTPUT + NTSC_KERNEL_TAPS) * 3;
+
+    int16 accumulator[accumulator_size];
+    uint32 color_base = (emphasis & 0x7) << 6;
+    uint32 kernel_stride = NTSC_PHASE_COUNT * NTSC_GROUP_PIXELS * NTSC_KERNEL_SIZE;
+    const int16 *phase_kernels = kernels + phase * NTSC_GROUP_PIXELS * NTSC_KERNEL_SIZE;
+
+    memset(accumulator, 0, sizeof(accumulator));
+
+    for (uint32 group = 0; group < groups; group++)
+    {
+        int16 *dest = accumulator + group * NTSC_GROUP_OUTPUT * 3;
+        uint32 first = group * NTSC_GROUP_PIXELS;
+
+        // The final group of a 256 pixel line holds a single pixel.
+        uint32 count = min(PPU_DISPLAY_WIDTH - first, NTSC_GROUP_PIXELS);
+
+#if defined (BASE_SIMD_AVX2)
+        __m256i sum0 = _mm256_loadu_si256((const __m256i *) (dest + 0));
+        __m256i sum1 = _mm256_loadu_si256((const __m256i *) (dest + 16));
+        __m256i sum2 = _mm256_loadu_si256((const __m256i *) (dest + 32));
+
+        for (uint32 i = 0; i < count; i++)
+        {
+            const int16 *kernel = phase_kernels + (color_base | (indices[first + i] & 0x3F)) * kernel_stride + i * NTSC_KERNEL_SIZE;
+
+            sum0 = _mm256_add_epi16(sum0, _mm256_loadu_si256((const __m256i *) (kernel + 0)));
+            sum1 = _mm256_add_epi16(sum1, _mm256_loadu_si256((const __m256i *) (kernel + 16)));
+            sum2 = _mm256_add_epi16(sum2, _mm256_loadu_si256((const __m256i *) (kernel + 32)));
+        }
+
+        _mm256_storeu_si256((__m256i *) (dest + 0), sum0);
+        _mm256_storeu_si256((__m256i *) (dest + 16), sum1);
+        _mm256_storeu_si256((__m256i *) (dest + 32), sum2);
+#else
+        for (uint32 i = 0; i < count; i++)
+        {
+            const int16 *kernel = phase_kernels + (color_base | (indices[first + i] & 0x3F)) * kernel_stride + i * NTSC_KERNEL_SIZE;
+
+            for (uint32 j = 0; j < NTSC_KERNEL_SIZE; j++)
+            {
+                dest[j] += kernel[j];
+            }
+        }
+#endif
+    }
+
+    // Drop the lead, round away the fraction and clamp.
+    const int16 *source = accumulator + NTSC_KERNEL_LEAD * 3;
+    uint32 x = 0;
+
+#if defined (BASE_SIMD_SSE2)
+    __m128i rounding = _mm_set1_epi16(1 << (NTSC_FRACTION_BITS - 1));
+
+    for (; x + 16 <= NTSC_OUTPUT_WIDTH * 3; x += 16)
+    {
+        __m128i low = _mm_loadu_si128((const __m128i *) (source + x));
+        __m128i high = _mm_loadu_si128((const __m128i *) (source + x + 8));
+
+        low = _mm_srai_epi16(_mm_adds_epi16(low, rounding), NTSC_FRACTION_BITS);
+        high = _mm_srai_epi16(_mm_adds_epi16(high, rounding), NTSC_FRACTION_BITS);
+
+        _mm_storeu_si128((__m128i *) (output + x), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; x < NTSC_OUTPUT_WIDTH * 3; x++)
+    {
+        int32 value = (source[x] + (1 << (NTSC_FRACTION_BITS - 1))) >> NTSC_FRACTION_BITS;
+        output[x] = (uint8) min(max(value, 0), 255);
+    }
+}
+
+} // namespace nes
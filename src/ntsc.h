@@ -0,0 +1,103 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// ntsc.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __NTSC_FILTER_H__
+#define __NTSC_FILTER_H__
+
+#include "base.h"
+#include "bands.h"
+#include "ppu.h"
+
+#define NTSC_OUTPUT_WIDTH                   (((PPU_DISPLAY_WIDTH + 2) / 3) * 7)    // 602
+#define NTSC_COLOR_COUNT                    (512)  // palette index and emphasis bits
+#define NTSC_PHASE_COUNT                    (3)
+#define NTSC_KERNEL_TAPS                    (16)
+#define NTSC_KERNEL_SIZE                    (NTSC_KERNEL_TAPS * 3)
+#define NTSC_FRACTION_BITS                  (5)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct ntsc_config
+{
+    float32 hue;                // degrees
+    float32 saturation;         // 1.0 matches the system palette
+    uint8 thread_count;
+
+} ntsc_config;
+
+// Simulates the composite signal of the ppu and its decoding by a television.
+// Every three input pixels span two cycles of the color subcarrier and become
+// seven output pixels. Since decoding is linear in the signal, the output of a
+// line is the sum of one precomputed kernel per input pixel, chosen by its 
+// color, emphasis, position within the group of three, and the phase of the
+// subcarrier on that line. Filtering a line is therefore a run of vector adds.
+
+class ntsc_filter
+{
+    ntsc_config config;
+    int16 *kernels;             // [color][phase][position][tap][rgb]
+    band_pool pool;
+
+    // Parameters of the frame in flight.
+    const ppu_frame_view *job_view;
+    uint8 job_phase;
+    uint8 *job_output;
+    uint32 job_stride;
+
+public:
+
+    ntsc_filter();
+    ~ntsc_filter();
+
+    status configure(const ntsc_config *input);
+    void query_config(ntsc_config *output);
+
+    // Writes NTSC_OUTPUT_WIDTH RGB888 pixels for every row of the view. The 
+    // subcarrier phase advances by a third of a cycle per line, starting from
+    // burst_phase (0-2) on the first row. Stepping it every frame gives the
+    // moving dot crawl of the real console.
+    status filter(const ppu_frame_view *view, uint8 burst_phase, uint8 *output, uint32 stride);
+
+private:
+
+    void build_kernels();
+    static void run_band(void *context, uint32 first_row, uint32 last_row);
+    void filter_line(const uint8 *indices, uint8 emphasis, uint8 phase, uint8 *output);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(ntsc_filter);
+};
+
+} // namespace nes
+
+#endif // __NTSC_FILTER_H__
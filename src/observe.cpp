@@ -0,0 +1,266 @@
+
+#include "observe.h"
+
+#if defined (BASE_SIMD_SSE2)
+#include "emmintrin.h"
+#endif
+
+namespace nes {
+
+observation_builder::observation_builder()
+{
+    row_first = NULL;
+    row_weights = NULL;
+    column_first = NULL;
+    column_weights = NULL;
+    current_luma = NULL;
+    previous_luma = NULL;
+    column_sums = NULL;
+
+    // Rec. 601 luma of each system palette entry, in 8 bit fixed point.
+    const ppu_color *palette = query_system_palette();
+
+    for (uint32 i = 0; i < OBSERVATION_LUMA_TABLE_SIZE; i++)
+    {
+        luma_table[i] = (77 * palette[i].red + 150 * palette[i].green + 29 * palette[i].blue + 128) >> 8;
+    }
+
+    observation_config defaults;
+
+    defaults.crop_x = 0;
+    defaults.crop_y = 0;
+    defaults.crop_width = PPU_DISPLAY_WIDTH;
+    defaults.crop_height = PPU_DISPLAY_HEIGHT;
+    defaults.output_width = OBSERVATION_DEFAULT_SIZE;
+    defaults.output_height = OBSERVATION_DEFAULT_SIZE;
+    defaults.max_pool = false;
+
+    if (base_failed(configure(&defaults)))
+    {
+        base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+}
+
+observation_builder::~observation_builder()
+{
+    release();
+}
+
+void observation_builder::release()
+{
+    delete [] row_first;
+    delete [] row_weights;
+    delete [] column_first;
+    delete [] column_weights;
+    delete [] current_luma;
+    delete [] previous_luma;
+    delete [] column_sums;
+
+    row_first = NULL;
+    row_weights = NULL;
+    column_first = NULL;
+    column_weights = NULL;
+    current_luma = NULL;
+    previous_luma = NULL;
+    column_sums = NULL;
+}
+
+status observation_builder::configure(const observation_config *input)
+{
+    if (!input || !input->output_width || !input->output_height ||
+        input->output_width > input->crop_width || input->output_height > input->crop_height ||
+        input->crop_x + input->crop_width > PPU_DISPLAY_WIDTH || 
+        input->crop_y + input->crop_height > PPU_DISPLAY_HEIGHT)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    release();
+
+    config = *input;
+    previous_valid = false;
+
+    if (base_failed(build_weights(config.crop_height, config.output_height, &row_taps, &row_first, &row_weights)) ||
+        base_failed(build_weights(config.crop_width, config.output_width, &column_taps, &column_first, &column_weights)))
+    {
+        release();
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    // The column sums are padded so that the last output column can read all 
+    // of its taps, even those past the edge that carry no weight.
+    uint32 plane_size = config.crop_width * config.crop_height;
+
+    current_luma = new uint8[plane_size];
+    previous_luma = new uint8[plane_size];
+    column_sums = new uint16[config.crop_width + column_taps];
+
+    if (!current_luma || !previous_luma || !column_sums)
+    {
+        release();
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void observation_builder::query_config(observation_config *output)
+{
+    *output = config;
+}
+
+status observation_builder::build_weights(uint16 source_size, uint16 output_size, uint32 *taps, uint16 **first, uint16 **weights)
+{
+    // Output pixel i covers [i * source_size, (i + 1) * source_size) when each 
+    // source pixel is output_size units long. A source pixel is weighted by its 
+    // overlap with that span, and the weights of each output pixel sum to 256. 
+    // They are derived from rounded running totals so the sum is exact.
+
+    *taps = (source_size + output_size - 1) / output_size + 1;
+    *first = new uint16[output_size];
+    *weights = new uint16[output_size * (*taps)];
+
+    if (!*first || !*weights)
+    {
+        return BASE_ERROR_OUTOFMEMORY;
+    }
+
+    memset(*weights, 0, output_size * (*taps) * sizeof(uint16));
+
+    for (uint32 i = 0; i < output_size; i++)
+    {
+        uint32 span_begin = i * source_size;
+        uint32 span_end = span_begin + source_size;
+        uint32 source = span_begin / output_size;
+        uint32 covered = 0;
+
+        (*first)[i] = source;
+
+        for (uint32 tap = 0; tap < *taps && source * output_size < span_end; tap++, source++)
+        {
+            uint32 pixel_begin = max(source * output_size, span_begin);
+            uint32 pixel_end = min((source + 1) * output_size, span_end);
+            uint32 previous_total = (covered * 256 + source_size / 2) / source_size;
+
+            covered += pixel_end - pixel_begin;
+            (*weights)[i * (*taps) + tap] = (covered * 256 + source_size / 2) / source_size - previous_total;
+        }
+    }
+
+    return BASE_SUCCESS;
+}
+
+void observation_builder::convert_to_luma(const ppu_frame_view *view)
+{
+    for (uint32 y = 0; y < config.crop_height; y++)
+    {
+        const uint8 *indices = view->indices + (config.crop_y + y) * view->index_stride + config.crop_x;
+        uint8 *luma = current_luma + y * config.crop_width;
+
+        for (uint32 x = 0; x < config.crop_width; x++)
+        {
+            luma[x] = luma_table[indices[x] & 0x3F];
+        }
+    }
+}
+
+void observation_builder::accumulate_rows(uint16 output_y)
+{
+    // Weighted sum of the source rows under this output row, for every column
+    // of the crop. Weights sum to 256, so the totals always fit in 16 bits.
+
+    bool pool = config.max_pool && previous_valid;
+    uint32 width = config.crop_width;
+
+    memset(column_sums, 0, (width + column_taps) * sizeof(uint16));
+
+    for (uint32 tap = 0; tap < row_taps; tap++)
+    {
+        uint16 weight = row_weights[output_y * row_taps + tap];
+
+        if (!weight)
+        {
+            continue;
+        }
+
+        uint32 offset = (row_first[output_y] + tap) * width;
+        const uint8 *current = current_luma + offset;
+        const uint8 *previous = previous_luma + offset;
+        uint32 x = 0;
+
+#if defined (BASE_SIMD_SSE2)
+        __m128i zero = _mm_setzero_si128();
+        __m128i weights = _mm_set1_epi16(weight);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i luma = _mm_loadu_si128((const __m128i *) (current + x));
+
+            if (pool)
+            {
+                luma = _mm_max_epu8(luma, _mm_loadu_si128((const __m128i *) (previous + x)));
+            }
+
+            __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(luma, zero), weights);
+            __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(luma, zero), weights);
+            __m128i *sums = (__m128i *) (column_sums + x);
+
+            _mm_storeu_si128(sums, _mm_add_epi16(_mm_loadu_si128(sums), low));
+            _mm_storeu_si128(sums + 1, _mm_add_epi16(_mm_loadu_si128(sums + 1), high));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            uint8 luma = pool ? max(current[x], previous[x]) : current[x];
+            column_sums[x] += weight * luma;
+        }
+    }
+}
+
+void observation_builder::resolve_columns(uint8 *output)
+{
+    for (uint32 i = 0; i < config.output_width; i++)
+    {
+        const uint16 *weights = &column_weights[i * column_taps];
+        const uint16 *sums = &column_sums[column_first[i]];
+        uint32 total = 0;
+
+        for (uint32 tap = 0; tap < column_taps; tap++)
+        {
+            total += weights[tap] * sums[tap];
+        }
+
+        output[i] = (total + 0x8000) >> 16;
+    }
+}
+
+void observation_builder::build(const ppu_frame_view *view, uint8 *output)
+{
+    // A frame is only pooled with the one emulated directly before it. Passing 
+    // a null output records the frame for pooling without producing anything.
+
+    if (!current_luma)
+    {
+        return;
+    }
+
+    previous_valid = previous_valid && (previous_frame + 1 == view->frame);
+    convert_to_luma(view);
+
+    if (output)
+    {
+        for (uint32 y = 0; y < config.output_height; y++)
+        {
+            accumulate_rows(y);
+            resolve_columns(output + y * config.output_width);
+        }
+    }
+
+    uint8 *swap = previous_luma;
+    previous_luma = current_luma;
+    current_luma = swap;
+    previous_frame = view->frame;
+    previous_valid = true;
+}
+
+} // namespace nes
@@ -0,0 +1,104 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// observe.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __OBSERVATION_H__
+#define __OBSERVATION_H__
+
+#include "base.h"
+#include "ppu.h"
+
+#define OBSERVATION_DEFAULT_SIZE            (84)
+#define OBSERVATION_LUMA_TABLE_SIZE         (64)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct observation_config
+{
+    uint16 crop_x;              // region of the displayed 256x224 image
+    uint16 crop_y;
+    uint16 crop_width;
+    uint16 crop_height;
+    uint16 output_width;        // no larger than the crop region
+    uint16 output_height;
+    bool max_pool;              // per pixel maximum of this and the previous frame
+
+} observation_config;
+
+// Produces small grayscale frames for agents straight from the palette index
+// plane of a frame. Indices are mapped to luma through a table and the crop
+// region is area averaged down to the output size. Weights for each output row
+// and column are computed once, when the configuration changes.
+
+class observation_builder
+{
+    observation_config config;
+    uint8 luma_table[OBSERVATION_LUMA_TABLE_SIZE];
+
+    uint32 row_taps;
+    uint16 *row_first;
+    uint16 *row_weights;
+    uint32 column_taps;
+    uint16 *column_first;
+    uint16 *column_weights;
+
+    // Luma of the crop region for the current and previous frame.
+    uint8 *current_luma;
+    uint8 *previous_luma;
+    uint32 previous_frame;
+    bool previous_valid;
+    uint16 *column_sums;
+
+public:
+
+    observation_builder();
+    ~observation_builder();
+
+    status configure(const observation_config *input);
+    void query_config(observation_config *output);
+    void build(const ppu_frame_view *view, uint8 *output);
+
+private:
+
+    void release();
+    status build_weights(uint16 source_size, uint16 output_size, uint32 *taps, uint16 **first, uint16 **weights);
+    void convert_to_luma(const ppu_frame_view *view);
+    void accumulate_rows(uint16 output_y);
+    void resolve_columns(uint8 *output);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(observation_builder);
+};
+
+} // namespace nes
+
+#endif // __OBSERVATION_H__
@@ -0,0 +1,239 @@
+
+#include "pipeline.h"
+
+namespace nes {
+
+render_pipeline::render_pipeline()
+{
+    memset(&shadow_cart, 0, sizeof(cartridge));
+    source_cart = NULL;
+
+    packets = new ppu_render_packet[PIPELINE_PACKET_COUNT];
+    read_index = 0;
+    write_index = 0;
+    running = false;
+    renderer_sleeping = false;
+    recorder_sleeping = false;
+
+    if (!packets)
+    {
+        base_post_error(BASE_ERROR_OUTOFMEMORY);
+        return;
+    }
+
+    shadow_ppu.attach_system_bus(&shadow_bus);
+    shadow_bus.attach_ppu(&shadow_ppu);
+}
+
+render_pipeline::~render_pipeline()
+{
+    stop();
+
+    delete [] packets;
+    delete [] shadow_cart.tile_rom;
+}
+
+status render_pipeline::start(const cartridge *game)
+{
+    if (!game || !packets)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (running)
+    {
+        return BASE_SUCCESS;
+    }
+
+    // Only the chr is needed to draw. It is copied since chr ram may be written
+    // by the cpu while we are drawing an earlier line.
+    uint32 tile_data_size = TILE_PAGE_SIZE * game->header.tile_page_count;
+
+    delete [] shadow_cart.tile_rom;
+
+    shadow_cart.header = game->header;
+    shadow_cart.tile_rom = new uint8[tile_data_size];
+    source_cart = game;
+
+    if (!shadow_cart.tile_rom)
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    memcpy(shadow_cart.tile_rom, game->tile_rom, tile_data_size);
+
+    shadow_bus.reset();
+    shadow_bus.load_cartridge_into_memory(&shadow_cart);
+    shadow_ppu.reset();
+
+    read_index = 0;
+    write_index = 0;
+    running = true;
+    worker = std::thread(&render_pipeline::run, this);
+
+    return BASE_SUCCESS;
+}
+
+void render_pipeline::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    wait_until_idle();
+
+    {
+        std::lock_guard<std::mutex> guard(wait_lock);
+        running = false;
+    }
+
+    packet_signal.notify_one();
+    worker.join();
+}
+
+void render_pipeline::synchronize(system_bus *source_bus, const virtual_ppu *source_ppu)
+{
+    // Brings our copy of the ppu up to date with the recording one, after which
+    // packets only need to carry what changed.
+    wait_until_idle();
+
+    memcpy(shadow_cart.tile_rom, source_cart->tile_rom, TILE_PAGE_SIZE * shadow_cart.header.tile_page_count);
+
+    for (uint32 address = 0x2000; address < 0x3000; address++)
+    {
+        shadow_bus.write_ppu_byte(address, source_bus->read_ppu_byte(address));
+    }
+
+    for (uint32 address = 0x3F00; address < 0x3F20; address++)
+    {
+        shadow_bus.write_ppu_byte(address, source_bus->read_ppu_byte(address));
+    }
+
+    shadow_ppu.copy_render_state(source_ppu);
+}
+
+const virtual_ppu *render_pipeline::query_ppu()
+{
+    return &shadow_ppu;
+}
+
+bool render_pipeline::is_ring_full()
+{
+    return write_index.load(std::memory_order_relaxed) - read_index.load(std::memory_order_seq_cst) >= PIPELINE_PACKET_COUNT;
+}
+
+void render_pipeline::wait_for_drain(bool until_empty)
+{
+    // Called by the recording thread only, which is the only one to advance 
+    // the write index. Sleeping is announced before the index is checked 
+    // again, and the render thread checks the announcement after advancing 
+    // the read index, so one of the two always sees the other.
+    uint32 write = write_index.load(std::memory_order_relaxed);
+    uint32 limit = until_empty ? 0 : PIPELINE_PACKET_COUNT - 1;
+
+    for (uint32 i = 0; i < PIPELINE_SPIN_COUNT; i++)
+    {
+        if (write - read_index.load(std::memory_order_acquire) <= limit)
+        {
+            return;
+        }
+
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> guard(wait_lock);
+
+    recorder_sleeping.store(true, std::memory_order_seq_cst);
+
+    while (write - read_index.load(std::memory_order_seq_cst) > limit)
+    {
+        drain_signal.wait(guard);
+    }
+
+    recorder_sleeping.store(false, std::memory_order_relaxed);
+}
+
+ppu_render_packet *render_pipeline::acquire_packet()
+{
+    // Called by the recording thread only. Waits while every packet is queued.
+    if (is_ring_full())
+    {
+        wait_for_drain(false);
+    }
+
+    return &packets[write_index.load(std::memory_order_relaxed) % PIPELINE_PACKET_COUNT];
+}
+
+void render_pipeline::submit_packet()
+{
+    write_index.store(write_index.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+
+    if (renderer_sleeping.load(std::memory_order_seq_cst))
+    {
+        std::lock_guard<std::mutex> guard(wait_lock);
+        packet_signal.notify_one();
+    }
+}
+
+void render_pipeline::wait_until_idle()
+{
+    wait_for_drain(true);
+}
+
+ppu_frame_view render_pipeline::query_frame_view(bool synchronous)
+{
+    // The render thread publishes through the triple buffer, so its latest 
+    // frame can be taken while it draws the next one.
+    if (synchronous)
+    {
+        wait_until_idle();
+    }
+
+    return shadow_ppu.query_frame_view();
+}
+
+void render_pipeline::run()
+{
+    uint32 idle_checks = 0;
+
+    while (running.load(std::memory_order_acquire))
+    {
+        uint32 read = read_index.load(std::memory_order_relaxed);
+
+        if (read == write_index.load(std::memory_order_acquire))
+        {
+            if (++idle_checks < PIPELINE_SPIN_COUNT)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(wait_lock);
+
+            renderer_sleeping.store(true, std::memory_order_seq_cst);
+
+            while (running.load(std::memory_order_relaxed) && read == write_index.load(std::memory_order_seq_cst))
+            {
+                packet_signal.wait(guard);
+            }
+
+            renderer_sleeping.store(false, std::memory_order_relaxed);
+            idle_checks = 0;
+            continue;
+        }
+
+        idle_checks = 0;
+
+        shadow_ppu.render_packet(&packets[read % PIPELINE_PACKET_COUNT]);
+        read_index.store(read + 1, std::memory_order_seq_cst);
+
+        if (recorder_sleeping.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> guard(wait_lock);
+            drain_signal.notify_one();
+        }
+    }
+}
+
+} // namespace nes
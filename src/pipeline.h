@@ -0,0 +1,109 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// pipeline.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __RENDER_PIPELINE_H__
+#define __RENDER_PIPELINE_H__
+
+#include "base.h"
+#include "cart.h"
+#include "bus.h"
+#include "ppu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define PIPELINE_PACKET_COUNT               (8)
+#define PIPELINE_SPIN_COUNT                 (256)       // checks before a waiting thread sleeps
+
+namespace nes {
+
+using namespace base;
+
+// Draws frames on a separate thread. The recording ppu hands over chunks of 
+// scanline registers and memory writes through a single producer, single 
+// consumer ring, and a private copy of the ppu, with its own bus and chr, 
+// replays them into its frame buffer while the cpu carries on. Either side 
+// that has to wait spins briefly and then sleeps until the other wakes it, so
+// an idle pipeline costs no cpu time.
+
+class render_pipeline
+{
+    cartridge shadow_cart;
+    const cartridge *source_cart;
+    system_bus shadow_bus;
+    virtual_ppu shadow_ppu;
+
+    ppu_render_packet *packets;
+    std::atomic<uint32> read_index;
+    std::atomic<uint32> write_index;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    std::mutex wait_lock;
+    std::condition_variable packet_signal;      // a packet was submitted, or we are stopping
+    std::condition_variable drain_signal;       // a packet was drawn
+    std::atomic<bool> renderer_sleeping;
+    std::atomic<bool> recorder_sleeping;
+
+public:
+
+    render_pipeline();
+    ~render_pipeline();
+
+    status start(const cartridge *game);
+    void stop();
+
+    void synchronize(system_bus *source_bus, const virtual_ppu *source_ppu);
+    const virtual_ppu *query_ppu();
+
+    ppu_render_packet *acquire_packet();
+    void submit_packet();
+    void wait_until_idle();
+
+    // Returns the latest frame the render thread has completed, or waits for 
+    // every line submitted so far to be drawn first.
+    ppu_frame_view query_frame_view(bool synchronous);
+
+private:
+
+    void run();
+    bool is_ring_full();
+    void wait_for_drain(bool until_empty);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(render_pipeline);
+};
+
+} // namespace nes
+
+#endif // __RENDER_PIPELINE_H__
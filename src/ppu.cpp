@@ -1,5 +1,11 @@
 
 #include "ppu.h"
+#include "pipeline.h"
+#include "hash.h"
+
+#if defined (BASE_SIMD_SSE2)
+#include "emmintrin.h"
+#endif
 
 namespace nes {
 
@@ -23,12 +29,52 @@ static const ppu_color ppu_palette[] =
     {0xb5, 0xeb, 0xf2}, {0xb8, 0xb8, 0xb8}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, 
 };
 
+const ppu_color *query_system_palette()
+{
+    return ppu_palette;
+}
+
+static shared_block *create_blank_frame()
+{
+    // Holds a reference of its own, so it is never freed or written to.
+    shared_block *block = shared_block::create(PPU_FRAME_BUFFER_SIZE + PPU_INDEX_BUFFER_SIZE);
+
+    if (block)
+    {
+        memset(block->query_data(), 0, block->query_size());
+    }
+
+    return block;
+}
+
+static shared_block *query_blank_frame()
+{
+    static shared_block *blank_frame = create_blank_frame();
+    return blank_frame;
+}
+
 virtual_ppu::virtual_ppu() 
 {
-    frame_buffer = new uint8[PPU_FRAME_BUFFER_SIZE];
-    sprite_attrib_ram = new uint8[OBJECT_ATTRIB_RAM_SIZE];
+    for (uint32 i = 0; i < PPU_FRAME_BUFFER_COUNT; i++)
+    {
+        frame_blocks[i] = NULL;
+        frame_buffers[i] = NULL;
+        index_buffers[i] = NULL;
+    }
 
-    if (!frame_buffer || !sprite_attrib_ram)
+    sprite_attrib_ram = new uint8[OBJECT_ATTRIB_RAM_SIZE];
+    nametable_cache = new ppu_nametable_entry[PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT];
+    nametable_bitmap = new uint8[PPU_NAMETABLE_BITMAP_SIZE];
+    nametable_bitmap_dirty = new uint8[PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT];
+    scanline_state_buffers = new ppu_scanline_state[PPU_FRAME_BUFFER_COUNT * PPU_FRAME_HEIGHT];
+    deferred_writes = new ppu_deferred_write[PPU_DEFERRED_LOG_SIZE];
+    background_cache_enabled = false;
+    scanline_cache_mode = PPU_SCANLINE_CACHE_DISABLED;
+    deferred_rendering_enabled = false;
+    pipeline = NULL;
+
+    if (!query_blank_frame() || !sprite_attrib_ram || !nametable_cache || !nametable_bitmap || 
+        !nametable_bitmap_dirty || !scanline_state_buffers || !deferred_writes)
     {
         base_post_error(BASE_ERROR_OUTOFMEMORY);
         return;
@@ -39,14 +85,37 @@ virtual_ppu::virtual_ppu()
 
 virtual_ppu::~virtual_ppu() 
 {
-    delete [] frame_buffer;
+    for (uint8 i = 0; i < PPU_FRAME_BUFFER_COUNT; i++)
+    {
+        attach_frame_block(i, NULL);
+    }
+
     delete [] sprite_attrib_ram;
+    delete [] nametable_cache;
+    delete [] nametable_bitmap;
+    delete [] nametable_bitmap_dirty;
+    delete [] scanline_state_buffers;
+    delete [] deferred_writes;
 }
 
 void virtual_ppu::reset()
 {
-    memset(frame_buffer, 0, PPU_FRAME_BUFFER_SIZE);
+    for (uint8 i = 0; i < PPU_FRAME_BUFFER_COUNT; i++)
+    {
+        attach_frame_block(i, query_blank_frame()->acquire());
+        memset(emphasis_buffers[i], 0, PPU_FRAME_HEIGHT);
+        frame_numbers[i] = 0;
+        frame_hashes[i] = 0;
+        memset(dirty_tile_buffers[i], 0, sizeof(dirty_tile_buffers[i]));
+    }
+
+    front_buffer = 2;
+    published_buffer = 1;
+    middle_buffer = 1;
+    select_back_buffer(0);
+
     memset(sprite_attrib_ram, 0, OBJECT_ATTRIB_RAM_SIZE);
+    memset(nametable_cache, 0, PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT * sizeof(ppu_nametable_entry));
 
     current_scan_line = 0;
     frame_count = 0;
@@ -62,6 +131,41 @@ void virtual_ppu::reset()
     ppu_vram_addr = 0;
     ppu_read_buffer = 0;
     ppu_byte_cache = 0;
+
+    // Palette RAM is cleared alongside the bus, so every entry starts as color zero.
+    for (uint32 i = 0; i < PPU_PALETTE_ENTRY_COUNT; i++)
+    {
+        palette_colors[i] = ppu_palette[0];
+        palette_color_indices[i] = 0;
+    }
+
+    for (uint32 i = 0; i < PPU_PALETTE_TABLE_COUNT; i++)
+    {
+        for (uint32 j = 0; j < 4; j++)
+        {
+            palette_tables[i][j] = ppu_palette[0];
+            palette_table_indices[i][j] = 0;
+        }
+    }
+
+    memset(&background_cache_stats, 0, sizeof(ppu_background_cache_stats));
+    memset(&last_background_cache_stats, 0, sizeof(ppu_background_cache_stats));
+    invalidate_background_cache();
+
+    palette_generation = 0;
+    pattern_generation = 0;
+    memset(nametable_row_generation, 0, sizeof(nametable_row_generation));
+    memset(scanline_state_buffers, 0, PPU_FRAME_BUFFER_COUNT * PPU_FRAME_HEIGHT * sizeof(ppu_scanline_state));
+    memset(scanline_sprite_zero_hit_buffers, 0, sizeof(scanline_sprite_zero_hit_buffers));
+    memset(&scanline_stats, 0, sizeof(ppu_scanline_stats));
+    memset(&last_scanline_stats, 0, sizeof(ppu_scanline_stats));
+
+    sprite_lists_dirty = true;
+
+    deferred_line_count = 0;
+    deferred_rendered_lines = 0;
+    deferred_frame_number = 0;
+    deferred_write_count = 0;
 }
 
 void virtual_ppu::attach_system_bus(system_bus *input)
@@ -79,6 +183,36 @@ uint32 virtual_ppu::query_current_scanline()
     return current_scan_line;
 }
 
+uint32 virtual_ppu::query_memory_usage()
+{
+    // Frame buffers still shared with a clone or the blank frame belong to no 
+    // one in particular and are left out, as are the background bitmap and 
+    // the deferred log while nothing touches their pages.
+    uint32 result = OBJECT_ATTRIB_RAM_SIZE + 
+                    PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT * (sizeof(ppu_nametable_entry) + 1) +
+                    PPU_FRAME_BUFFER_COUNT * PPU_FRAME_HEIGHT * sizeof(ppu_scanline_state);
+
+    for (uint8 i = 0; i < PPU_FRAME_BUFFER_COUNT; i++)
+    {
+        if (!frame_blocks[i]->is_shared())
+        {
+            result += frame_blocks[i]->query_size();
+        }
+    }
+
+    if (background_cache_enabled)
+    {
+        result += PPU_NAMETABLE_BITMAP_SIZE;
+    }
+
+    if (deferred_rendering_enabled || pipeline)
+    {
+        result += PPU_DEFERRED_LOG_SIZE * sizeof(ppu_deferred_write);
+    }
+
+    return result;
+}
+
 uint8 virtual_ppu::read_ppu_register(uint16 address)
 {
     uint8 output = 0;
@@ -143,6 +277,12 @@ void virtual_ppu::write_ppu_register(uint16 address, uint8 input)
             // If the write is activating vblank NMIs, and we are currently
             // in a vblank period, issue an NMI immediately.
 
+            if ((control_byte ^ input) & 0x20)
+            {
+                // Sprite size changed, so every sprite covers a different set of lines.
+                sprite_lists_dirty = true;
+            }
+
             control_byte = input;
 
             if (status_flags.vblank_flag && (input & 0x80))
@@ -166,7 +306,13 @@ void virtual_ppu::write_ppu_register(uint16 address, uint8 input)
 
         case 0x4: // OAM_DATA
         {
+            if (deferred_rendering_enabled || pipeline)
+            {
+                record_deferred_write(PPU_DEFERRED_WRITE_OAM, ppu_oam_addr, sprite_attrib_ram[ppu_oam_addr], input);
+            }
+
             sprite_attrib_ram[ppu_oam_addr++] = input;
+            sprite_lists_dirty = true;
 
         } break;
 
@@ -204,6 +350,11 @@ void virtual_ppu::write_ppu_register(uint16 address, uint8 input)
 
         case 0x7: // NAME_DATA
         {
+            if ((deferred_rendering_enabled || pipeline) && ppu_vram_addr < 0x3FFF)
+            {
+                record_deferred_write(PPU_DEFERRED_WRITE_VRAM, ppu_vram_addr, bus->read_ppu_byte(ppu_vram_addr), input);
+            }
+
             bus->write_ppu_byte(ppu_vram_addr, input);
 
             if (!control_flags.vertical_write)
@@ -229,401 +380,1550 @@ void virtual_ppu::write_oam_block(uint16 cpu_address)
 
     for (uint32 i = 0; i < OBJECT_ATTRIB_RAM_SIZE; i++)
     {
-        sprite_attrib_ram[ppu_oam_addr++] = bus->read_cpu_byte(cpu_address + i);
+        uint8 input = bus->read_cpu_byte(cpu_address + i);
+
+        if (deferred_rendering_enabled || pipeline)
+        {
+            record_deferred_write(PPU_DEFERRED_WRITE_OAM, ppu_oam_addr, sprite_attrib_ram[ppu_oam_addr], input);
+        }
+
+        sprite_attrib_ram[ppu_oam_addr++] = input;
     }
-}
 
-void virtual_ppu::read_frame_buffer(void *output_rgb_image)
-{
-    memcpy(output_rgb_image, frame_buffer + 8 * PPU_FRAME_WIDTH * 3, PPU_DISPLAY_BUFFER_SIZE);
+    sprite_lists_dirty = true;
 }
 
-void virtual_ppu::step()
+void virtual_ppu::update_palette_cache(uint8 index, uint8 color_index)
 {
-    // Scanline : Description
-    //
-    // 0        : dummy (Spr0 reset)
-    // 1-20     : dummy
-    // 21-260   : actual frame
-    // 261      : dummy (NMI)
+    // Called by the bus whenever palette RAM is written. The index has already
+    // been folded onto its backing entry, so $3F10/$3F14/$3F18/$3F1C arrive as
+    // their $3F00-$3F0C counterparts and we mirror them back out here.
 
-    if (0 == current_scan_line)
-    {
-        status_flags.sprite_zero_hit = 0;
-        status_flags.sprite_overflow_bit = 0;
-    }
+    ppu_color color = ppu_palette[color_index & 0x3F];
 
-    if (20 == current_scan_line)
-    {           
-        // Disable vertical blank flag
-        // status_flags.vblank_flag = 0;
-    }
+    palette_colors[index] = color;
+    palette_color_indices[index] = color_index & 0x3F;
+    palette_generation++;
 
-    if (current_scan_line > 20 && current_scan_line < 261)
+    if (0 == (index % 4))
     {
-        if (mask_flags.screen_enabled)
-        {
-            render_background_to_scanline(current_scan_line - 21);
-        }
+        palette_colors[index | 0x10] = color;
+        palette_color_indices[index | 0x10] = color_index & 0x3F;
+    }
 
-        if (mask_flags.sprites_enabled)
+    if (0 == index)
+    {
+        for (uint32 i = 0; i < PPU_PALETTE_TABLE_COUNT; i++)
         {
-            status_flags.sprite_zero_hit = 1;
-            render_sprites_to_scanline(current_scan_line - 21);
+            palette_tables[i][0] = color;
+            palette_table_indices[i][0] = color_index & 0x3F;
         }
     }
-     
-    if (261 == current_scan_line)
+    else if (index % 4)
     {
-        status_flags.vblank_flag = 1;
-
-        if (control_flags.vblank_enabled)
-        {
-            bus->fire_interrupt(NON_MASKABLE_INTERRUPT_VECTOR);
-        }
+        palette_tables[index >> 2][index % 4] = color;
+        palette_table_indices[index >> 2][index % 4] = color_index & 0x3F;
     }
-
-    current_scan_line = (current_scan_line + 1) % PPU_FRAME_SCANLINE_COUNT;
 }
 
-void virtual_ppu::render_background_to_scanline(uint8 scanline_y)
+void virtual_ppu::update_nametable_cache(uint16 address, uint8 input)
 {
-    // this method is responsible for traversing the list of tiles that are covered 
-    // by our current frame. for each tile we fetch the pattern byte and attribute 
-    // data, and then call render_pattern.
+    // Called by the bus whenever video ram is written. The address is the already
+    // mirrored offset into video ram, so bits 10-11 select the physical table.
 
-    uint32 start_x = (mask_flags.screen_mask ? 0 : 8);
+    ppu_nametable_entry *table = &nametable_cache[((address >> 10) & 0x3) * PPU_NAMETABLE_TILE_COUNT];
+    uint16 offset = address & 0x3FF;
 
-    for (uint32 scanline_x = start_x; scanline_x < 256;)
+    if (offset < PPU_NAMETABLE_ATTRIB_OFFSET)
     {
-        uint32 pixel_offset = (scanline_y * PPU_FRAME_WIDTH + scanline_x) * 3;
-
-        uint32 nametable_x = scanline_x + ppu_scroll_x;
-        uint32 nametable_y = scanline_y + ppu_scroll_y;
+        if (table[offset].tile_index != input)
+        {
+            table[offset].tile_index = input;
+            invalidate_nametable_cell((address >> 10) & 0x3, offset);
+            nametable_row_generation[((address >> 10) & 0x3) * PPU_NAMETABLE_HEIGHT + offset / PPU_NAMETABLE_WIDTH]++;
+        }
 
-        uint8 count = 8 - (nametable_x % 8);
-        count = min(count, 256 - scanline_x);
+        return;
+    }
 
-        uint8 pattern_index = fetch_nametable_byte(nametable_x >> 3, nametable_y >> 3);
-        uint8 attrib_index = fetch_attrib_byte(nametable_x >> 4, nametable_y >> 4);
+    // Each attribute byte covers a 4x4 block of tiles, with two bits for each
+    // of its 2x2 quadrants. The last row of blocks only covers two tile rows.
+    uint16 block_x = ((offset - PPU_NAMETABLE_ATTRIB_OFFSET) % 8) * 4;
+    uint16 block_y = ((offset - PPU_NAMETABLE_ATTRIB_OFFSET) / 8) * 4;
 
-        render_background_pattern(&frame_buffer[pixel_offset], pattern_index, attrib_index, nametable_x % 8, nametable_y % 8, count);
+    for (uint16 tile_y = block_y; tile_y < block_y + 4 && tile_y < PPU_NAMETABLE_HEIGHT; tile_y++)
+    {
+        for (uint16 tile_x = block_x; tile_x < block_x + 4; tile_x++)
+        {
+            uint8 shift = ((tile_y & 0x2) << 1) | (tile_x & 0x2);
+            uint16 cell = tile_y * PPU_NAMETABLE_WIDTH + tile_x;
 
-        scanline_x += count;
+            if (table[cell].palette_index != ((input >> shift) & 0x3))
+            {
+                table[cell].palette_index = (input >> shift) & 0x3;
+                invalidate_nametable_cell((address >> 10) & 0x3, cell);
+                nametable_row_generation[((address >> 10) & 0x3) * PPU_NAMETABLE_HEIGHT + tile_y]++;
+            }
+        }
     }
 }
 
-uint8 virtual_ppu::fetch_nametable_byte(uint16 tile_x, uint16 tile_y)
+void virtual_ppu::invalidate_pattern_tile(uint16 address)
 {
-    // We compute this each pass to catch cpu writes to ppu_control.
-    uint16 name_table_select = ((control_byte & 0x3) << 0xA);
-    uint16 tile_byte_address = 0x2000 | name_table_select;
-
-    if (mirror_mode)
-    {
-        // Vertical mirroring - $2000 and $2400 contain 
-        // our horizontal tables
+    // Called by the bus whenever pattern memory is written. We only note the tile
+    // here and resolve the affected cells the next time the cache is used.
 
-        if (tile_y >= 30)
-        {
-            base_post_error(BASE_ERROR_EXECUTION_FAILURE);
-        }
+    pattern_generation++;
 
-        if (tile_x >= 32)
-        {
-            tile_byte_address ^= 0x0400;
-            tile_x -= 32;
-        }
-    }
-    else
+    if (background_cache_enabled)
     {
-        // Horizontal mirroring - $2000 and $2800 contain 
-        // our vertical tables
+        pattern_tile_dirty[(address >> 4) & 0x1FF] = 1;
+        pattern_dirty_pending = true;
+    }
+}
 
-        if (tile_x >= 32)
-        {
-            base_post_error(BASE_ERROR_EXECUTION_FAILURE);
-        }
+void virtual_ppu::set_background_cache_enabled(bool enabled)
+{
+    // The cache is not maintained while disabled, so rebuild it from scratch.
+    background_cache_enabled = enabled;
+    invalidate_background_cache();
+}
 
-        if (tile_y >= 30)
-        {
-            tile_byte_address ^= 0x0800;
-            tile_y -= 30;
-        }
-    }
+ppu_background_cache_stats virtual_ppu::query_background_cache_stats()
+{
+    return last_background_cache_stats;
+}
 
-    tile_byte_address += tile_y * 32 + tile_x;      
-    return bus->read_ppu_byte(tile_byte_address);
+void virtual_ppu::set_scanline_cache_mode(uint8 mode)
+{
+    // Lines drawn while tracking was off have no recorded state to compare.
+    scanline_cache_mode = mode;
+    memset(scanline_state_buffers, 0, PPU_FRAME_BUFFER_COUNT * PPU_FRAME_HEIGHT * sizeof(ppu_scanline_state));
 }
 
-uint8 virtual_ppu::fetch_attrib_byte(uint16 tile_x, uint16 tile_y)
+ppu_scanline_stats virtual_ppu::query_scanline_stats()
 {
-    // We compute this each pass to catch cpu writes to ppu_control.
-    uint16 name_table_select = ((control_byte & 0x3) << 0xA);
-    uint16 tile_byte_address = 0x23C0 | name_table_select;
+    return last_scanline_stats;
+}
 
-    // Our location within the 8x8 grid.
-    uint16 attrib_block_x = tile_x >> 1;
-    uint16 attrib_block_y = tile_y >> 1;
+void virtual_ppu::set_deferred_rendering_enabled(bool enabled)
+{
+    // Lines recorded so far are drawn before switching back to eager rendering.
+    // When switching on, lines of the current frame that were already drawn are
+    // marked as such so that only the remainder is recorded.
+    flush_deferred_lines();
 
-    // Our location within the byte.
-    uint8 sub_tile_x = tile_x % 2;
-    uint8 sub_tile_y = tile_y % 2;
+    deferred_rendering_enabled = enabled;
 
-    if (mirror_mode)
+    if (!pipeline)
     {
-        // Vertical mirroring - $2000 and $2400 contain 
-        // our horizontal tables
+        uint8 current_line = PPU_FRAME_HEIGHT;
 
-        if (attrib_block_y >= 8)
+        if (current_scan_line > 20 && current_scan_line < 261)
         {
-            base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+            current_line = current_scan_line - 21;
         }
 
-        if (attrib_block_x >= 8)
-        {
-            tile_byte_address ^= 0x0400;
-            attrib_block_x -= 8;
-        }
+        deferred_line_count = current_line;
+        deferred_rendered_lines = current_line;
     }
-    else
+}
+
+void virtual_ppu::attach_render_pipeline(render_pipeline *input)
+{
+    // Outstanding lines are drawn by whoever recorded them, and the frame buffer
+    // is handed across, so the frame in progress continues seamlessly.
+    flush_deferred_lines();
+
+    if (pipeline)
     {
-        // Horizontal mirroring - $2000 and $2800 contain 
-        // our vertical tables
+        pipeline->wait_until_idle();
+        copy_render_state(pipeline->query_ppu());
+    }
 
-        if (attrib_block_x >= 8)
-        {
-            base_post_error(BASE_ERROR_EXECUTION_FAILURE);
-        }
+    pipeline = input;
 
-        if (attrib_block_y >= 8)
-        {
-            tile_byte_address ^= 0x0800;
-            attrib_block_y -= 8;
-        }
+    if (pipeline)
+    {
+        pipeline->synchronize(bus, this);
     }
 
-    tile_byte_address += attrib_block_y * 8 + attrib_block_x;      
-    uint8 attrib_byte = bus->read_ppu_byte(tile_byte_address);
-    attrib_byte = (attrib_byte >> (4 * sub_tile_y + 2 * sub_tile_x)) & 0x3;
+    // Outside of the visible lines the next line recorded belongs to a new frame.
+    uint8 current_line = 0;
+
+    if (current_scan_line > 20 && current_scan_line < 261)
+    {
+        current_line = current_scan_line - 21;
+    }
 
-    return attrib_byte;
+    deferred_line_count = current_line;
+    deferred_rendered_lines = current_line;
+    deferred_write_count = 0;
 }
 
-void virtual_ppu::render_background_pattern(uint8 *dest, uint8 pattern_index, uint8 palette_index, uint8 internal_x, uint8 internal_y, uint8 count)
+void virtual_ppu::copy_render_state(const virtual_ppu *source)
 {
-    // check our status bit to see which bank contains our background patterns
-    // load the high and low pattern bytes based on internal_y
-    // shift in based on internal_x and then render out count pixels to dest.
-
-    uint16 background_pattern_address = (control_flags.screen_pattern_table_addr ? 0x1000 : 0x0000);
-    uint16 low_pattern_byte_address = background_pattern_address + pattern_index * 16 + internal_y;
-    uint16 high_pattern_byte_address = low_pattern_byte_address + 8; 
+    // Copies what drawing needs beyond ppu memory, which is synchronized through
+    // the bus. The last completed frame is carried over and published, followed
+    // by the frame in progress. Lines are redrawn afterwards since our recorded 
+    // states are stale.
+    // A buffer that cannot be claimed keeps its old pixels.
+    if (base_succeeded(claim_back_buffer()))
+    {
+        memcpy(frame_buffer, source->frame_buffers[source->published_buffer], PPU_FRAME_BUFFER_SIZE);
+        memcpy(index_buffer, source->index_buffers[source->published_buffer], PPU_INDEX_BUFFER_SIZE);
+        memcpy(line_emphasis, source->emphasis_buffers[source->published_buffer], PPU_FRAME_HEIGHT);
+    }
 
-    uint8 low_pattern_byte = bus->read_ppu_byte(low_pattern_byte_address);
-    uint8 high_pattern_byte = bus->read_ppu_byte(high_pattern_byte_address);
+    publish_frame(source->frame_numbers[source->published_buffer]);
 
-    low_pattern_byte <<= internal_x;
-    high_pattern_byte <<= internal_x;
+    if (base_succeeded(claim_back_buffer()))
+    {
+        memcpy(frame_buffer, source->frame_buffer, PPU_FRAME_BUFFER_SIZE);
+        memcpy(index_buffer, source->index_buffer, PPU_INDEX_BUFFER_SIZE);
+        memcpy(line_emphasis, source->line_emphasis, PPU_FRAME_HEIGHT);
+    }
 
-    // prepare our palette base address.
-    uint16 palette_base_address = 0;
+    memcpy(sprite_attrib_ram, source->sprite_attrib_ram, OBJECT_ATTRIB_RAM_SIZE);
+    sprite_lists_dirty = true;
 
-    switch (palette_index)
-    {
-        case 0x0: palette_base_address = 0x3F01; break;
-        case 0x1: palette_base_address = 0x3F05; break;
-        case 0x2: palette_base_address = 0x3F09; break;
-        case 0x3: palette_base_address = 0x3F0D; break;
-    };
+    control_byte = source->control_byte;
+    mask_byte = source->mask_byte;
+    ppu_scroll_x = source->ppu_scroll_x;
+    ppu_scroll_y = source->ppu_scroll_y;
+    ppu_vram_addr = source->ppu_vram_addr;
 
-    render_background_pattern_line(dest, low_pattern_byte, high_pattern_byte, palette_base_address, count);    
+    set_background_cache_enabled(source->background_cache_enabled);
+    set_scanline_cache_mode(source->scanline_cache_mode);
 }
 
-void virtual_ppu::render_background_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint16 palette_base_address, uint8 count)
+void virtual_ppu::render_packet(const ppu_render_packet *packet)
 {
-    uint8 color_indices[4] = {0};
-    uint16 backdrop_address = 0x3F00;
+    // Called on the render thread. Our memory already matches the recording 
+    // ppu as of the start of this packet, so the writes only move forward.
+    replay_deferred_lines(packet->lines, packet->first_line, packet->line_count, 
+                          packet->writes, packet->write_count, packet->frame_number);
+}
 
-    if (ppu_vram_addr >= 0x3F00 && ppu_vram_addr <= 0x3FFF)
+void virtual_ppu::record_deferred_write(uint8 type, uint16 address, uint8 old_value, uint8 new_value)
+{
+    if (old_value == new_value)
     {
-        backdrop_address = ppu_vram_addr;
+        return;
     }
 
-    color_indices[0] = bus->read_ppu_byte(backdrop_address);
-    color_indices[1] = bus->read_ppu_byte(palette_base_address + 0);
-    color_indices[2] = bus->read_ppu_byte(palette_base_address + 1);
-    color_indices[3] = bus->read_ppu_byte(palette_base_address + 2);
-    
-    for (uint8 i = 0; i < count; i++)
+    if (PPU_DEFERRED_LOG_SIZE == deferred_write_count)
     {
-        uint8 pattern_byte = ((low_byte & 0x80) >> 7) | ((high_byte & 0x80) >> 6);
-        render_pixel(dest + i * 3, pattern_byte, color_indices);
-
-        low_byte <<= 1;
-        high_byte <<= 1;
+        // The log is full, so draw the lines recorded so far. This empties it 
+        // and the remainder of the frame is logged from this point on.
+        flush_deferred_lines();
     }
+
+    ppu_deferred_write *write = &deferred_writes[deferred_write_count++];
+
+    write->address = address;
+    write->scanline_y = deferred_line_count;
+    write->type = type;
+    write->old_value = old_value;
+    write->new_value = new_value;
 }
 
-ppu_sprite_desc *virtual_ppu::fetch_sprite_desc(uint8 index)
+void virtual_ppu::apply_deferred_write(const ppu_deferred_write *write, bool undo)
 {
-    ppu_sprite_desc *sprite_list = (ppu_sprite_desc *) sprite_attrib_ram;
-    uint8 test = sizeof(ppu_sprite_desc);
-    return &sprite_list[index];
+    uint8 value = undo ? write->old_value : write->new_value;
+
+    if (PPU_DEFERRED_WRITE_OAM == write->type)
+    {
+        sprite_attrib_ram[write->address] = value;
+        sprite_lists_dirty = true;
+    }
+    else
+    {
+        // Goes through the bus so that every derived cache follows the write.
+        bus->write_ppu_byte(write->address, value);
+    }
 }
 
-void virtual_ppu::render_sprites_to_scanline(uint8 scanline_y)
+void virtual_ppu::render_deferred_lines()
 {
-    // Render the sprites in reverse order (painter's algorithm). This won't be 
-    // able to support all games, but it works fine for the titles we care about.
-    ppu_sprite_desc *sprite_indices[8] = {0};
+    if (deferred_rendered_lines >= deferred_line_count)
+    {
+        // Nothing is waiting to be drawn, so the log is no longer needed.
+        deferred_write_count = 0;
+        return;
+    }
 
-    // First we find the set of sprites that collide with this scanline.
-    uint8 sprite_count = gather_sprite_hit_list(scanline_y, sprite_indices);
+    uint8 live_control_byte = control_byte;
+    uint8 live_mask_byte = mask_byte;
+    uint8 live_status_byte = status_byte;
+    uint8 live_scroll_x = ppu_scroll_x;
+    uint8 live_scroll_y = ppu_scroll_y;
+    uint16 live_vram_addr = ppu_vram_addr;
 
-    if (9 == sprite_count)
+    // Rewind memory to the point where the first pending line was recorded.
+    for (uint32 i = deferred_write_count; i > 0; i--)
     {
-        status_flags.sprite_overflow_bit = 1;
+        apply_deferred_write(&deferred_writes[i - 1], true);
     }
 
-    while (sprite_count)
+    replay_deferred_lines(&deferred_lines[deferred_rendered_lines], deferred_rendered_lines, 
+                          deferred_line_count - deferred_rendered_lines, deferred_writes, deferred_write_count, 
+                          deferred_frame_number);
+
+    // Drawing repeats the sprite status effects, which the cpu has already seen.
+    if ((control_byte ^ live_control_byte) & 0x20)
     {
-        ppu_sprite_desc *desc = sprite_indices[sprite_count - 1];
-        render_one_sprite_to_scanline(desc, scanline_y);
-        sprite_count--;
+        sprite_lists_dirty = true;
     }
+
+    control_byte = live_control_byte;
+    mask_byte = live_mask_byte;
+    status_byte = live_status_byte;
+    ppu_scroll_x = live_scroll_x;
+    ppu_scroll_y = live_scroll_y;
+    ppu_vram_addr = live_vram_addr;
+
+    deferred_rendered_lines = deferred_line_count;
+    deferred_write_count = 0;
 }
 
-uint8 virtual_ppu::gather_sprite_hit_list(uint8 scanline_y, ppu_sprite_desc **sprite_indices)
+void virtual_ppu::replay_deferred_lines(const ppu_deferred_line *lines, uint8 first_line, uint8 line_count, const ppu_deferred_write *writes, uint32 write_count, uint32 frame_number)
 {
-    uint8 sprite_count = 0;
-    
-    for (int8 sprite = 0; sprite < 64; sprite++)
+    // Draws each line with the registers it was recorded with, applying every 
+    // logged write that happened before it. Writes made after the last line 
+    // are applied at the end, leaving memory as the recording left it.
+
+    uint32 next_write = 0;
+
+    for (uint32 i = 0; i < line_count; i++)
     {
-        // Render sprite into our scanline if it hits it.
-        ppu_sprite_desc *desc = fetch_sprite_desc(sprite);
+        uint8 scanline_y = first_line + i;
 
-        if (desc->sprite_y >= 240 || desc->sprite_y > scanline_y || (desc->sprite_y + 7) < scanline_y)
+        while (next_write < write_count && writes[next_write].scanline_y <= scanline_y)
         {
-            // Sprite does not intersect our current scanline.
-            continue;
+            apply_deferred_write(&writes[next_write++], false);
         }
 
-        if (desc->sprite_x >= 256)
+        if ((control_byte ^ lines[i].control_byte) & 0x20)
         {
-            continue;
+            sprite_lists_dirty = true;
         }
 
-        if (sprite_count < 8)
-        {
-            // Add to our list
-            sprite_indices[sprite_count] = desc;
-            sprite_count++;
-        }
+        control_byte = lines[i].control_byte;
+        mask_byte = lines[i].mask_byte;
+        ppu_scroll_x = lines[i].scroll_x;
+        ppu_scroll_y = lines[i].scroll_y;
+        ppu_vram_addr = lines[i].vram_addr;
 
-        if (9 == sprite_count)
+        render_visible_scanline(scanline_y);
+
+        if (PPU_FRAME_HEIGHT - 1 == scanline_y)
         {
-            break;
+            publish_frame(frame_number);
         }
     }
 
-    return sprite_count;
-}
-
-void virtual_ppu::render_one_sprite_to_scanline(ppu_sprite_desc *desc, uint8 scanline_y)
-{
-    uint16 internal_y = scanline_y - desc->sprite_y;
-    uint32 pixel_offset = (scanline_y * PPU_FRAME_WIDTH + desc->sprite_x) * 3;
-    uint8 count = min(8, 256 - desc->sprite_x);
-        
-    if (!(desc->attributes & 0x20))
+    while (next_write < write_count)
     {
-        status_flags.sprite_zero_hit = 1;
-
-        // We only render the sprite if it's in front of the background.
-        render_sprite_pattern(&frame_buffer[pixel_offset], desc->tile_index, desc->attributes, internal_y, count);
+        apply_deferred_write(&writes[next_write++], false);
     }
 }
 
-void virtual_ppu::render_sprite_pattern(uint8 *dest, uint8 pattern_index, uint8 attributes, uint8 internal_y, uint8 count)
+void virtual_ppu::submit_render_packet()
 {
-    // check our status bit to see which bank contains our background patterns
-    // load the high and low pattern bytes based on internal_y
-    // shift in based on internal_x and then render out count pixels to dest.
-
-    if (attributes & 0x80)
+    if (deferred_rendered_lines >= deferred_line_count && !deferred_write_count)
     {
-        internal_y = 7 - internal_y;
+        return;
     }
 
-    uint8 palette_index = attributes & 0x3;
-    uint16 sprite_pattern_address = (control_flags.sprite_pattern_table_addr ? 0x1000 : 0x0000);
-    uint16 low_pattern_byte_address = sprite_pattern_address + pattern_index * 16 + internal_y;
-    uint16 high_pattern_byte_address = low_pattern_byte_address + 8; 
+    ppu_render_packet *packet = pipeline->acquire_packet();
 
-    uint8 low_pattern_byte = bus->read_ppu_byte(low_pattern_byte_address);
-    uint8 high_pattern_byte = bus->read_ppu_byte(high_pattern_byte_address);
+    packet->first_line = deferred_rendered_lines;
+    packet->line_count = deferred_line_count - deferred_rendered_lines;
+    packet->frame_number = deferred_frame_number;
+    packet->write_count = deferred_write_count;
 
-    // prepare our palette base address.
-    uint16 palette_base_address = 0;
+    memcpy(packet->lines, &deferred_lines[deferred_rendered_lines], packet->line_count * sizeof(ppu_deferred_line));
+    memcpy(packet->writes, deferred_writes, deferred_write_count * sizeof(ppu_deferred_write));
 
-    switch (palette_index)
-    {
-        case 0x0: palette_base_address = 0x3F11; break;
-        case 0x1: palette_base_address = 0x3F15; break;
-        case 0x2: palette_base_address = 0x3F19; break;
-        case 0x3: palette_base_address = 0x3F1D; break;
-    };
+    pipeline->submit_packet();
 
-    render_sprite_pattern_line(dest, low_pattern_byte, high_pattern_byte, attributes, palette_base_address, count);   
+    deferred_rendered_lines = deferred_line_count;
+    deferred_write_count = 0;
+
+    if (PPU_FRAME_HEIGHT == deferred_line_count)
+    {
+        // Writes from here on come before the first line of the next frame.
+        deferred_line_count = 0;
+        deferred_rendered_lines = 0;
+    }
 }
 
-void virtual_ppu::render_sprite_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint8 attributes, uint16 palette_base_address, uint8 count)
+void virtual_ppu::flush_deferred_lines()
 {
-    uint8 color_indices[4] = {0};
-    uint16 backdrop_address = 0x3F00;
-
-    color_indices[0] = bus->read_ppu_byte(backdrop_address);
-    color_indices[1] = bus->read_ppu_byte(palette_base_address + 0);
-    color_indices[2] = bus->read_ppu_byte(palette_base_address + 1);
-    color_indices[3] = bus->read_ppu_byte(palette_base_address + 2);
-    
-    if (attributes & 0x40)
+    if (pipeline)
     {
-        for (uint8 i = 0; i < count; i++)
-        {
-            uint8 pattern_byte = ((low_byte & 0x1) | ((high_byte & 0x1) << 1));
-            render_pixel(dest + i * 3, pattern_byte, color_indices, true);
-
-            low_byte >>= 1;
-            high_byte >>= 1;
-        }
+        submit_render_packet();
     }
     else
     {
-        for (uint8 i = 0; i < count; i++)
-        {
-            uint8 pattern_byte = ((low_byte & 0x80) >> 7) | ((high_byte & 0x80) >> 6);
-            render_pixel(dest + i * 3, pattern_byte, color_indices, true);
+        render_deferred_lines();
+    }
+}
 
-            low_byte <<= 1;
-            high_byte <<= 1;
+void virtual_ppu::invalidate_background_cache()
+{
+    memset(nametable_bitmap_dirty, 1, PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT);
+    memset(nametable_bitmap_row_dirty, 1, PPU_NAMETABLE_COUNT * PPU_NAMETABLE_HEIGHT);
+    memset(pattern_tile_dirty, 0, PPU_PATTERN_TILE_COUNT);
+
+    pattern_dirty_pending = false;
+    nametable_bitmap_pattern_table = control_flags.screen_pattern_table_addr;
+    background_cache_stats.tiles_invalidated += PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT;
+}
+
+void virtual_ppu::rebuild_nametable_cache()
+{
+    // Decodes every nametable from video ram at once, for when it was replaced 
+    // as a whole. Mirrored tables share their physical entries, so each is 
+    // decoded once, straight from its physical copy in video ram.
+
+    const uint8 *video_ram = bus->query_video_ram();
+    uint8 decoded = 0;
+
+    for (uint8 name_table = 0; name_table < PPU_NAMETABLE_COUNT; name_table++)
+    {
+        uint8 physical_table = fetch_physical_nametable(name_table);
+
+        if (decoded & (1 << physical_table))
+        {
+            continue;
+        }
+
+        const uint8 *memory = video_ram + physical_table * 0x400;
+        ppu_nametable_entry *table = &nametable_cache[physical_table * PPU_NAMETABLE_TILE_COUNT];
+
+        for (uint16 tile_y = 0; tile_y < PPU_NAMETABLE_HEIGHT; tile_y++)
+        {
+            // Palettes are expanded for the row first so that the cells below
+            // are a plain interleave of two byte rows.
+            const uint8 *attributes = memory + PPU_NAMETABLE_ATTRIB_OFFSET + (tile_y / 4) * 8;
+            uint8 row_shift = (tile_y & 0x2) << 1;
+            uint8 palettes[PPU_NAMETABLE_WIDTH];
+
+            for (uint16 block = 0; block < PPU_NAMETABLE_WIDTH / 4; block++)
+            {
+                uint8 left = (attributes[block] >> row_shift) & 0x3;
+                uint8 right = (attributes[block] >> (row_shift + 2)) & 0x3;
+
+                palettes[block * 4 + 0] = palettes[block * 4 + 1] = left;
+                palettes[block * 4 + 2] = palettes[block * 4 + 3] = right;
+            }
+
+            const uint8 *tiles = memory + tile_y * PPU_NAMETABLE_WIDTH;
+            ppu_nametable_entry *row = table + tile_y * PPU_NAMETABLE_WIDTH;
+
+            for (uint16 tile_x = 0; tile_x < PPU_NAMETABLE_WIDTH; tile_x++)
+            {
+                row[tile_x].tile_index = tiles[tile_x];
+                row[tile_x].palette_index = palettes[tile_x];
+            }
+
+            nametable_row_generation[physical_table * PPU_NAMETABLE_HEIGHT + tile_y]++;
+        }
+
+        decoded |= 1 << physical_table;
+    }
+
+    invalidate_background_cache();
+}
+
+void virtual_ppu::invalidate_nametable_cell(uint8 physical_table, uint16 cell)
+{
+    if (!background_cache_enabled)
+    {
+        return;
+    }
+
+    uint8 &dirty = nametable_bitmap_dirty[physical_table * PPU_NAMETABLE_TILE_COUNT + cell];
+
+    if (!dirty)
+    {
+        dirty = 1;
+        nametable_bitmap_row_dirty[physical_table * PPU_NAMETABLE_HEIGHT + cell / PPU_NAMETABLE_WIDTH] = 1;
+        background_cache_stats.tiles_invalidated++;
+    }
+}
+
+void virtual_ppu::refresh_nametable_bitmap_row(uint16 row_index)
+{
+    // Redraws the dirty cells of a single row of tiles into the bitmap.
+
+    uint32 cell = row_index * PPU_NAMETABLE_WIDTH;
+    uint16 background_pattern_address = (control_flags.screen_pattern_table_addr ? 0x1000 : 0x0000);
+    uint8 *row = &nametable_bitmap[row_index * 8 * PPU_NAMETABLE_PIXEL_WIDTH];
+
+    for (uint32 tile_x = 0; tile_x < PPU_NAMETABLE_WIDTH; tile_x++, cell++)
+    {
+        if (!nametable_bitmap_dirty[cell])
+        {
+            continue;
+        }
+
+        uint8 palette_slot = nametable_cache[cell].palette_index << 2;
+        uint16 low_pattern_byte_address = background_pattern_address + nametable_cache[cell].tile_index * 16;
+
+        for (uint32 internal_y = 0; internal_y < 8; internal_y++)
+        {
+            uint8 low_byte = bus->read_ppu_byte(low_pattern_byte_address + internal_y);
+            uint8 high_byte = bus->read_ppu_byte(low_pattern_byte_address + internal_y + 8);
+            uint8 *dest = &row[internal_y * PPU_NAMETABLE_PIXEL_WIDTH + tile_x * 8];
+
+            for (uint32 i = 0; i < 8; i++)
+            {
+                dest[i] = palette_slot | ((low_byte & 0x80) >> 7) | ((high_byte & 0x80) >> 6);
+
+                low_byte <<= 1;
+                high_byte <<= 1;
+            }
+        }
+
+        nametable_bitmap_dirty[cell] = 0;
+        background_cache_stats.tiles_rendered++;
+    }
+
+    nametable_bitmap_row_dirty[row_index] = 0;
+}
+
+void virtual_ppu::read_frame_buffer(void *output_rgb_image, bool synchronous)
+{
+    ppu_frame_view view = query_frame_view(synchronous);
+    uint8 *output = (uint8 *) output_rgb_image;
+
+    for (uint32 i = 0; i < view.height; i++)
+    {
+        memcpy(output + i * view.width * 3, view.pixels + i * view.stride, view.width * 3);
+    }
+}
+
+ppu_frame_view virtual_ppu::query_frame_view(bool synchronous)
+{
+    // Returns the most recently completed frame, which stays untouched until the
+    // next call. In eager mode this may be called from a thread other than the 
+    // one running the emulation. Deferred and pipelined modes first finish the
+    // frame on the calling thread, so they must be queried from the emulation.
+    // With a render thread the lines recorded so far are handed over, and the
+    // frame returned is the latest it has finished unless synchronous asks to
+    // wait for all of them to be drawn. The cpu may then run the next frame 
+    // while this one is still being drawn.
+
+    if (pipeline)
+    {
+        submit_render_packet();
+        return pipeline->query_frame_view(synchronous);
+    }
+
+    if (deferred_rendering_enabled)
+    {
+        render_deferred_lines();
+    }
+
+    return acquire_frame_view();
+}
+
+void virtual_ppu::prefetch()
+{
+    // The registers and palettes, OAM, and the records and pixels of the next
+    // visible line.
+    BASE_PREFETCH(&control_byte);
+    BASE_PREFETCH(palette_tables);
+
+    for (uint32 i = 0; i < OBJECT_ATTRIB_RAM_SIZE; i += 64)
+    {
+        BASE_PREFETCH(sprite_attrib_ram + i);
+    }
+
+    if (current_scan_line < 21 || current_scan_line > 260)
+    {
+        return;
+    }
+
+    uint8 scanline_y = current_scan_line - 21;
+    uint8 *pixels = &frame_buffer[scanline_y * PPU_FRAME_WIDTH * 3];
+    uint8 *indices = &index_buffer[scanline_y * PPU_FRAME_WIDTH];
+
+    BASE_PREFETCH(sprite_line_lists[scanline_y]);
+    BASE_PREFETCH(&scanline_states[scanline_y]);
+
+    for (uint32 i = 0; i < PPU_FRAME_WIDTH * 3; i += 64)
+    {
+        BASE_PREFETCH(pixels + i);
+    }
+
+    for (uint32 i = 0; i < PPU_FRAME_WIDTH; i += 64)
+    {
+        BASE_PREFETCH(indices + i);
+    }
+}
+
+void virtual_ppu::save_state(ppu_state *output)
+{
+    memcpy(output->sprite_attrib_ram, sprite_attrib_ram, OBJECT_ATTRIB_RAM_SIZE);
+
+    output->current_scan_line = current_scan_line;
+    output->frame_count = frame_count;
+    output->vram_addr = ppu_vram_addr;
+    output->control_byte = control_byte;
+    output->mask_byte = mask_byte;
+    output->status_byte = status_byte;
+    output->scroll_x = ppu_scroll_x;
+    output->scroll_y = ppu_scroll_y;
+    output->oam_addr = ppu_oam_addr;
+    output->read_buffer = ppu_read_buffer;
+    output->byte_cache = ppu_byte_cache;
+    output->address_latch = address_latch;
+    output->mirror_mode = mirror_mode;
+}
+
+void virtual_ppu::load_state(const ppu_state *input)
+{
+    // Expects the bus to already hold the loaded memory, and no deferred lines
+    // to be outstanding since their log describes the memory that was replaced.
+    // Everything derived from memory is rebuilt, and the generations advance so
+    // that no line is skipped on the strength of what was drawn before.
+
+    memcpy(sprite_attrib_ram, input->sprite_attrib_ram, OBJECT_ATTRIB_RAM_SIZE);
+
+    current_scan_line = input->current_scan_line % PPU_FRAME_SCANLINE_COUNT;
+    frame_count = input->frame_count;
+    ppu_vram_addr = input->vram_addr;
+    control_byte = input->control_byte;
+    mask_byte = input->mask_byte;
+    status_byte = input->status_byte;
+    ppu_scroll_x = input->scroll_x;
+    ppu_scroll_y = input->scroll_y;
+    ppu_oam_addr = input->oam_addr;
+    ppu_read_buffer = input->read_buffer;
+    ppu_byte_cache = input->byte_cache;
+    address_latch = !!input->address_latch;
+    mirror_mode = !!input->mirror_mode;
+
+    for (uint8 i = 0; i < PPU_PALETTE_ENTRY_COUNT; i++)
+    {
+        // The sprite backdrop entries are mirrors, refreshed along with their 
+        // background counterparts.
+        if (i < 0x10 || (i % 4))
+        {
+            update_palette_cache(i, bus->read_ppu_byte(0x3F00 + i));
+        }
+    }
+
+    rebuild_nametable_cache();
+
+    palette_generation++;
+    pattern_generation++;
+    sprite_lists_dirty = true;
+}
+
+void virtual_ppu::clone_from(const virtual_ppu *source)
+{
+    // Expects our bus to already hold a copy of the source's memory. Lines the
+    // source has deferred stay deferred, since its log undoes just as well 
+    // against the copy. The background bitmap is redrawn on demand rather than
+    // copied, and the frame buffers are shared.
+
+    memcpy(sprite_attrib_ram, source->sprite_attrib_ram, OBJECT_ATTRIB_RAM_SIZE);
+    memcpy(nametable_cache, source->nametable_cache, PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT * sizeof(ppu_nametable_entry));
+    memcpy(palette_colors, source->palette_colors, sizeof(palette_colors));
+    memcpy(palette_tables, source->palette_tables, sizeof(palette_tables));
+    memcpy(palette_color_indices, source->palette_color_indices, sizeof(palette_color_indices));
+    memcpy(palette_table_indices, source->palette_table_indices, sizeof(palette_table_indices));
+
+    current_scan_line = source->current_scan_line;
+    frame_count = source->frame_count;
+    control_byte = source->control_byte;
+    mask_byte = source->mask_byte;
+    status_byte = source->status_byte;
+    ppu_scroll_x = source->ppu_scroll_x;
+    ppu_scroll_y = source->ppu_scroll_y;
+    ppu_oam_addr = source->ppu_oam_addr;
+    ppu_read_buffer = source->ppu_read_buffer;
+    ppu_vram_addr = source->ppu_vram_addr;
+    ppu_byte_cache = source->ppu_byte_cache;
+    address_latch = source->address_latch;
+    mirror_mode = source->mirror_mode;
+
+    set_background_cache_enabled(source->background_cache_enabled);
+    scanline_cache_mode = source->scanline_cache_mode;
+    background_cache_stats = source->background_cache_stats;
+    last_background_cache_stats = source->last_background_cache_stats;
+    scanline_stats = source->scanline_stats;
+    last_scanline_stats = source->last_scanline_stats;
+    sprite_lists_dirty = true;
+
+    deferred_rendering_enabled = source->deferred_rendering_enabled;
+    deferred_line_count = source->deferred_line_count;
+    deferred_rendered_lines = source->deferred_rendered_lines;
+    deferred_frame_number = source->deferred_frame_number;
+    deferred_write_count = source->deferred_write_count;
+    memcpy(deferred_lines, source->deferred_lines, sizeof(deferred_lines));
+    memcpy(deferred_writes, source->deferred_writes, deferred_write_count * sizeof(ppu_deferred_write));
+
+    share_frame_buffers(source);
+}
+
+void virtual_ppu::share_frame_buffers(const virtual_ppu *source)
+{
+    // Takes a reference to each of the source's frames along with everything
+    // recorded about them, including the states their lines were drawn with 
+    // and the generations those refer to. With a render pipeline the frames 
+    // belong to its ppu, which must be idle.
+
+    for (uint8 i = 0; i < PPU_FRAME_BUFFER_COUNT; i++)
+    {
+        attach_frame_block(i, source->frame_blocks[i]->acquire());
+    }
+
+    memcpy(emphasis_buffers, source->emphasis_buffers, sizeof(emphasis_buffers));
+    memcpy(frame_hashes, source->frame_hashes, sizeof(frame_hashes));
+    memcpy(dirty_tile_buffers, source->dirty_tile_buffers, sizeof(dirty_tile_buffers));
+    memcpy(frame_numbers, source->frame_numbers, sizeof(frame_numbers));
+
+    front_buffer = source->front_buffer;
+    published_buffer = source->published_buffer;
+    middle_buffer.store(source->middle_buffer.load(std::memory_order_acquire), std::memory_order_relaxed);
+
+    palette_generation = source->palette_generation;
+    pattern_generation = source->pattern_generation;
+    memcpy(nametable_row_generation, source->nametable_row_generation, sizeof(nametable_row_generation));
+
+    if (PPU_SCANLINE_CACHE_DISABLED != scanline_cache_mode)
+    {
+        memcpy(scanline_state_buffers, source->scanline_state_buffers, 
+               PPU_FRAME_BUFFER_COUNT * PPU_FRAME_HEIGHT * sizeof(ppu_scanline_state));
+        memcpy(scanline_sprite_zero_hit_buffers, source->scanline_sprite_zero_hit_buffers, 
+               sizeof(scanline_sprite_zero_hit_buffers));
+    }
+
+    select_back_buffer(source->back_buffer);
+}
+
+ppu_frame_view virtual_ppu::acquire_frame_view()
+{
+    if (middle_buffer.load(std::memory_order_relaxed) & PPU_FRAME_BUFFER_FRESH)
+    {
+        front_buffer = middle_buffer.exchange(front_buffer, std::memory_order_acq_rel) & PPU_FRAME_BUFFER_INDEX_MASK;
+    }
+
+    ppu_frame_view view;
+
+    view.pixels = frame_buffers[front_buffer] + 8 * PPU_FRAME_WIDTH * 3;
+    view.indices = index_buffers[front_buffer] + 8 * PPU_FRAME_WIDTH;
+    view.emphasis = emphasis_buffers[front_buffer] + 8;
+    view.width = PPU_DISPLAY_WIDTH;
+    view.height = PPU_DISPLAY_HEIGHT;
+    view.stride = PPU_FRAME_WIDTH * 3;
+    view.index_stride = PPU_FRAME_WIDTH;
+    view.format = PPU_FRAME_FORMAT_RGB888;
+    view.frame = frame_numbers[front_buffer];
+    view.hash = frame_hashes[front_buffer];
+    view.dirty_tiles = dirty_tile_buffers[front_buffer];
+
+    return view;
+}
+
+void virtual_ppu::attach_frame_block(uint8 index, shared_block *block)
+{
+    // Takes over the reference to the block, which may be null.
+    if (frame_blocks[index])
+    {
+        frame_blocks[index]->release();
+    }
+
+    frame_blocks[index] = block;
+    frame_buffers[index] = block ? block->query_data() : NULL;
+    index_buffers[index] = block ? block->query_data() + PPU_FRAME_BUFFER_SIZE : NULL;
+}
+
+status virtual_ppu::claim_back_buffer()
+{
+    // Called before drawing into the back buffer. One that is shared with a
+    // clone, or still the blank frame, is copied first so that lines kept from
+    // its previous frame remain valid. Nothing may be drawn if that fails.
+    if (frame_blocks[back_buffer]->is_shared())
+    {
+        shared_block *block = claim_shared_block(frame_blocks[back_buffer]->acquire());
+
+        if (!block)
+        {
+            frame_blocks[back_buffer]->release();
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+
+        attach_frame_block(back_buffer, block);
+        select_back_buffer(back_buffer);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void virtual_ppu::select_back_buffer(uint8 index)
+{
+    back_buffer = index;
+    frame_buffer = frame_buffers[index];
+    index_buffer = index_buffers[index];
+    line_emphasis = emphasis_buffers[index];
+    scanline_states = &scanline_state_buffers[index * PPU_FRAME_HEIGHT];
+    scanline_sprite_zero_hits = scanline_sprite_zero_hit_buffers[index];
+}
+
+void virtual_ppu::publish_frame(uint32 frame_number)
+{
+    // The buffer we get back is either the one the reader released, or our
+    // previous frame if the reader never took it.
+    frame_numbers[back_buffer] = frame_number;
+    summarize_frame(back_buffer, published_buffer);
+    published_buffer = back_buffer;
+
+    uint8 previous = middle_buffer.exchange(back_buffer | PPU_FRAME_BUFFER_FRESH, std::memory_order_acq_rel);
+    select_back_buffer(previous & PPU_FRAME_BUFFER_INDEX_MASK);
+}
+
+static uint32 compare_tile_line(const uint8 *line, const uint8 *previous_line)
+{
+    // Returns a bit for each 8 pixel tile of the line that differs.
+    uint32 dirty = 0;
+
+#if defined (BASE_SIMD_SSE2)
+    for (uint32 i = 0; i < PPU_FRAME_TILE_COLUMNS / 2; i++)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (line + i * 16));
+        __m128i b = _mm_loadu_si128((const __m128i *) (previous_line + i * 16));
+        uint32 changed = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+
+        dirty |= ((0 != (changed & 0xFF)) << (i * 2)) | ((0 != (changed >> 8)) << (i * 2 + 1));
+    }
+#else
+    for (uint32 i = 0; i < PPU_FRAME_TILE_COLUMNS; i++)
+    {
+        dirty |= (0 != memcmp(line + i * 8, previous_line + i * 8, 8)) << i;
+    }
+#endif
+
+    return dirty;
+}
+
+void virtual_ppu::summarize_frame(uint8 index, uint8 previous_index)
+{
+    // The index plane and line emphasis determine every pixel, and are a third
+    // of the size of the colors.
+    const uint8 *indices = index_buffers[index];
+    const uint8 *previous_indices = index_buffers[previous_index];
+    const uint8 *emphasis = emphasis_buffers[index];
+    const uint8 *previous_emphasis = emphasis_buffers[previous_index];
+
+    for (uint32 row = 0; row < PPU_FRAME_TILE_ROWS; row++)
+    {
+        uint32 dirty = 0;
+
+        for (uint32 y = row * 8; y < row * 8 + 8; y++)
+        {
+            if (emphasis[y] != previous_emphasis[y])
+            {
+                dirty = 0xFFFFFFFF;
+                break;
+            }
+
+            dirty |= compare_tile_line(indices + y * PPU_FRAME_WIDTH, previous_indices + y * PPU_FRAME_WIDTH);
+        }
+
+        dirty_tile_buffers[index][row] = dirty;
+    }
+
+    frame_hashes[index] = compute_hash64(indices, PPU_INDEX_BUFFER_SIZE, compute_hash64(emphasis, PPU_FRAME_HEIGHT));
+}
+
+void virtual_ppu::step(bool render)
+{
+    // Scanline : Description
+    //
+    // 0        : dummy (Spr0 reset)
+    // 1-20     : dummy
+    // 21-260   : actual frame
+    // 261      : dummy (NMI)
+
+    if (0 == current_scan_line)
+    {
+        status_flags.sprite_zero_hit = 0;
+        status_flags.sprite_overflow_bit = 0;
+    }
+
+    if (20 == current_scan_line)
+    {           
+        // Disable vertical blank flag
+        // status_flags.vblank_flag = 0;
+    }
+
+    if (current_scan_line > 20 && current_scan_line < 261)
+    {
+        if (deferred_rendering_enabled || pipeline)
+        {
+            uint8 scanline_y = current_scan_line - 21;
+            ppu_deferred_line *line = &deferred_lines[scanline_y];
+
+            line->control_byte = control_byte;
+            line->mask_byte = mask_byte;
+            line->scroll_x = ppu_scroll_x;
+            line->scroll_y = ppu_scroll_y;
+            line->vram_addr = ppu_vram_addr;
+            deferred_line_count = scanline_y + 1;
+            deferred_frame_number = frame_count;
+
+            evaluate_scanline_status(scanline_y);
+
+            if (pipeline && (deferred_line_count - deferred_rendered_lines >= PPU_PIPELINE_CHUNK_LINES || 
+                             PPU_FRAME_HEIGHT == deferred_line_count))
+            {
+                submit_render_packet();
+            }
+        }
+        else if (render)
+        {
+            render_visible_scanline(current_scan_line - 21);
+
+            if (260 == current_scan_line)
+            {
+                publish_frame(frame_count);
+            }
+        }
+        else
+        {
+            evaluate_scanline_status(current_scan_line - 21);
+        }
+    }
+     
+    if (261 == current_scan_line)
+    {
+        status_flags.vblank_flag = 1;
+
+        last_background_cache_stats = background_cache_stats;
+        memset(&background_cache_stats, 0, sizeof(ppu_background_cache_stats));
+        background_cache_stats.frame = ++frame_count;
+
+        last_scanline_stats = scanline_stats;
+        memset(&scanline_stats, 0, sizeof(ppu_scanline_stats));
+        scanline_stats.frame = frame_count;
+
+        if (control_flags.vblank_enabled)
+        {
+            bus->fire_interrupt(NON_MASKABLE_INTERRUPT_VECTOR);
+        }
+    }
+
+    current_scan_line = (current_scan_line + 1) % PPU_FRAME_SCANLINE_COUNT;
+
+    if (21 == current_scan_line && !pipeline)
+    {
+        // A new frame begins. Whatever was recorded for the previous one and 
+        // never read is dropped along with its log.
+        deferred_line_count = 0;
+        deferred_rendered_lines = 0;
+        deferred_write_count = 0;
+    }
+}
+
+bool virtual_ppu::capture_scanline_state(uint8 scanline_y)
+{
+    // Records everything that feeds this scanline and returns true if it matches
+    // what was recorded the last time the line was drawn.
+
+    ppu_scanline_state state;
+    memset(&state, 0, sizeof(ppu_scanline_state));
+
+    state.valid = 1;
+    state.control_byte = control_byte;
+    state.mask_byte = mask_byte;
+    state.scroll_x = ppu_scroll_x;
+    state.scroll_y = ppu_scroll_y;
+    state.backdrop_index = PPU_PALETTE_ENTRY_COUNT;
+    state.palette_generation = palette_generation;
+    state.pattern_generation = pattern_generation;
+
+    if (ppu_vram_addr >= 0x3F00 && ppu_vram_addr <= 0x3FFF)
+    {
+        state.backdrop_index = ppu_vram_addr & 0x1F;
+    }
+
+    if (mask_flags.screen_enabled)
+    {
+        uint32 nametable_y = scanline_y + ppu_scroll_y;
+        uint8 name_table_select = control_byte & 0x3;
+
+        state.nametable_generation[0] = nametable_row_generation[fetch_nametable_row_index(name_table_select, nametable_y >> 3)];
+        state.nametable_generation[1] = nametable_row_generation[fetch_nametable_row_index(name_table_select ^ 0x1, nametable_y >> 3)];
+    }
+
+    if (mask_flags.sprites_enabled)
+    {
+        ppu_sprite_desc *sprite_indices[PPU_MAX_SPRITES_PER_SCANLINE] = {0};
+        state.sprite_count = gather_sprite_hit_list(scanline_y, sprite_indices);
+        state.sprite_zero = (state.sprite_count && sprite_indices[0] == fetch_sprite_desc(0));
+
+        for (uint8 i = 0; i < min(state.sprite_count, PPU_MAX_SPRITES_PER_SCANLINE); i++)
+        {
+            state.sprites[i] = *sprite_indices[i];
+        }
+    }
+
+    ppu_scanline_state *previous = &scanline_states[scanline_y];
+
+    if (0 == memcmp(previous, &state, sizeof(ppu_scanline_state)))
+    {
+        return true;
+    }
+
+    *previous = state;
+
+    return false;
+}
+
+void virtual_ppu::render_visible_scanline(uint8 scanline_y)
+{
+    if (base_failed(claim_back_buffer()))
+    {
+        // The line is left undrawn, but the cpu still sees its status effects.
+        evaluate_scanline_status(scanline_y);
+        return;
+    }
+
+    if (PPU_SCANLINE_CACHE_DISABLED == scanline_cache_mode)
+    {
+        render_scanline(scanline_y);
+        return;
+    }
+
+    if (!mask_flags.screen_enabled && !mask_flags.sprites_enabled)
+    {
+        // The line carries over from the previous frame, which depends on history
+        // rather than on any state we could record.
+        scanline_states[scanline_y].valid = 0;
+        render_scanline(scanline_y);
+        return;
+    }
+
+    if (!capture_scanline_state(scanline_y))
+    {
+        scanline_stats.lines_rendered++;
+        render_scanline(scanline_y);
+        return;
+    }
+
+    // The line is unchanged since it was last drawn, so its pixels are still 
+    // valid. We only need to repeat the status effects of drawing it.
+    scanline_stats.lines_skipped++;
+
+    if (9 == scanline_states[scanline_y].sprite_count)
+    {
+        status_flags.sprite_overflow_bit = 1;
+    }
+
+    if (scanline_sprite_zero_hits[scanline_y])
+    {
+        status_flags.sprite_zero_hit = 1;
+    }
+
+    if (PPU_SCANLINE_CACHE_VERIFY == scanline_cache_mode)
+    {
+        uint8 previous_line[PPU_FRAME_WIDTH * 3];
+        uint8 *current_line = &frame_buffer[scanline_y * PPU_FRAME_WIDTH * 3];
+
+        memcpy(previous_line, current_line, PPU_FRAME_WIDTH * 3);
+        render_scanline(scanline_y);
+
+        if (0 != memcmp(previous_line, current_line, PPU_FRAME_WIDTH * 3))
+        {
+            scanline_stats.lines_mismatched++;
+        }
+    }
+}
+
+void virtual_ppu::evaluate_scanline_status(uint8 scanline_y)
+{
+    // Used in place of rendering when the frame will be discarded. Only the state 
+    // the cpu can observe is updated: sprite overflow, and sprite zero hit, which 
+    // needs the background line only when sprite zero is on this scanline.
+
+    if (!mask_flags.sprites_enabled)
+    {
+        return;
+    }
+
+    ppu_sprite_desc *sprite_indices[PPU_MAX_SPRITES_PER_SCANLINE] = {0};
+    uint8 sprite_count = gather_sprite_hit_list(scanline_y, sprite_indices);
+
+    if (9 == sprite_count)
+    {
+        status_flags.sprite_overflow_bit = 1;
+    }
+
+    if (!mask_flags.screen_enabled || !sprite_count || sprite_indices[0] != fetch_sprite_desc(0))
+    {
+        return;
+    }
+
+    uint8 background_line[PPU_FRAME_WIDTH] = {0};
+    uint8 sprite_line[PPU_FRAME_WIDTH] = {0};
+
+    // Sprite zero is first in OAM order, so it owns all of its opaque pixels.
+    render_background_to_scanline(scanline_y, background_line);
+    render_one_sprite_to_scanline(sprite_indices[0], scanline_y, sprite_line);
+
+    if (!mask_flags.sprite_mask)
+    {
+        memset(sprite_line, 0, 8);
+    }
+
+    for (uint32 i = 0; i < PPU_FRAME_WIDTH - 1; i++)
+    {
+        if ((sprite_line[i] & 0x3) && (background_line[i] & 0x3))
+        {
+            status_flags.sprite_zero_hit = 1;
+            break;
+        }
+    }
+}
+
+void virtual_ppu::render_scanline(uint8 scanline_y)
+{
+    // Each layer is first rendered into a line of palette slots. The sprite line
+    // additionally carries the priority and sprite zero bits for each pixel, and
+    // both are merged into the frame buffer in a single pass.
+
+    if (!mask_flags.screen_enabled && !mask_flags.sprites_enabled)
+    {
+        // Nothing is drawn, so the line keeps what the last completed frame showed.
+        if (published_buffer != back_buffer)
+        {
+            memcpy(&frame_buffer[scanline_y * PPU_FRAME_WIDTH * 3], 
+                   &frame_buffers[published_buffer][scanline_y * PPU_FRAME_WIDTH * 3], PPU_FRAME_WIDTH * 3);
+            memcpy(&index_buffer[scanline_y * PPU_FRAME_WIDTH], 
+                   &index_buffers[published_buffer][scanline_y * PPU_FRAME_WIDTH], PPU_FRAME_WIDTH);
+            line_emphasis[scanline_y] = emphasis_buffers[published_buffer][scanline_y];
+        }
+
+        return;
+    }
+
+    uint8 background_line[PPU_FRAME_WIDTH] = {0};
+    uint8 sprite_line[PPU_FRAME_WIDTH] = {0};
+
+    if (mask_flags.screen_enabled)
+    {
+        render_background_to_scanline(scanline_y, background_line);
+    }
+
+    if (mask_flags.sprites_enabled)
+    {
+        render_sprites_to_scanline(scanline_y, sprite_line);
+    }
+
+    composite_scanline(scanline_y, background_line, sprite_line);
+}
+
+void virtual_ppu::composite_scanline(uint8 scanline_y, const uint8 *background_line, const uint8 *sprite_line)
+{
+    // Entry zero of every palette table is the backdrop, so a transparent pixel
+    // already resolves to it through its slot.
+    const ppu_color *colors = palette_tables[0];
+    const uint8 *color_indices = palette_table_indices[0];
+    ppu_color backdrop_colors[PPU_PALETTE_TABLE_COUNT * 4];
+    uint8 backdrop_indices[PPU_PALETTE_TABLE_COUNT * 4];
+
+    if (ppu_vram_addr >= 0x3F00 && ppu_vram_addr <= 0x3FFF)
+    {
+        // When the vram address points into palette RAM the backdrop is taken 
+        // from that entry instead of $3F00.
+        memcpy(backdrop_colors, palette_tables, sizeof(backdrop_colors));
+        memcpy(backdrop_indices, palette_table_indices, sizeof(backdrop_indices));
+
+        for (uint32 i = 0; i < PPU_PALETTE_TABLE_COUNT * 4; i += 4)
+        {
+            backdrop_colors[i] = palette_colors[ppu_vram_addr & 0x1F];
+            backdrop_indices[i] = palette_color_indices[ppu_vram_addr & 0x1F];
         }
+
+        colors = backdrop_colors;
+        color_indices = backdrop_indices;
+    }
+
+    // A sprite pixel wins if it is opaque and either in front of the background 
+    // or over a transparent background pixel. Sprite zero hits whenever an opaque
+    // sprite zero pixel overlaps an opaque background pixel, except at x=255.
+    uint8 slots[PPU_FRAME_WIDTH];
+    uint8 sprite_zero_hit = 0;
+
+    for (uint32 i = 0; i < PPU_FRAME_WIDTH; i++)
+    {
+        uint8 background_opaque = (0 != (background_line[i] & 0x3));
+        uint8 sprite_opaque = (0 != (sprite_line[i] & 0x3));
+        uint8 sprite_front = (0 == (sprite_line[i] & PPU_SPRITE_LINE_BEHIND));
+        uint8 sprite_wins = sprite_opaque & (sprite_front | !background_opaque);
+
+        slots[i] = (sprite_wins ? (sprite_line[i] & PPU_SPRITE_LINE_SLOT_MASK) : background_line[i]);
+        sprite_zero_hit |= (0 != (sprite_line[i] & PPU_SPRITE_LINE_ZERO)) & sprite_opaque & background_opaque & (i < PPU_FRAME_WIDTH - 1);
+    }
+
+    uint8 *dest = &frame_buffer[scanline_y * PPU_FRAME_WIDTH * 3];
+    uint8 *index_dest = &index_buffer[scanline_y * PPU_FRAME_WIDTH];
+
+    for (uint32 i = 0; i < PPU_FRAME_WIDTH; i++)
+    {
+        dest[i * 3 + 0] = colors[slots[i]].red;
+        dest[i * 3 + 1] = colors[slots[i]].green;
+        dest[i * 3 + 2] = colors[slots[i]].blue;
+        index_dest[i] = color_indices[slots[i]];
+    }
+
+    scanline_sprite_zero_hits[scanline_y] = sprite_zero_hit;
+    line_emphasis[scanline_y] = mask_byte >> 5;
+
+    if (sprite_zero_hit)
+    {
+        status_flags.sprite_zero_hit = 1;
     }
 }
 
-void virtual_ppu::render_pixel(uint8 *dest, uint8 pattern, uint8 *color_indices, bool zero_is_transparent)
+void virtual_ppu::render_background_to_scanline(uint8 scanline_y, uint8 *background_line)
 {
-    uint8 color_index = color_indices[pattern];
+    // this method is responsible for traversing the list of tiles that are covered 
+    // by our current frame. for each tile we fetch the pattern byte and attribute 
+    // data, and then call render_pattern.
 
-    if (0 == pattern && zero_is_transparent)
+    if (background_cache_enabled)
     {
+        render_background_from_cache(scanline_y, background_line);
         return;
     }
 
-    dest[0] = ppu_palette[color_index].red;
-    dest[1] = ppu_palette[color_index].green;
-    dest[2] = ppu_palette[color_index].blue;
+    uint32 start_x = (mask_flags.screen_mask ? 0 : 8);
+    uint32 nametable_y = scanline_y + ppu_scroll_y;
+
+    // We compute this each scanline to catch cpu writes to ppu_control. The left
+    // and right rows cover the two horizontally adjacent tables under our scroll.
+    uint8 name_table_select = control_byte & 0x3;
+    const ppu_nametable_entry *rows[2] = 
+    {
+        fetch_nametable_row(name_table_select, nametable_y >> 3),
+        fetch_nametable_row(name_table_select ^ 0x1, nametable_y >> 3),
+    };
+
+    for (uint32 scanline_x = start_x; scanline_x < 256;)
+    {
+        uint32 nametable_x = scanline_x + ppu_scroll_x;
+
+        uint8 count = 8 - (nametable_x % 8);
+        count = min(count, 256 - scanline_x);
+
+        const ppu_nametable_entry &entry = rows[(nametable_x >> 8) & 0x1][(nametable_x >> 3) % PPU_NAMETABLE_WIDTH];
+
+        render_background_pattern(&background_line[scanline_x], entry.tile_index, entry.palette_index, nametable_x % 8, nametable_y % 8, count);
+
+        scanline_x += count;
+    }
+}
+
+uint8 virtual_ppu::fetch_physical_nametable(uint8 name_table)
+{
+    // Vertical mirroring - $2000 and $2400 contain our horizontal tables.
+    // Horizontal mirroring - $2000 and $2800 contain our vertical tables.
+    return (mirror_mode ? (name_table & 0x1) : (name_table & 0x2));
+}
+
+uint16 virtual_ppu::fetch_nametable_row_index(uint8 name_table, uint16 tile_y)
+{
+    // Returns physical_table * PPU_NAMETABLE_HEIGHT + row. tile_y spans two 
+    // vertically adjacent tables, and moving past the bottom row selects the 
+    // table below our current one.
+
+    if (tile_y >= PPU_NAMETABLE_HEIGHT)
+    {
+        name_table ^= 0x2;
+        tile_y -= PPU_NAMETABLE_HEIGHT;
+    }
+
+    return fetch_physical_nametable(name_table) * PPU_NAMETABLE_HEIGHT + (tile_y % PPU_NAMETABLE_HEIGHT);
+}
+
+const ppu_nametable_entry *virtual_ppu::fetch_nametable_row(uint8 name_table, uint16 tile_y)
+{
+    return &nametable_cache[fetch_nametable_row_index(name_table, tile_y) * PPU_NAMETABLE_WIDTH];
+}
+
+void virtual_ppu::render_background_from_cache(uint8 scanline_y, uint8 *background_line)
+{
+    // Bring the cache up to date with any pattern changes before we read from it.
+    // Switching the background pattern table invalidates every cell.
+
+    if (nametable_bitmap_pattern_table != control_flags.screen_pattern_table_addr)
+    {
+        invalidate_background_cache();
+    }
+
+    if (pattern_dirty_pending)
+    {
+        uint16 pattern_bank = (control_flags.screen_pattern_table_addr ? 0x100 : 0x000);
+
+        for (uint32 i = 0; i < PPU_NAMETABLE_COUNT * PPU_NAMETABLE_TILE_COUNT; i++)
+        {
+            if (pattern_tile_dirty[pattern_bank + nametable_cache[i].tile_index])
+            {
+                invalidate_nametable_cell(i / PPU_NAMETABLE_TILE_COUNT, i % PPU_NAMETABLE_TILE_COUNT);
+            }
+        }
+
+        memset(pattern_tile_dirty, 0, PPU_PATTERN_TILE_COUNT);
+        pattern_dirty_pending = false;
+    }
+
+    uint32 start_x = (mask_flags.screen_mask ? 0 : 8);
+    uint32 nametable_y = scanline_y + ppu_scroll_y;
+    uint8 name_table_select = control_byte & 0x3;
+
+    // Fetch the bitmap lines for the two horizontally adjacent tables, redrawing
+    // their tile rows first if anything under them has changed.
+    const uint8 *lines[2] = {0};
+
+    for (uint8 i = 0; i < 2; i++)
+    {
+        uint16 row_index = fetch_nametable_row_index(name_table_select ^ i, nametable_y >> 3);
+
+        if (nametable_bitmap_row_dirty[row_index])
+        {
+            refresh_nametable_bitmap_row(row_index);
+        }
+
+        lines[i] = &nametable_bitmap[(row_index * 8 + nametable_y % 8) * PPU_NAMETABLE_PIXEL_WIDTH];
+    }
+
+    // The visible line is then a wrapped copy of at most two runs.
+    for (uint32 scanline_x = start_x; scanline_x < 256;)
+    {
+        uint32 nametable_x = scanline_x + ppu_scroll_x;
+        uint32 count = min(256 - (nametable_x & 0xFF), 256 - scanline_x);
+
+        memcpy(&background_line[scanline_x], lines[(nametable_x >> 8) & 0x1] + (nametable_x & 0xFF), count);
+
+        scanline_x += count;
+    }
+}
+
+void virtual_ppu::render_background_pattern(uint8 *dest, uint8 pattern_index, uint8 palette_index, uint8 internal_x, uint8 internal_y, uint8 count)
+{
+    // check our status bit to see which bank contains our background patterns
+    // load the high and low pattern bytes based on internal_y
+    // shift in based on internal_x and then render out count pixels to dest.
+
+    uint16 background_pattern_address = (control_flags.screen_pattern_table_addr ? 0x1000 : 0x0000);
+    uint16 low_pattern_byte_address = background_pattern_address + pattern_index * 16 + internal_y;
+    uint16 high_pattern_byte_address = low_pattern_byte_address + 8; 
+
+    uint8 low_pattern_byte = bus->read_ppu_byte(low_pattern_byte_address);
+    uint8 high_pattern_byte = bus->read_ppu_byte(high_pattern_byte_address);
+
+    low_pattern_byte <<= internal_x;
+    high_pattern_byte <<= internal_x;
+
+    render_background_pattern_line(dest, low_pattern_byte, high_pattern_byte, palette_index << 2, count);    
+}
+
+void virtual_ppu::render_background_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint8 palette_slot, uint8 count)
+{
+    for (uint8 i = 0; i < count; i++)
+    {
+        dest[i] = palette_slot | ((low_byte & 0x80) >> 7) | ((high_byte & 0x80) >> 6);
+
+        low_byte <<= 1;
+        high_byte <<= 1;
+    }
+}
+
+ppu_sprite_desc *virtual_ppu::fetch_sprite_desc(uint8 index)
+{
+    ppu_sprite_desc *sprite_list = (ppu_sprite_desc *) sprite_attrib_ram;
+    return &sprite_list[index];
+}
+
+void virtual_ppu::build_sprite_lists()
+{
+    // Evaluates every sprite once and appends it to the lists of the lines it
+    // covers, in OAM order. This replaces a scan of all 64 sprites per scanline.
+
+    uint8 sprite_height = (control_flags.sprite_size ? 16 : 8);
+
+    memset(sprite_line_counts, 0, sizeof(sprite_line_counts));
+
+    for (uint8 sprite = 0; sprite < PPU_SPRITE_COUNT; sprite++)
+    {
+        ppu_sprite_desc *desc = fetch_sprite_desc(sprite);
+
+        if (desc->sprite_y >= PPU_FRAME_HEIGHT)
+        {
+            continue;
+        }
+
+        uint32 last_line = min(desc->sprite_y + sprite_height, PPU_FRAME_HEIGHT);
+
+        for (uint32 line = desc->sprite_y; line < last_line; line++)
+        {
+            if (sprite_line_counts[line] < PPU_MAX_SPRITES_PER_SCANLINE)
+            {
+                sprite_line_lists[line][sprite_line_counts[line]++] = sprite;
+            }
+            else
+            {
+                sprite_line_counts[line] = PPU_MAX_SPRITES_PER_SCANLINE + 1;
+            }
+        }
+    }
+
+    sprite_lists_dirty = false;
+}
+
+void virtual_ppu::render_sprites_to_scanline(uint8 scanline_y, uint8 *sprite_line)
+{
+    // Render the sprites front to back in OAM order. A pixel is only written if
+    // no earlier sprite has already placed an opaque pixel there, which gives us
+    // the hardware's sprite priority even for sprites behind the background.
+    ppu_sprite_desc *sprite_indices[PPU_MAX_SPRITES_PER_SCANLINE] = {0};
+
+    // First we find the set of sprites that collide with this scanline.
+    uint8 sprite_count = gather_sprite_hit_list(scanline_y, sprite_indices);
+
+    if (9 == sprite_count)
+    {
+        status_flags.sprite_overflow_bit = 1;
+        sprite_count = PPU_MAX_SPRITES_PER_SCANLINE;
+    }
+
+    for (uint8 i = 0; i < sprite_count; i++)
+    {
+        render_one_sprite_to_scanline(sprite_indices[i], scanline_y, sprite_line);
+    }
+
+    if (!mask_flags.sprite_mask)
+    {
+        // Sprites are clipped from the leftmost eight pixels.
+        memset(sprite_line, 0, 8);
+    }
+}
+
+uint8 virtual_ppu::gather_sprite_hit_list(uint8 scanline_y, ppu_sprite_desc **sprite_indices)
+{
+    if (sprite_lists_dirty)
+    {
+        build_sprite_lists();
+    }
+
+    uint8 sprite_count = sprite_line_counts[scanline_y];
+
+    for (uint8 i = 0; i < min(sprite_count, PPU_MAX_SPRITES_PER_SCANLINE); i++)
+    {
+        sprite_indices[i] = fetch_sprite_desc(sprite_line_lists[scanline_y][i]);
+    }
+
+    return sprite_count;
+}
+
+void virtual_ppu::render_one_sprite_to_scanline(ppu_sprite_desc *desc, uint8 scanline_y, uint8 *sprite_line)
+{
+    uint16 internal_y = scanline_y - desc->sprite_y;
+    uint8 count = min(8, 256 - desc->sprite_x);
+    uint8 sprite_bits = (desc->attributes & PPU_SPRITE_LINE_BEHIND);
+
+    if (desc == fetch_sprite_desc(0))
+    {
+        sprite_bits |= PPU_SPRITE_LINE_ZERO;
+    }
+
+    render_sprite_pattern(&sprite_line[desc->sprite_x], desc->tile_index, desc->attributes, sprite_bits, internal_y, count);
+}
+
+void virtual_ppu::render_sprite_pattern(uint8 *dest, uint8 pattern_index, uint8 attributes, uint8 sprite_bits, uint8 internal_y, uint8 count)
+{
+    // check our status bit to see which bank contains our sprite patterns
+    // load the high and low pattern bytes based on internal_y
+    // and then render out count pixels to dest.
+
+    uint8 palette_index = attributes & 0x3;
+    uint16 sprite_pattern_address = (control_flags.sprite_pattern_table_addr ? 0x1000 : 0x0000);
+
+    if (control_flags.sprite_size)
+    {
+        // 8x16 sprites ignore the pattern table select. Bit zero of the tile index
+        // picks the bank, and the top and bottom halves use an even/odd tile pair.
+        if (attributes & 0x80)
+        {
+            internal_y = 15 - internal_y;
+        }
+
+        sprite_pattern_address = ((pattern_index & 0x1) ? 0x1000 : 0x0000);
+        pattern_index &= 0xFE;
+
+        if (internal_y >= 8)
+        {
+            pattern_index++;
+            internal_y -= 8;
+        }
+    }
+    else if (attributes & 0x80)
+    {
+        internal_y = 7 - internal_y;
+    }
+
+    uint16 low_pattern_byte_address = sprite_pattern_address + pattern_index * 16 + internal_y;
+    uint16 high_pattern_byte_address = low_pattern_byte_address + 8; 
+
+    uint8 low_pattern_byte = bus->read_ppu_byte(low_pattern_byte_address);
+    uint8 high_pattern_byte = bus->read_ppu_byte(high_pattern_byte_address);
+
+    // Sprite palettes occupy the upper four tables.
+    sprite_bits |= (4 + palette_index) << 2;
+
+    render_sprite_pattern_line(dest, low_pattern_byte, high_pattern_byte, attributes, sprite_bits, count);   
+}
+
+void virtual_ppu::render_sprite_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint8 attributes, uint8 sprite_bits, uint8 count)
+{
+    if (attributes & 0x40)
+    {
+        for (uint8 i = 0; i < count; i++)
+        {
+            uint8 pattern_byte = ((low_byte & 0x1) | ((high_byte & 0x1) << 1));
+
+            if (pattern_byte && !(dest[i] & 0x3))
+            {
+                dest[i] = sprite_bits | pattern_byte;
+            }
+
+            low_byte >>= 1;
+            high_byte >>= 1;
+        }
+    }
+    else
+    {
+        for (uint8 i = 0; i < count; i++)
+        {
+            uint8 pattern_byte = ((low_byte & 0x80) >> 7) | ((high_byte & 0x80) >> 6);
+
+            if (pattern_byte && !(dest[i] & 0x3))
+            {
+                dest[i] = sprite_bits | pattern_byte;
+            }
+
+            low_byte <<= 1;
+            high_byte <<= 1;
+        }
+    }
 }
 
 } // namespace nes
\ No newline at end of file
@@ -35,6 +35,9 @@
 
 #include "base.h"
 #include "bus.h"
+#include "shared.h"
+
+#include <atomic>
 
 #define PPU_FRAME_WIDTH                     (256)
 #define PPU_FRAME_HEIGHT                    (240)
@@ -43,7 +46,40 @@
 
 #define PPU_FRAME_BUFFER_SIZE               (PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT * 3)
 #define PPU_DISPLAY_BUFFER_SIZE             (PPU_DISPLAY_WIDTH * PPU_DISPLAY_HEIGHT * 3)
+#define PPU_INDEX_BUFFER_SIZE               (PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT)
+#define PPU_FRAME_BUFFER_COUNT              (3)
+#define PPU_FRAME_BUFFER_INDEX_MASK         (0x03)
+#define PPU_FRAME_BUFFER_FRESH              (0x04)   // published and not yet seen by the reader
+#define PPU_FRAME_FORMAT_RGB888             (0)
+#define PPU_FRAME_TILE_COLUMNS              (PPU_FRAME_WIDTH / 8)
+#define PPU_FRAME_TILE_ROWS                 (PPU_FRAME_HEIGHT / 8)
 #define OBJECT_ATTRIB_RAM_SIZE              (0x100)
+#define PPU_PALETTE_ENTRY_COUNT             (0x20)
+#define PPU_PALETTE_TABLE_COUNT             (8)
+#define PPU_NAMETABLE_COUNT                 (4)
+#define PPU_NAMETABLE_WIDTH                 (32)
+#define PPU_NAMETABLE_HEIGHT                (30)
+#define PPU_NAMETABLE_TILE_COUNT            (PPU_NAMETABLE_WIDTH * PPU_NAMETABLE_HEIGHT)
+#define PPU_NAMETABLE_ATTRIB_OFFSET         (0x3C0)
+#define PPU_NAMETABLE_PIXEL_WIDTH           (PPU_NAMETABLE_WIDTH * 8)
+#define PPU_NAMETABLE_PIXEL_HEIGHT          (PPU_NAMETABLE_HEIGHT * 8)
+#define PPU_NAMETABLE_BITMAP_SIZE           (PPU_NAMETABLE_COUNT * PPU_NAMETABLE_PIXEL_WIDTH * PPU_NAMETABLE_PIXEL_HEIGHT)
+#define PPU_PATTERN_TILE_COUNT              (0x200)
+#define PPU_MAX_SPRITES_PER_SCANLINE        (8)
+#define PPU_SPRITE_COUNT                    (64)
+
+#define PPU_SPRITE_LINE_SLOT_MASK           (0x1F)   // palette slot of the sprite pixel
+#define PPU_SPRITE_LINE_BEHIND              (0x20)   // sprite is behind the background
+#define PPU_SPRITE_LINE_ZERO                (0x40)   // pixel belongs to sprite zero
+
+#define PPU_SCANLINE_CACHE_DISABLED         (0)    // render every visible line
+#define PPU_SCANLINE_CACHE_ENABLED          (1)    // skip lines whose inputs are unchanged
+#define PPU_SCANLINE_CACHE_VERIFY           (2)    // render skippable lines anyway and compare
+
+#define PPU_DEFERRED_LOG_SIZE               (0x1000)
+#define PPU_DEFERRED_WRITE_VRAM             (0)    // ppu address space, including palette and chr
+#define PPU_DEFERRED_WRITE_OAM              (1)
+#define PPU_PIPELINE_CHUNK_LINES            (16)   // visible lines handed to the render thread at once
 
 #define PPU_CYCLES_PER_SCANLINE             (340)
 #define PPU_VBLANK_BEGIN_CYCLE              (260 * PPU_CYCLES_PER_SCANLINE)
@@ -72,6 +108,121 @@ typedef struct ppu_sprite_desc
 
 } ppu_sprite_desc;
 
+typedef struct ppu_frame_view
+{
+    const uint8 *pixels;        // first displayed row
+    const uint8 *indices;       // the same pixels as system palette indices (0-63)
+    const uint8 *emphasis;      // per row, the red, green and blue emphasis bits
+    uint32 width;
+    uint32 height;
+    uint32 stride;              // bytes from one row to the next
+    uint32 index_stride;
+    uint8 format;
+    uint32 frame;
+
+    // Summary of the whole 256x240 frame, of which the displayed rows are tile
+    // rows 1-28. The hash covers the palette indices and emphasis, which fully
+    // determine the pixels. Bit x of dirty_tiles[y] is set when that 8x8 tile
+    // differs from the frame published before this one. Frames skipped by the
+    // reader are not accounted for, so compare frame numbers to detect them.
+    uint64 hash;
+    const uint32 *dirty_tiles;
+
+} ppu_frame_view;
+
+typedef struct ppu_nametable_entry
+{
+    uint8 tile_index;
+    uint8 palette_index;
+
+} ppu_nametable_entry;
+
+typedef struct ppu_background_cache_stats
+{
+    uint32 frame;
+    uint32 tiles_invalidated;   // nametable cells marked dirty during the frame
+    uint32 tiles_rendered;      // nametable cells redrawn into the bitmap
+
+} ppu_background_cache_stats;
+
+typedef struct ppu_scanline_state
+{
+    uint32 palette_generation;
+    uint32 pattern_generation;
+    uint32 nametable_generation[2];
+    uint8 control_byte;
+    uint8 mask_byte;
+    uint8 scroll_x;
+    uint8 scroll_y;
+    uint8 backdrop_index;
+    uint8 sprite_count;
+    uint8 sprite_zero;
+    uint8 valid;
+    ppu_sprite_desc sprites[PPU_MAX_SPRITES_PER_SCANLINE];
+
+} ppu_scanline_state;
+
+typedef struct ppu_scanline_stats
+{
+    uint32 frame;
+    uint32 lines_rendered;
+    uint32 lines_skipped;
+    uint32 lines_mismatched;    // skipped lines that differed once re-rendered (verify mode)
+
+} ppu_scanline_stats;
+
+typedef struct ppu_deferred_line
+{
+    uint8 control_byte;
+    uint8 mask_byte;
+    uint8 scroll_x;
+    uint8 scroll_y;
+    uint16 vram_addr;
+
+} ppu_deferred_line;
+
+typedef struct ppu_deferred_write
+{
+    uint16 address;
+    uint8 scanline_y;           // first visible line drawn after the write
+    uint8 type;
+    uint8 old_value;
+    uint8 new_value;
+
+} ppu_deferred_write;
+
+typedef struct ppu_render_packet
+{
+    uint8 first_line;
+    uint8 line_count;
+    uint32 frame_number;
+    uint32 write_count;
+    ppu_deferred_line lines[PPU_FRAME_HEIGHT];          // lines[0] is first_line
+    ppu_deferred_write writes[PPU_DEFERRED_LOG_SIZE];
+
+} ppu_render_packet;
+
+typedef struct ppu_state
+{
+    uint8 sprite_attrib_ram[OBJECT_ATTRIB_RAM_SIZE];
+    uint32 current_scan_line;
+    uint32 frame_count;
+    uint16 vram_addr;
+    uint8 control_byte;
+    uint8 mask_byte;
+    uint8 status_byte;
+    uint8 scroll_x;
+    uint8 scroll_y;
+    uint8 oam_addr;
+    uint8 read_buffer;
+    uint8 byte_cache;
+    uint8 address_latch;
+    uint8 mirror_mode;
+
+} ppu_state;
+
+class render_pipeline;
+
 typedef struct ppu_control_flags
 {
     uint8 name_table_address : 2;
@@ -112,9 +263,94 @@ class virtual_ppu
 
     uint8 *frame_buffer;
     uint32 frame_count;
+
+    // Frames are drawn into the back buffer and published by exchanging it with
+    // the middle one. The reader takes the middle buffer whenever it is fresh, so
+    // a completed frame is never copied and never written while it is viewed.
+    // frame_buffer always points at the back buffer. Every frame is also kept 
+    // as system palette indices, for consumers that map colors themselves,
+    // along with the color emphasis each line was drawn with. The colors and
+    // indices of each buffer share a block, which clones refer to until one
+    // of them draws into it. A reset points every buffer at a blank frame.
+    shared_block *frame_blocks[PPU_FRAME_BUFFER_COUNT];
+    uint8 *frame_buffers[PPU_FRAME_BUFFER_COUNT];
+    uint8 *index_buffers[PPU_FRAME_BUFFER_COUNT];
+    uint8 *index_buffer;
+    uint8 emphasis_buffers[PPU_FRAME_BUFFER_COUNT][PPU_FRAME_HEIGHT];
+    uint8 *line_emphasis;
+
+    // Computed as each frame is published, for consumers that skip unchanged
+    // frames or tiles.
+    uint64 frame_hashes[PPU_FRAME_BUFFER_COUNT];
+    uint32 dirty_tile_buffers[PPU_FRAME_BUFFER_COUNT][PPU_FRAME_TILE_ROWS];
+    uint32 frame_numbers[PPU_FRAME_BUFFER_COUNT];
+    uint8 back_buffer;
+    uint8 front_buffer;
+    uint8 published_buffer;
+    std::atomic<uint8> middle_buffer;
+
     uint32 current_scan_line;
     uint8 *sprite_attrib_ram;
 
+    // Decoded copy of each physical nametable in video ram. Every 8x8 cell holds 
+    // its tile index and the two bit palette already extracted from the attribute 
+    // table. The bus keeps this in sync on writes to $2000-$2FFF.
+    ppu_nametable_entry *nametable_cache;
+
+    // Optional pre-rendered background. Each physical nametable is also kept as a
+    // 256x240 bitmap of palette slots (palette * 4 + pattern) so that a scanline 
+    // becomes a wrapped copy. Cells are redrawn only after their nametable entry,
+    // attribute or pattern tile changes.
+    bool background_cache_enabled;
+    bool pattern_dirty_pending;
+    uint8 nametable_bitmap_pattern_table;
+    uint8 *nametable_bitmap;
+    uint8 *nametable_bitmap_dirty;
+    uint8 nametable_bitmap_row_dirty[PPU_NAMETABLE_COUNT * PPU_NAMETABLE_HEIGHT];
+    uint8 pattern_tile_dirty[PPU_PATTERN_TILE_COUNT];
+    ppu_background_cache_stats background_cache_stats;
+    ppu_background_cache_stats last_background_cache_stats;
+
+    // Scanline level dirty tracking. We record the inputs that fed each visible
+    // line when it was last drawn and keep its pixels if none of them changed.
+    // Memory that is too large to compare directly is tracked by generation 
+    // counters that advance on every write. Each frame buffer keeps its own 
+    // records, and the pointers below follow the back buffer.
+    uint8 scanline_cache_mode;
+    uint32 palette_generation;
+    uint32 pattern_generation;
+    uint32 nametable_row_generation[PPU_NAMETABLE_COUNT * PPU_NAMETABLE_HEIGHT];
+    ppu_scanline_state *scanline_state_buffers;
+    ppu_scanline_state *scanline_states;
+    uint8 scanline_sprite_zero_hit_buffers[PPU_FRAME_BUFFER_COUNT][PPU_FRAME_HEIGHT];
+    uint8 *scanline_sprite_zero_hits;
+    ppu_scanline_stats scanline_stats;
+    ppu_scanline_stats last_scanline_stats;
+
+    // Sprites bucketed by the visible lines they cover, rebuilt only after OAM or
+    // the sprite size changes. A count of nine flags a sprite overflow on that
+    // line, in which case only the first eight sprites are listed.
+    bool sprite_lists_dirty;
+    uint8 sprite_line_counts[PPU_FRAME_HEIGHT];
+    uint8 sprite_line_lists[PPU_FRAME_HEIGHT][PPU_MAX_SPRITES_PER_SCANLINE];
+
+    // Deferred rendering. Visible lines only record the registers they would be
+    // drawn with, and every memory write made since the frame began is logged 
+    // with its previous value. Reading the frame buffer undoes the log to recover
+    // the memory as it was at the first unrendered line, then replays it forward
+    // while drawing. A frame that is never read costs only the log.
+    bool deferred_rendering_enabled;
+    uint8 deferred_line_count;
+    uint8 deferred_rendered_lines;
+    uint32 deferred_frame_number;
+    uint32 deferred_write_count;
+    ppu_deferred_line deferred_lines[PPU_FRAME_HEIGHT];
+    ppu_deferred_write *deferred_writes;
+
+    // When a render pipeline is attached the same records are handed to its
+    // thread in chunks instead, and its copy of the ppu draws them.
+    render_pipeline *pipeline;
+
     union 
     {
         uint8 control_byte;
@@ -143,13 +379,21 @@ class virtual_ppu
     bool address_latch;
     bool mirror_mode;
 
+    // Palette RAM resolved into output colors. The tables hold the four colors of 
+    // each background (0-3) and sprite (4-7) palette, with entry zero always set to 
+    // the universal backdrop. Both are refreshed only when palette RAM is written.
+    ppu_color palette_colors[PPU_PALETTE_ENTRY_COUNT];
+    ppu_color palette_tables[PPU_PALETTE_TABLE_COUNT][4];
+    uint8 palette_color_indices[PPU_PALETTE_ENTRY_COUNT];
+    uint8 palette_table_indices[PPU_PALETTE_TABLE_COUNT][4];
+
 public:
 
     virtual_ppu();
     ~virtual_ppu();
 
     void reset();
-    void step();
+    void step(bool render = true);
 
     void attach_system_bus(system_bus *input);
     void set_mirror_mode(bool mode);
@@ -157,31 +401,82 @@ public:
     uint8 read_ppu_register(uint16 address);
     void write_ppu_register(uint16 address, uint8 input);
     void write_oam_block(uint16 cpu_address);
+    void update_palette_cache(uint8 index, uint8 color_index);
+    void update_nametable_cache(uint16 address, uint8 input);
+    void invalidate_pattern_tile(uint16 address);
+
+    void set_background_cache_enabled(bool enabled);
+    ppu_background_cache_stats query_background_cache_stats();
+
+    void set_scanline_cache_mode(uint8 mode);
+    ppu_scanline_stats query_scanline_stats();
+
+    void set_deferred_rendering_enabled(bool enabled);
+    void attach_render_pipeline(render_pipeline *input);
+    void copy_render_state(const virtual_ppu *source);
+    void render_packet(const ppu_render_packet *packet);
+
+    void read_frame_buffer(void *output_rgb_image, bool synchronous = false);
+    ppu_frame_view query_frame_view(bool synchronous = false);
 
-    void read_frame_buffer(void *output_rgb_image);
+    void save_state(ppu_state *output);
+    void load_state(const ppu_state *input);
+
+    void clone_from(const virtual_ppu *source);
+    void share_frame_buffers(const virtual_ppu *source);
+    void flush_deferred_lines();
 
     uint32 query_current_scanline();
+    uint32 query_memory_usage();
+    void prefetch();
     void print_current_name_table();
     
 private:
 
-    uint8 fetch_nametable_byte(uint16 tile_x, uint16 tile_y);
-    uint8 fetch_attrib_byte(uint16 tile_x, uint16 tile_y);
+    uint8 fetch_physical_nametable(uint8 name_table);
+    uint16 fetch_nametable_row_index(uint8 name_table, uint16 tile_y);
+    const ppu_nametable_entry *fetch_nametable_row(uint8 name_table, uint16 tile_y);
+
+    void invalidate_background_cache();
+    void rebuild_nametable_cache();
+    void invalidate_nametable_cell(uint8 physical_table, uint16 cell);
+    void refresh_nametable_bitmap_row(uint16 row_index);
     ppu_sprite_desc *fetch_sprite_desc(uint8 index);
+    void build_sprite_lists();
     uint8 gather_sprite_hit_list(uint8 scanline_y, ppu_sprite_desc **sprite_indices);
 
-    void render_background_to_scanline(uint8 scanline_y);
+    void record_deferred_write(uint8 type, uint16 address, uint8 old_value, uint8 new_value);
+    void apply_deferred_write(const ppu_deferred_write *write, bool undo);
+    void render_deferred_lines();
+    void replay_deferred_lines(const ppu_deferred_line *lines, uint8 first_line, uint8 line_count, const ppu_deferred_write *writes, uint32 write_count, uint32 frame_number);
+    void submit_render_packet();
+
+    void attach_frame_block(uint8 index, shared_block *block);
+    status claim_back_buffer();
+    void select_back_buffer(uint8 index);
+    void publish_frame(uint32 frame_number);
+    void summarize_frame(uint8 index, uint8 previous_index);
+    ppu_frame_view acquire_frame_view();
+
+    bool capture_scanline_state(uint8 scanline_y);
+    void render_visible_scanline(uint8 scanline_y);
+    void evaluate_scanline_status(uint8 scanline_y);
+    void render_scanline(uint8 scanline_y);
+    void composite_scanline(uint8 scanline_y, const uint8 *background_line, const uint8 *sprite_line);
+
+    void render_background_to_scanline(uint8 scanline_y, uint8 *background_line);
+    void render_background_from_cache(uint8 scanline_y, uint8 *background_line);
     void render_background_pattern(uint8 *dest, uint8 pattern_index, uint8 palette_index, uint8 internal_x, uint8 internal_y, uint8 count);
-    void render_background_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint16 palette_base_address, uint8 count);
+    void render_background_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint8 palette_slot, uint8 count);
 
-    void render_sprites_to_scanline(uint8 scanline_y);
-    void render_one_sprite_to_scanline(ppu_sprite_desc *desc, uint8 scanline_y);
-    void render_sprite_pattern(uint8 *dest, uint8 pattern_index, uint8 attributes, uint8 internal_y, uint8 count);
-    void render_sprite_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint8 attributes, uint16 palette_base_address, uint8 count);
-
-    void render_pixel(uint8 *dest, uint8 pattern, uint8 *color_indices, bool zero_is_transparent=false);
+    void render_sprites_to_scanline(uint8 scanline_y, uint8 *sprite_line);
+    void render_one_sprite_to_scanline(ppu_sprite_desc *desc, uint8 scanline_y, uint8 *sprite_line);
+    void render_sprite_pattern(uint8 *dest, uint8 pattern_index, uint8 attributes, uint8 sprite_bits, uint8 internal_y, uint8 count);
+    void render_sprite_pattern_line(uint8 *dest, uint8 low_byte, uint8 high_byte, uint8 attributes, uint8 sprite_bits, uint8 count);
 };
 
+const ppu_color *query_system_palette();
+
 } // namespace nes
 
 #endif // __2C02_PPU_H__
\ No newline at end of file
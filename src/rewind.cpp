@@ -0,0 +1,290 @@
+
+#include "rewind.h"
+#include "delta.h"
+
+#include <chrono>
+
+// Decoding a keyframe costs about as much as applying this many differences.
+#define REWIND_KEYFRAME_COST                (4)
+
+#define REWIND_ENCODE_BOUND                 DELTA_ENCODE_BOUND(sizeof(famicom_state))
+
+namespace nes {
+
+static const uint8 zero_state[sizeof(famicom_state)] = { 0 };
+
+rewind_buffer::rewind_buffer()
+{
+    config.memory_limit = REWIND_DEFAULT_MEMORY_LIMIT;
+    config.frame_limit = REWIND_DEFAULT_FRAME_LIMIT;
+    config.keyframe_interval = REWIND_DEFAULT_KEYFRAME_INTERVAL;
+
+    history = NULL;
+    entries = NULL;
+    current_state = NULL;
+    scratch_state = NULL;
+    encode_buffer = NULL;
+
+    memset(&stats, 0, sizeof(rewind_stats));
+
+    clear();
+}
+
+rewind_buffer::~rewind_buffer()
+{
+    release();
+}
+
+void rewind_buffer::release()
+{
+    delete [] history;
+    delete [] entries;
+    delete current_state;
+    delete scratch_state;
+    delete [] encode_buffer;
+
+    history = NULL;
+    entries = NULL;
+    current_state = NULL;
+    scratch_state = NULL;
+    encode_buffer = NULL;
+}
+
+status rewind_buffer::configure(const rewind_config *input)
+{
+    // The history must be able to hold at least one keyframe along with its
+    // difference from the frame before.
+    if (!input || !input->frame_limit || input->memory_limit < 2 * REWIND_ENCODE_BOUND)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    release();
+    clear();
+
+    config = *input;
+
+    history = new uint8[config.memory_limit];
+    entries = new rewind_entry[config.frame_limit];
+    current_state = new famicom_state;
+    scratch_state = new famicom_state;
+    encode_buffer = new uint8[2 * REWIND_ENCODE_BOUND];
+
+    if (!history || !entries || !current_state || !scratch_state || !encode_buffer)
+    {
+        release();
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    // Padding within the state is never written, so it must start out equal.
+    memset(current_state, 0, sizeof(famicom_state));
+    memset(scratch_state, 0, sizeof(famicom_state));
+
+    return BASE_SUCCESS;
+}
+
+void rewind_buffer::query_config(rewind_config *output)
+{
+    *output = config;
+}
+
+void rewind_buffer::query_stats(rewind_stats *output)
+{
+    *output = stats;
+
+    output->frame_count = entry_count;
+    output->keyframe_count = 0;
+    output->memory_used = 0;
+    output->session_bytes = 0;
+
+    if (history)
+    {
+        output->session_bytes = sizeof(rewind_buffer) + config.memory_limit + config.frame_limit * sizeof(rewind_entry) +
+                                2 * sizeof(famicom_state) + 2 * REWIND_ENCODE_BOUND;
+    }
+
+    for (uint32 i = 0; i < entry_count; i++)
+    {
+        rewind_entry *entry = fetch_entry(i);
+
+        output->keyframe_count += !!entry->key_size;
+        output->memory_used += entry->delta_size + entry->key_size;
+    }
+}
+
+void rewind_buffer::clear()
+{
+    first_entry = 0;
+    entry_count = 0;
+    frames_since_keyframe = 0;
+}
+
+rewind_entry *rewind_buffer::fetch_entry(uint32 index)
+{
+    return &entries[(first_entry + index) % config.frame_limit];
+}
+
+uint8 *rewind_buffer::allocate_history(uint32 size)
+{
+    // Entries are laid out in the order they were recorded, wrapping to the
+    // start of the history when the end is reached. The oldest are dropped
+    // until the new entry fits after the latest one.
+
+    if (entry_count == config.frame_limit)
+    {
+        first_entry = (first_entry + 1) % config.frame_limit;
+        entry_count--;
+    }
+
+    while (entry_count)
+    {
+        rewind_entry *oldest = fetch_entry(0);
+        rewind_entry *latest = fetch_entry(entry_count - 1);
+        uint32 head = oldest->offset;
+        uint32 tail = latest->offset + latest->delta_size + latest->key_size;
+
+        if (latest->offset >= head)
+        {
+            if (config.memory_limit - tail >= size)
+            {
+                return history + tail;
+            }
+
+            if (head >= size)
+            {
+                return history;
+            }
+        }
+        else if (head - tail >= size)
+        {
+            return history + tail;
+        }
+
+        first_entry = (first_entry + 1) % config.frame_limit;
+        entry_count--;
+    }
+
+    return history;
+}
+
+status rewind_buffer::record(famicom *system)
+{
+    if (!system)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!history)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    if (base_failed(system->save_state(scratch_state)))
+    {
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    // The first frame has nothing to differ from and is always a keyframe.
+    uint32 delta_size = 0;
+    uint32 key_size = 0;
+
+    if (entry_count)
+    {
+        delta_size = encode_difference((const uint8 *) scratch_state, (const uint8 *) current_state,
+                                       sizeof(famicom_state), encode_buffer);
+    }
+
+    if (!entry_count || (config.keyframe_interval && frames_since_keyframe + 1 >= config.keyframe_interval))
+    {
+        key_size = encode_difference((const uint8 *) scratch_state, zero_state, sizeof(famicom_state),
+                                     encode_buffer + delta_size);
+        frames_since_keyframe = 0;
+    }
+    else
+    {
+        frames_since_keyframe++;
+    }
+
+    uint8 *destination = allocate_history(delta_size + key_size);
+    rewind_entry *entry = &entries[(first_entry + entry_count) % config.frame_limit];
+
+    memcpy(destination, encode_buffer, delta_size + key_size);
+
+    entry->offset = (uint32) (destination - history);
+    entry->delta_size = delta_size;
+    entry->key_size = key_size;
+    entry_count++;
+
+    famicom_state *previous_state = current_state;
+    current_state = scratch_state;
+    scratch_state = previous_state;
+
+    stats.record_count++;
+    stats.record_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+status rewind_buffer::rewind(famicom *system, uint32 frames)
+{
+    if (!system)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!entry_count)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    uint32 latest = entry_count - 1;
+    uint32 target = latest - min(frames, latest);
+    uint32 index = latest;
+
+    // Each difference leads to the frame before, so walking back from the
+    // latest state works for any target. A keyframe at or after the target
+    // shortens the walk when it is far enough from the latest state.
+    for (uint32 i = target; i < latest && i - target + REWIND_KEYFRAME_COST < latest - target; i++)
+    {
+        rewind_entry *entry = fetch_entry(i);
+
+        if (entry->key_size)
+        {
+            memset(current_state, 0, sizeof(famicom_state));
+            apply_difference((uint8 *) current_state, history + entry->offset + entry->delta_size, entry->key_size);
+            index = i;
+            break;
+        }
+    }
+
+    for (; index > target; index--)
+    {
+        rewind_entry *entry = fetch_entry(index);
+        apply_difference((uint8 *) current_state, history + entry->offset, entry->delta_size);
+    }
+
+    // Frames after the target are discarded, and recording resumes from it.
+    entry_count = target + 1;
+    frames_since_keyframe = 0;
+
+    while (frames_since_keyframe < target && !fetch_entry(target - frames_since_keyframe)->key_size)
+    {
+        frames_since_keyframe++;
+    }
+
+    if (base_failed(system->load_state(current_state)))
+    {
+        return base_post_error(BASE_ERROR_EXECUTION_FAILURE);
+    }
+
+    stats.restore_count++;
+    stats.restore_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+} // namespace nes
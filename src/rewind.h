@@ -0,0 +1,131 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// rewind.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __REWIND_BUFFER_H__
+#define __REWIND_BUFFER_H__
+
+#include "base.h"
+#include "nes.h"
+
+#define REWIND_DEFAULT_MEMORY_LIMIT         (0x80000)   // bytes of compressed history
+#define REWIND_DEFAULT_FRAME_LIMIT          (3600)      // one minute at 60 fps
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL    (300)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct rewind_config
+{
+    uint32 memory_limit;
+    uint32 frame_limit;
+    uint32 keyframe_interval;   // zero stores no keyframes beyond the first
+
+} rewind_config;
+
+typedef struct rewind_stats
+{
+    uint32 frame_count;         // frames that can be returned to, the latest included
+    uint32 keyframe_count;
+    uint32 memory_used;         // compressed history
+    uint32 session_bytes;       // everything the buffer allocated, history included
+    uint64 record_count;
+    uint64 restore_count;
+    float64 record_seconds;     // total time spent in record
+    float64 restore_seconds;    // total time spent in rewind
+
+} rewind_stats;
+
+typedef struct rewind_entry
+{
+    uint32 offset;              // into the history
+    uint32 delta_size;          // difference from the frame before, when kept
+    uint32 key_size;            // the whole state, when this is a keyframe
+
+} rewind_entry;
+
+// Keeps a bounded history of machine states for stepping a game backwards.
+// Each recorded frame stores its xor difference from the frame before, with
+// unchanged runs compressed away, and every keyframe_interval frames the 
+// whole state is stored as well. The difference works in both directions, so
+// stepping back a frame applies one of them to the latest state, while longer
+// jumps start from the nearest keyframe when that is shorter. Compressed 
+// frames share a ring of memory_limit bytes and the oldest are dropped to 
+// make room. Rewinding discards the frames that came after.
+
+class rewind_buffer
+{
+    rewind_config config;
+
+    uint8 *history;
+    rewind_entry *entries;
+    uint32 first_entry;
+    uint32 entry_count;
+    uint32 frames_since_keyframe;
+
+    // The latest state uncompressed, and room to build the next one.
+    famicom_state *current_state;
+    famicom_state *scratch_state;
+    uint8 *encode_buffer;
+
+    rewind_stats stats;
+
+public:
+
+    rewind_buffer();
+    ~rewind_buffer();
+
+    status configure(const rewind_config *input);
+    void query_config(rewind_config *output);
+    void query_stats(rewind_stats *output);
+    void clear();
+
+    // Call after every frame to be able to return to it.
+    status record(famicom *system);
+
+    // Restores the frame that many frames before the latest one. Asking for 
+    // more than is kept returns to the oldest frame available.
+    status rewind(famicom *system, uint32 frames = 1);
+
+private:
+
+    void release();
+
+    rewind_entry *fetch_entry(uint32 index);
+    uint8 *allocate_history(uint32 size);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(rewind_buffer);
+};
+
+} // namespace nes
+
+#endif // __REWIND_BUFFER_H__
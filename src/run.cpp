@@ -0,0 +1,215 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// run.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "base.h"
+#include "nes.h"
+#include "input.h"
+#include "boot.h"
+
+#include <chrono>
+
+using namespace base;
+using namespace nes;
+
+#define RUN_DEFAULT_FRAME_COUNT             (3600)
+#define RUN_CPU_CLOCK_RATE                  (1789773.0)    // ntsc 2A03
+
+static void print_syntax()
+{
+    base_msg("syntax: simplenes-run <rom filename> [options]");
+    base_msg("  -frames <count>     number of frames to run (default %i)", RUN_DEFAULT_FRAME_COUNT);
+    base_msg("  -input <filename>   scripted controller input");
+    base_msg("  -boot-frames <count> frames of the script to run before timing starts");
+    base_msg("  -boot-cache <dir>   keep the state after the boot frames, and start from it");
+    base_msg("  -skip-render        emulate without drawing any frames");
+    base_msg("  -deferred           draw frames only when they are read");
+    base_msg("  -render-thread      draw frames on a separate thread");
+    base_msg("  -hash               print the hash of the final frame");
+}
+
+// Runs a rom without a window for as many frames as requested, as quickly as
+// possible, and reports the emulation rate.
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        print_syntax();
+        return 1;
+    }
+
+    uint32 frame_count = RUN_DEFAULT_FRAME_COUNT;
+    const char *input_filename = NULL;
+    const char *boot_directory = NULL;
+    uint32 boot_frames = 0;
+    bool render = true;
+    bool deferred = false;
+    bool render_thread = false;
+    bool print_hash = false;
+
+    for (int32 i = 2; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-frames") && i + 1 < argc)
+        {
+            frame_count = atoi(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-input") && i + 1 < argc)
+        {
+            input_filename = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-boot-frames") && i + 1 < argc)
+        {
+            boot_frames = atoi(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-boot-cache") && i + 1 < argc)
+        {
+            boot_directory = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-skip-render"))
+        {
+            render = false;
+        }
+        else if (0 == strcmp(argv[i], "-deferred"))
+        {
+            deferred = true;
+        }
+        else if (0 == strcmp(argv[i], "-render-thread"))
+        {
+            render_thread = true;
+        }
+        else if (0 == strcmp(argv[i], "-hash"))
+        {
+            print_hash = true;
+        }
+        else
+        {
+            print_syntax();
+            return 1;
+        }
+    }
+
+    input_event *events = new input_event[INPUT_MAX_SCRIPT_EVENTS];
+    uint32 event_count = 0;
+
+    if (!events)
+    {
+        return 1;
+    }
+
+    if (input_filename && base_failed(load_input_script(input_filename, events, &event_count)))
+    {
+        base_msg("Failed to read input script %s", input_filename);
+        delete [] events;
+        return 1;
+    }
+
+    famicom *system = new famicom;
+    controller gamepads[2];
+
+    if (base_failed(system->insert_rom(argv[1])))
+    {
+        base_msg("Failed to load %s", argv[1]);
+        delete system;
+        delete [] events;
+        return 1;
+    }
+
+    system->attach_controller(0, &gamepads[0]);
+    system->attach_controller(1, &gamepads[1]);
+    system->set_deferred_rendering_enabled(deferred);
+
+    if (render_thread && base_failed(system->set_render_thread_enabled(true)))
+    {
+        base_msg("Failed to start the render thread");
+    }
+
+    if (boot_frames)
+    {
+        boot_cache cache;
+        boot_cache_stats boot_stats;
+        boot_script script;
+
+        script.name = input_filename;
+        script.events = events;
+        script.event_count = event_count;
+        script.frame_count = boot_frames;
+
+        if ((boot_directory && base_failed(cache.configure(boot_directory))) || 
+            base_failed(cache.boot(system, &script, gamepads)))
+        {
+            base_msg("Failed to boot through the first %u frames", boot_frames);
+            delete system;
+            delete [] events;
+            return 1;
+        }
+
+        cache.query_stats(&boot_stats);
+
+        printf("booted %u frames in %.3f seconds (%s)\n", boot_frames, boot_stats.load_seconds + boot_stats.run_seconds, 
+               boot_stats.hit_count ? "cached" : "emulated");
+    }
+
+    // Events before the boot frames only restore the buttons already held.
+    uint32 next_event = 0;
+    uint64 boot_cycles = system->query_cycle_count();
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint32 frame = boot_frames; frame < boot_frames + frame_count; frame++)
+    {
+        while (next_event < event_count && events[next_event].frame <= frame)
+        {
+            apply_input_event(&events[next_event++], gamepads);
+        }
+
+        system->tick(render);
+    }
+
+    // Drawing on another thread or on demand must complete before timing stops.
+    ppu_frame_view view = system->query_frame_view(true);
+    float64 seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+    float64 cycles = (float64) (system->query_cycle_count() - boot_cycles);
+
+    printf("frames: %u  seconds: %.3f  frames/sec: %.1f  cpu cycles/sec: %.0f (%.1fx realtime)\n", 
+           frame_count, seconds, frame_count / seconds, cycles / seconds, cycles / seconds / RUN_CPU_CLOCK_RATE);
+
+    if (print_hash)
+    {
+        printf("frame %u hash: %016llx\n", view.frame, (unsigned long long) view.hash);
+    }
+
+    system->eject_rom();
+
+    delete system;
+    delete [] events;
+
+    return 0;
+}
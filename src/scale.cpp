@@ -0,0 +1,548 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// scale.cpp
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#include "scale.h"
+
+#if defined (BASE_SIMD_SSE2)
+#include "emmintrin.h"
+#endif
+
+#if defined (BASE_SIMD_AVX2)
+#include "immintrin.h"
+#endif
+
+#define SCALER_PASS_COPY                    (0)
+#define SCALER_PASS_SCALE2X                 (1)
+#define SCALER_PASS_SCALE3X                 (2)
+#define SCALER_PASS_RESAMPLE                (3)
+#define SCALER_PASS_BORDER                  (4)
+
+namespace nes {
+
+static uint32 query_filter_factor(uint8 filter)
+{
+    switch (filter)
+    {
+        case SCALER_FILTER_SCALE2X: return 2;
+        case SCALER_FILTER_SCALE3X: return 3;
+        case SCALER_FILTER_SCALE4X: return 4;
+    }
+
+    return 1;
+}
+
+static inline void scale2x_pixel(uint32 b, uint32 d, uint32 e, uint32 f, uint32 h, uint32 *out0, uint32 *out1)
+{
+    if (b != h && d != f)
+    {
+        out0[0] = (d == b) ? d : e;
+        out0[1] = (b == f) ? f : e;
+        out1[0] = (d == h) ? d : e;
+        out1[1] = (h == f) ? f : e;
+    }
+    else
+    {
+        out0[0] = out0[1] = out1[0] = out1[1] = e;
+    }
+}
+
+static inline void scale3x_pixel(uint32 a, uint32 b, uint32 c, uint32 d, uint32 e, uint32 f, uint32 g, uint32 h, uint32 i, 
+                                 uint32 *out0, uint32 *out1, uint32 *out2)
+{
+    if (b != h && d != f)
+    {
+        out0[0] = (d == b) ? d : e;
+        out0[1] = ((d == b && e != c) || (b == f && e != a)) ? b : e;
+        out0[2] = (b == f) ? f : e;
+        out1[0] = ((d == b && e != g) || (d == h && e != a)) ? d : e;
+        out1[1] = e;
+        out1[2] = ((b == f && e != i) || (h == f && e != c)) ? f : e;
+        out2[0] = (d == h) ? d : e;
+        out2[1] = ((d == h && e != i) || (h == f && e != g)) ? h : e;
+        out2[2] = (h == f) ? f : e;
+    }
+    else
+    {
+        out0[0] = out0[1] = out0[2] = e;
+        out1[0] = out1[1] = out1[2] = e;
+        out2[0] = out2[1] = out2[2] = e;
+    }
+}
+
+#if defined (BASE_SIMD_SSE2)
+
+static inline __m128i select_si128(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline void store_interleaved_3(uint32 *output, __m128i a, __m128i b, __m128i c)
+{
+    // a0 b0 c0 a1 | b1 c1 a2 b2 | c2 a3 b3 c3
+    __m128 ab_low = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b));
+    __m128 ab_high = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b));
+    __m128 bc_low = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c));
+    __m128 bc_high = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c));
+    __m128 ca_low = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a));
+    __m128 ca_high = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a));
+
+    _mm_storeu_ps((float32 *) output, _mm_shuffle_ps(ab_low, ca_low, _MM_SHUFFLE(3, 0, 1, 0)));
+    _mm_storeu_ps((float32 *) output + 4, _mm_shuffle_ps(bc_low, ab_high, _MM_SHUFFLE(1, 0, 3, 2)));
+    _mm_storeu_ps((float32 *) output + 8, _mm_shuffle_ps(ca_high, bc_high, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+
+#endif
+
+static void scale2x_row(const uint32 *above, const uint32 *row, const uint32 *below, uint32 *out0, uint32 *out1, uint32 width)
+{
+    // Pixels past either edge repeat the edge pixel.
+    uint32 last = width - 1;
+    uint32 x = 1;
+
+    scale2x_pixel(above[0], row[0], row[0], row[min(1, last)], below[0], out0, out1);
+
+#if defined (BASE_SIMD_SSE2)
+    for (; x + 4 < width; x += 4)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *) (above + x));
+        __m128i d = _mm_loadu_si128((const __m128i *) (row + x - 1));
+        __m128i e = _mm_loadu_si128((const __m128i *) (row + x));
+        __m128i f = _mm_loadu_si128((const __m128i *) (row + x + 1));
+        __m128i h = _mm_loadu_si128((const __m128i *) (below + x));
+
+        __m128i blocked = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+        __m128i e0 = select_si128(_mm_andnot_si128(blocked, _mm_cmpeq_epi32(d, b)), d, e);
+        __m128i e1 = select_si128(_mm_andnot_si128(blocked, _mm_cmpeq_epi32(b, f)), f, e);
+        __m128i e2 = select_si128(_mm_andnot_si128(blocked, _mm_cmpeq_epi32(d, h)), d, e);
+        __m128i e3 = select_si128(_mm_andnot_si128(blocked, _mm_cmpeq_epi32(h, f)), f, e);
+
+        _mm_storeu_si128((__m128i *) (out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128((__m128i *) (out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128((__m128i *) (out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128((__m128i *) (out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        scale2x_pixel(above[x], row[x - 1], row[x], row[min(x + 1, last)], below[x], out0 + 2 * x, out1 + 2 * x);
+    }
+}
+
+static void scale3x_row(const uint32 *above, const uint32 *row, const uint32 *below, uint32 *out0, uint32 *out1, uint32 *out2, uint32 width)
+{
+    uint32 last = width - 1;
+    uint32 x = 1;
+    uint32 right = min(1, last);
+
+    scale3x_pixel(above[0], above[0], above[right], row[0], row[0], row[right], below[0], below[0], below[right], out0, out1, out2);
+
+#if defined (BASE_SIMD_SSE2)
+    for (; x + 4 < width; x += 4)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (above + x - 1));
+        __m128i b = _mm_loadu_si128((const __m128i *) (above + x));
+        __m128i c = _mm_loadu_si128((const __m128i *) (above + x + 1));
+        __m128i d = _mm_loadu_si128((const __m128i *) (row + x - 1));
+        __m128i e = _mm_loadu_si128((const __m128i *) (row + x));
+        __m128i f = _mm_loadu_si128((const __m128i *) (row + x + 1));
+        __m128i g = _mm_loadu_si128((const __m128i *) (below + x - 1));
+        __m128i h = _mm_loadu_si128((const __m128i *) (below + x));
+        __m128i i = _mm_loadu_si128((const __m128i *) (below + x + 1));
+
+        __m128i blocked = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+        __m128i db = _mm_andnot_si128(blocked, _mm_cmpeq_epi32(d, b));
+        __m128i bf = _mm_andnot_si128(blocked, _mm_cmpeq_epi32(b, f));
+        __m128i dh = _mm_andnot_si128(blocked, _mm_cmpeq_epi32(d, h));
+        __m128i hf = _mm_andnot_si128(blocked, _mm_cmpeq_epi32(h, f));
+        __m128i ea = _mm_cmpeq_epi32(e, a);
+        __m128i ec = _mm_cmpeq_epi32(e, c);
+        __m128i eg = _mm_cmpeq_epi32(e, g);
+        __m128i ei = _mm_cmpeq_epi32(e, i);
+
+        __m128i top = _mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf));
+        __m128i left = _mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh));
+        __m128i right = _mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf));
+        __m128i bottom = _mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf));
+
+        store_interleaved_3(out0 + 3 * x, select_si128(db, d, e), select_si128(top, b, e), select_si128(bf, f, e));
+        store_interleaved_3(out1 + 3 * x, select_si128(left, d, e), e, select_si128(right, f, e));
+        store_interleaved_3(out2 + 3 * x, select_si128(dh, d, e), select_si128(bottom, h, e), select_si128(hf, f, e));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        right = min(x + 1, last);
+
+        scale3x_pixel(above[x - 1], above[x], above[right], row[x - 1], row[x], row[right], 
+                      below[x - 1], below[x], below[right], out0 + 3 * x, out1 + 3 * x, out2 + 3 * x);
+    }
+}
+
+static void resample_row(const uint32 *row, const uint32 *column_map, uint32 *output, uint32 width)
+{
+    uint32 x = 0;
+
+#if defined (BASE_SIMD_AVX2)
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i columns = _mm256_loadu_si256((const __m256i *) (column_map + x));
+        _mm256_storeu_si256((__m256i *) (output + x), _mm256_i32gather_epi32((const int *) row, columns, 4));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        output[x] = row[column_map[x]];
+    }
+}
+
+frame_scaler::frame_scaler()
+{
+    memset(&config, 0, sizeof(scaler_config));
+    filter_factor = 1;
+    target_x = 0;
+    target_y = 0;
+    target_width = 0;
+    target_height = 0;
+
+    stage = NULL;
+    filtered = NULL;
+    column_map = NULL;
+    row_map = NULL;
+
+    pass_type = SCALER_PASS_COPY;
+    pass_source = NULL;
+    pass_source_stride = 0;
+    pass_source_width = 0;
+    pass_source_height = 0;
+    pass_output = NULL;
+    pass_output_stride = 0;
+}
+
+frame_scaler::~frame_scaler()
+{
+    pool.stop();
+    release();
+}
+
+void frame_scaler::release()
+{
+    delete [] stage;
+    delete [] filtered;
+    delete [] column_map;
+    delete [] row_map;
+
+    stage = NULL;
+    filtered = NULL;
+    column_map = NULL;
+    row_map = NULL;
+}
+
+status frame_scaler::configure(const scaler_config *input)
+{
+    if (!input || input->filter >= SCALER_FILTER_COUNT || !input->source_width || !input->source_height ||
+        !input->output_width || !input->output_height)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    uint32 source_width = input->source_width;
+    uint32 source_height = input->source_height;
+    uint32 width = input->output_width;
+    uint32 height = input->output_height;
+
+    if (input->integer_scale)
+    {
+        uint32 multiple = min(width / source_width, height / source_height);
+
+        if (!multiple)
+        {
+            return base_post_error(BASE_ERROR_INVALIDARG);
+        }
+
+        width = source_width * multiple;
+        height = source_height * multiple;
+    }
+    else if (input->letterbox)
+    {
+        // Fit whichever side is relatively shorter.
+        if (width * source_height > height * source_width)
+        {
+            width = max(source_width * height / source_height, 1);
+        }
+        else
+        {
+            height = max(source_height * width / source_width, 1);
+        }
+    }
+
+    pool.stop();
+    release();
+
+    config = *input;
+    config.thread_count = min(max(input->thread_count, 1), SCALER_MAX_THREADS);
+    filter_factor = query_filter_factor(config.filter);
+    target_width = width;
+    target_height = height;
+    target_x = (config.output_width - width) / 2;
+    target_y = (config.output_height - height) / 2;
+
+    uint32 filtered_width = source_width * filter_factor;
+    uint32 filtered_height = source_height * filter_factor;
+
+    if (SCALER_FILTER_SCALE4X == config.filter)
+    {
+        stage = new uint32[filtered_width * filtered_height / 4];
+
+        if (!stage)
+        {
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+    }
+
+    // Filters write straight into the output when their size matches the 
+    // target, otherwise into a buffer that is then resampled.
+    if (target_width != filtered_width || target_height != filtered_height)
+    {
+        column_map = new uint32[target_width];
+        row_map = new uint32[target_height];
+
+        if (!column_map || !row_map)
+        {
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+
+        if (SCALER_FILTER_NEAREST != config.filter)
+        {
+            filtered = new uint32[filtered_width * filtered_height];
+
+            if (!filtered)
+            {
+                return base_post_error(BASE_ERROR_OUTOFMEMORY);
+            }
+        }
+
+        for (uint32 x = 0; x < target_width; x++)
+        {
+            column_map[x] = x * filtered_width / target_width;
+        }
+
+        for (uint32 y = 0; y < target_height; y++)
+        {
+            row_map[y] = y * filtered_height / target_height;
+        }
+    }
+
+    pool.start(config.thread_count);
+
+    return BASE_SUCCESS;
+}
+
+void frame_scaler::query_config(scaler_config *output)
+{
+    if (output)
+    {
+        *output = config;
+    }
+}
+
+void frame_scaler::query_target(uint16 *x, uint16 *y, uint16 *width, uint16 *height)
+{
+    if (x) *x = target_x;
+    if (y) *y = target_y;
+    if (width) *width = target_width;
+    if (height) *height = target_height;
+}
+
+status frame_scaler::scale(const uint32 *source, uint32 source_stride, uint32 *output, uint32 output_stride)
+{
+    if (!source || !output || !target_width || source_stride < config.source_width * 4u || 
+        output_stride < config.output_width * 4u)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    uint32 source_width = config.source_width;
+    uint32 source_height = config.source_height;
+    uint32 filtered_stride = source_width * filter_factor * 4;
+    uint32 *target = (uint32 *) ((uint8 *) output + target_y * output_stride) + target_x;
+    uint32 *filter_output = filtered ? filtered : target;
+    uint32 filter_stride = filtered ? filtered_stride : output_stride;
+
+    switch (config.filter)
+    {
+        case SCALER_FILTER_NEAREST:
+        {
+            if (!column_map)
+            {
+                run_pass(SCALER_PASS_COPY, source, source_stride, source_width, source_height, target, output_stride, source_height);
+            }
+        } break;
+
+        case SCALER_FILTER_SCALE2X:
+        {
+            run_pass(SCALER_PASS_SCALE2X, source, source_stride, source_width, source_height, filter_output, filter_stride, source_height);
+        } break;
+
+        case SCALER_FILTER_SCALE3X:
+        {
+            run_pass(SCALER_PASS_SCALE3X, source, source_stride, source_width, source_height, filter_output, filter_stride, source_height);
+        } break;
+
+        case SCALER_FILTER_SCALE4X:
+        {
+            // Every band of the second pass reads rows next to it, so the first
+            // pass has to finish entirely before the second begins.
+            run_pass(SCALER_PASS_SCALE2X, source, source_stride, source_width, source_height, stage, filtered_stride / 2, source_height);
+            run_pass(SCALER_PASS_SCALE2X, stage, filtered_stride / 2, source_width * 2, source_height * 2, filter_output, filter_stride, source_height * 2);
+        } break;
+    }
+
+    if (column_map)
+    {
+        const uint32 *resample_source = filtered ? filtered : source;
+        uint32 resample_stride = filtered ? filtered_stride : source_stride;
+
+        run_pass(SCALER_PASS_RESAMPLE, resample_source, resample_stride, source_width * filter_factor, 
+                 source_height * filter_factor, target, output_stride, target_height);
+    }
+
+    if (target_width != config.output_width || target_height != config.output_height)
+    {
+        run_pass(SCALER_PASS_BORDER, NULL, 0, 0, 0, output, output_stride, config.output_height);
+    }
+
+    return BASE_SUCCESS;
+}
+
+void frame_scaler::run_pass(uint8 type, const uint32 *source, uint32 source_stride, uint32 source_width, 
+                            uint32 source_height, uint32 *output, uint32 output_stride, uint32 rows)
+{
+    pass_type = type;
+    pass_source = source;
+    pass_source_stride = source_stride;
+    pass_source_width = source_width;
+    pass_source_height = source_height;
+    pass_output = output;
+    pass_output_stride = output_stride;
+
+    pool.run(rows, &frame_scaler::run_band, this);
+}
+
+void frame_scaler::run_band(void *context, uint32 first_row, uint32 last_row)
+{
+    frame_scaler *scaler = (frame_scaler *) context;
+
+    switch (scaler->pass_type)
+    {
+        case SCALER_PASS_RESAMPLE: scaler->resample(first_row, last_row); break;
+        case SCALER_PASS_BORDER: scaler->fill_border(first_row, last_row); break;
+        default: scaler->filter_rows(first_row, last_row); break;
+    }
+}
+
+void frame_scaler::filter_rows(uint32 first_row, uint32 last_row)
+{
+    for (uint32 y = first_row; y < last_row; y++)
+    {
+        const uint8 *source = (const uint8 *) pass_source;
+        const uint32 *above = (const uint32 *) (source + (y ? y - 1 : 0) * pass_source_stride);
+        const uint32 *row = (const uint32 *) (source + y * pass_source_stride);
+        const uint32 *below = (const uint32 *) (source + min(y + 1, pass_source_height - 1) * pass_source_stride);
+
+        switch (pass_type)
+        {
+            case SCALER_PASS_COPY:
+            {
+                memcpy((uint8 *) pass_output + y * pass_output_stride, row, pass_source_width * 4);
+            } break;
+
+            case SCALER_PASS_SCALE2X:
+            {
+                uint32 *out0 = (uint32 *) ((uint8 *) pass_output + 2 * y * pass_output_stride);
+                uint32 *out1 = (uint32 *) ((uint8 *) out0 + pass_output_stride);
+
+                scale2x_row(above, row, below, out0, out1, pass_source_width);
+            } break;
+
+            case SCALER_PASS_SCALE3X:
+            {
+                uint32 *out0 = (uint32 *) ((uint8 *) pass_output + 3 * y * pass_output_stride);
+                uint32 *out1 = (uint32 *) ((uint8 *) out0 + pass_output_stride);
+                uint32 *out2 = (uint32 *) ((uint8 *) out1 + pass_output_stride);
+
+                scale3x_row(above, row, below, out0, out1, out2, pass_source_width);
+            } break;
+        }
+    }
+}
+
+void frame_scaler::resample(uint32 first_row, uint32 last_row)
+{
+    for (uint32 y = first_row; y < last_row; y++)
+    {
+        uint32 *output = (uint32 *) ((uint8 *) pass_output + y * pass_output_stride);
+
+        // Rows that sample the same source row are copies of the row above.
+        if (y > first_row && row_map[y] == row_map[y - 1])
+        {
+            memcpy(output, (uint8 *) output - pass_output_stride, target_width * 4);
+            continue;
+        }
+
+        const uint32 *row = (const uint32 *) ((const uint8 *) pass_source + row_map[y] * pass_source_stride);
+        resample_row(row, column_map, output, target_width);
+    }
+}
+
+void frame_scaler::fill_border(uint32 first_row, uint32 last_row)
+{
+    uint32 color = config.border_color;
+
+    for (uint32 y = first_row; y < last_row; y++)
+    {
+        uint32 *output = (uint32 *) ((uint8 *) pass_output + y * pass_output_stride);
+
+        if (y < target_y || y >= target_y + target_height)
+        {
+            for (uint32 x = 0; x < config.output_width; x++) output[x] = color;
+            continue;
+        }
+
+        for (uint32 x = 0; x < target_x; x++) output[x] = color;
+        for (uint32 x = target_x + target_width; x < config.output_width; x++) output[x] = color;
+    }
+}
+
+} // namespace nes
@@ -0,0 +1,125 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// scale.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __FRAME_SCALER_H__
+#define __FRAME_SCALER_H__
+
+#include "base.h"
+#include "bands.h"
+
+#define SCALER_FILTER_NEAREST               (0)
+#define SCALER_FILTER_SCALE2X               (1)    // identical output to epx
+#define SCALER_FILTER_SCALE3X               (2)
+#define SCALER_FILTER_SCALE4X               (3)    // scale2x applied twice
+#define SCALER_FILTER_COUNT                 (4)
+
+#define SCALER_MAX_THREADS                  (BAND_POOL_MAX_THREADS)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct scaler_config
+{
+    uint8 filter;
+    uint16 source_width;
+    uint16 source_height;
+    uint16 output_width;
+    uint16 output_height;
+    bool integer_scale;         // largest whole multiple of the source that fits
+    bool letterbox;             // keep the aspect ratio and border the remainder
+    uint32 border_color;
+    uint8 thread_count;         // including the calling thread
+
+} scaler_config;
+
+// Upscales 32 bit frames, as written by convert_frame, for display without a
+// gpu. The pixel art filters run first at their native factor and the result 
+// is resampled with nearest filtering only when it does not already match the
+// target region. Every pass is split into horizontal bands across a pool.
+
+class frame_scaler
+{
+    scaler_config config;
+    uint32 filter_factor;
+    uint16 target_x;
+    uint16 target_y;
+    uint16 target_width;
+    uint16 target_height;
+
+    uint32 *stage;              // first pass of scale4x
+    uint32 *filtered;           // filter output when it must be resampled
+    uint32 *column_map;
+    uint32 *row_map;
+
+    // Parameters of the pass in flight.
+    uint8 pass_type;
+    const uint32 *pass_source;
+    uint32 pass_source_stride;
+    uint32 pass_source_width;
+    uint32 pass_source_height;
+    uint32 *pass_output;
+    uint32 pass_output_stride;
+
+    band_pool pool;
+
+public:
+
+    frame_scaler();
+    ~frame_scaler();
+
+    status configure(const scaler_config *input);
+    void query_config(scaler_config *output);
+    void query_target(uint16 *x, uint16 *y, uint16 *width, uint16 *height);
+
+    // Strides are in bytes. The whole output is written, border included.
+    status scale(const uint32 *source, uint32 source_stride, uint32 *output, uint32 output_stride);
+
+private:
+
+    void release();
+
+    void run_pass(uint8 type, const uint32 *source, uint32 source_stride, uint32 source_width, 
+                  uint32 source_height, uint32 *output, uint32 output_stride, uint32 rows);
+    static void run_band(void *context, uint32 first_row, uint32 last_row);
+
+    void filter_rows(uint32 first_row, uint32 last_row);
+
+    void fill_border(uint32 first_row, uint32 last_row);
+    void resample(uint32 first_row, uint32 last_row);
+
+    BASE_DISABLE_COPY_AND_ASSIGN(frame_scaler);
+};
+
+} // namespace nes
+
+#endif // __FRAME_SCALER_H__
@@ -0,0 +1,158 @@
+
+#include "shared.h"
+
+#if defined (__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace nes {
+
+shared_block::shared_block()
+{
+    reference_count = 1;
+    size = 0;
+    allocation_size = 0;
+    page_kind = SHARED_PAGES_NORMAL;
+    data = NULL;
+}
+
+shared_block::~shared_block()
+{
+#if defined (__linux__)
+    if (SHARED_PAGES_HUGE == page_kind)
+    {
+        munmap(data, allocation_size);
+        return;
+    }
+
+    if (SHARED_PAGES_TRANSPARENT == page_kind)
+    {
+        free(data);
+        return;
+    }
+#endif
+
+    delete [] data;
+}
+
+bool shared_block::allocate_huge_pages()
+{
+#if defined (__linux__)
+    allocation_size = (size + SHARED_HUGE_PAGE_SIZE - 1) & ~(SHARED_HUGE_PAGE_SIZE - 1);
+
+    void *pages = mmap(NULL, allocation_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (MAP_FAILED != pages)
+    {
+        data = (uint8 *) pages;
+        page_kind = SHARED_PAGES_HUGE;
+        return true;
+    }
+
+    // Reserved pages are often not configured. Aligned memory is still backed 
+    // by a huge page if the kernel allows it when advised.
+    if (posix_memalign(&pages, SHARED_HUGE_PAGE_SIZE, allocation_size))
+    {
+        return false;
+    }
+
+    if (madvise(pages, allocation_size, MADV_HUGEPAGE))
+    {
+        free(pages);
+        return false;
+    }
+
+    data = (uint8 *) pages;
+    page_kind = SHARED_PAGES_TRANSPARENT;
+    return true;
+#else
+    return false;
+#endif
+}
+
+shared_block *shared_block::create(uint32 size, bool huge_pages)
+{
+    shared_block *block = new shared_block;
+
+    if (!block)
+    {
+        base_post_error(BASE_ERROR_OUTOFMEMORY);
+        return NULL;
+    }
+
+    block->size = size;
+
+    if (!huge_pages || !block->allocate_huge_pages())
+    {
+        block->data = new uint8[size];
+        block->allocation_size = size;
+    }
+
+    if (!block->data)
+    {
+        delete block;
+        base_post_error(BASE_ERROR_OUTOFMEMORY);
+        return NULL;
+    }
+
+    return block;
+}
+
+shared_block *shared_block::acquire()
+{
+    reference_count.fetch_add(1, std::memory_order_relaxed);
+    return this;
+}
+
+void shared_block::release()
+{
+    // The last reference may be dropped on another thread than the writes were
+    // made on, so those must be visible before the memory is freed.
+    if (1 == reference_count.fetch_sub(1, std::memory_order_acq_rel))
+    {
+        delete this;
+    }
+}
+
+bool shared_block::is_shared() const
+{
+    return reference_count.load(std::memory_order_acquire) > 1;
+}
+
+uint8 *shared_block::query_data() const
+{
+    return data;
+}
+
+uint32 shared_block::query_size() const
+{
+    return size;
+}
+
+uint8 shared_block::query_page_kind() const
+{
+    return page_kind;
+}
+
+shared_block *claim_shared_block(shared_block *block)
+{
+    if (!block->is_shared())
+    {
+        return block;
+    }
+
+    shared_block *copy = shared_block::create(block->query_size());
+
+    if (!copy)
+    {
+        // Writing into the block would change it for everyone who shares it.
+        return NULL;
+    }
+
+    memcpy(copy->query_data(), block->query_data(), block->query_size());
+    block->release();
+
+    return copy;
+}
+
+} // namespace nes
@@ -0,0 +1,97 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// shared.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __SHARED_BLOCK_H__
+#define __SHARED_BLOCK_H__
+
+#include "base.h"
+
+#include <atomic>
+
+#define SHARED_HUGE_PAGE_SIZE               (2 * BASE_MB)
+
+#define SHARED_PAGES_NORMAL                 (0)
+#define SHARED_PAGES_TRANSPARENT            (1)         // aligned and advised for transparent huge pages
+#define SHARED_PAGES_HUGE                   (2)         // reserved huge pages
+
+namespace nes {
+
+using namespace base;
+
+// A reference counted block of memory, shared between cloned machines until 
+// one of them needs to change it. Whoever writes to a block must hold the only
+// reference to it, which claim_shared_block arranges by copying it otherwise.
+// References may be taken and dropped from any thread.
+//
+// Blocks read by many machines at once may ask for huge pages, so that they 
+// take a single tlb entry. Reserved huge pages are tried first, then memory 
+// advised for transparent huge pages, and then ordinary memory.
+
+class shared_block
+{
+    std::atomic<uint32> reference_count;
+    uint32 size;
+    uint32 allocation_size;
+    uint8 page_kind;
+    uint8 *data;
+
+    shared_block();
+    ~shared_block();
+
+    BASE_DISABLE_COPY_AND_ASSIGN(shared_block);
+
+public:
+
+    static shared_block *create(uint32 size, bool huge_pages = false);
+
+    shared_block *acquire();
+    void release();
+
+    bool is_shared() const;
+    uint8 *query_data() const;
+    uint32 query_size() const;
+    uint8 query_page_kind() const;
+
+private:
+
+    bool allocate_huge_pages();
+};
+
+// Returns a block holding the same contents that only the caller refers to. The 
+// caller's reference moves to the returned block, which is the input itself
+// when it was not shared. Returns null if the copy could not be allocated, in
+// which case the caller keeps its reference to the input and must not write.
+shared_block *claim_shared_block(shared_block *block);
+
+} // namespace nes
+
+#endif // __SHARED_BLOCK_H__
@@ -0,0 +1,567 @@
+
+#include "store.h"
+#include "hash.h"
+
+#include <chrono>
+
+#if defined (__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined (_MSC_VER)
+#define STORE_SEEK                          _fseeki64
+#define STORE_TELL                          _ftelli64
+#else
+#define STORE_SEEK                          fseeko
+#define STORE_TELL                          ftello
+#endif
+
+#define STORE_INITIAL_INDEX_CAPACITY        (1024)
+
+// Room the mapping leaves for the file to grow into before it is remapped.
+#define STORE_MAPPING_RESERVE               (64 * BASE_MB)
+
+namespace nes {
+
+static status create_index(store_index *index, uint32 capacity)
+{
+    index->entries = new store_index_entry[capacity];
+    index->capacity = capacity;
+    index->count = 0;
+
+    if (!index->entries)
+    {
+        index->capacity = 0;
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    memset(index->entries, 0, capacity * sizeof(store_index_entry));
+
+    return BASE_SUCCESS;
+}
+
+static void release_index(store_index *index)
+{
+    delete [] index->entries;
+
+    index->entries = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+static store_index_entry *find_index_entry(const store_index *index, uint64 hash)
+{
+    // Returns the entry holding the hash, or the unused entry where it belongs.
+    uint32 mask = index->capacity - 1;
+    uint32 slot = (uint32) hash & mask;
+
+    while (index->entries[slot].offset && index->entries[slot].hash != hash)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    return &index->entries[slot];
+}
+
+static status insert_index_entry(store_index *index, uint64 hash, uint64 offset)
+{
+    // Probing stays short as long as the index is at most half full.
+    if (2 * (index->count + 1) > index->capacity)
+    {
+        store_index grown;
+
+        if (base_failed(create_index(&grown, 2 * index->capacity)))
+        {
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+
+        for (uint32 i = 0; i < index->capacity; i++)
+        {
+            if (index->entries[i].offset)
+            {
+                *find_index_entry(&grown, index->entries[i].hash) = index->entries[i];
+            }
+        }
+
+        grown.count = index->count;
+        release_index(index);
+        *index = grown;
+    }
+
+    store_index_entry *entry = find_index_entry(index, hash);
+
+    if (!entry->offset)
+    {
+        entry->hash = hash;
+        entry->offset = offset;
+        index->count++;
+    }
+
+    return BASE_SUCCESS;
+}
+
+static status drop_index_entries(store_index *index, uint64 end)
+{
+    // Keeps only the entries of records that lie before the end.
+    store_index kept;
+
+    if (base_failed(create_index(&kept, index->capacity)))
+    {
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    for (uint32 i = 0; i < index->capacity; i++)
+    {
+        if (index->entries[i].offset && index->entries[i].offset < end)
+        {
+            *find_index_entry(&kept, index->entries[i].hash) = index->entries[i];
+            kept.count++;
+        }
+    }
+
+    release_index(index);
+    *index = kept;
+
+    return BASE_SUCCESS;
+}
+
+state_store::state_store()
+{
+    file = NULL;
+    file_size = 0;
+    flushed_size = 0;
+    mapping = NULL;
+    mapping_size = 0;
+
+    memset(&pages, 0, sizeof(store_index));
+    memset(&states, 0, sizeof(store_index));
+    memset(&stats, 0, sizeof(store_stats));
+}
+
+state_store::~state_store()
+{
+    close();
+}
+
+status state_store::open(const char *filename)
+{
+    if (!filename)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    close();
+
+    auto begin = std::chrono::steady_clock::now();
+
+    memset(&stats, 0, sizeof(store_stats));
+
+    file = fopen(filename, "r+b");
+
+    if (!file)
+    {
+        file = fopen(filename, "w+b");
+    }
+
+    if (!file)
+    {
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+
+    if (base_failed(create_index(&pages, STORE_INITIAL_INDEX_CAPACITY)) || 
+        base_failed(create_index(&states, STORE_INITIAL_INDEX_CAPACITY)))
+    {
+        close();
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    STORE_SEEK(file, 0, SEEK_END);
+    file_size = STORE_TELL(file);
+    flushed_size = file_size;
+
+    store_file_header header;
+
+    if (!file_size)
+    {
+        memset(&header, 0, sizeof(store_file_header));
+
+        header.magic = STORE_FILE_MAGIC;
+        header.version = STORE_FILE_VERSION;
+        header.page_size = STORE_PAGE_SIZE;
+        header.state_version = FAMICOM_STATE_VERSION;
+        header.state_size = sizeof(famicom_state);
+
+        if (1 != fwrite(&header, sizeof(store_file_header), 1, file))
+        {
+            close();
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+
+        file_size = sizeof(store_file_header);
+    }
+    else
+    {
+        // States from another layout cannot be loaded, so such a pack is 
+        // refused rather than mixed with new ones.
+        if (base_failed(read_file(0, &header, sizeof(store_file_header))) || 
+            STORE_FILE_MAGIC != header.magic || STORE_FILE_VERSION != header.version || 
+            STORE_PAGE_SIZE != header.page_size || FAMICOM_STATE_VERSION != header.state_version || 
+            sizeof(famicom_state) != header.state_size)
+        {
+            close();
+            return base_post_error(BASE_ERROR_INVALID_RESOURCE);
+        }
+
+        status result = index_records();
+
+        if (base_failed(result))
+        {
+            close();
+            return result;
+        }
+    }
+
+    STORE_SEEK(file, file_size, SEEK_SET);
+
+    stats.open_seconds = std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+void state_store::close()
+{
+    if (file)
+    {
+        unmap_file();
+        fclose(file);
+    }
+
+    release_index(&pages);
+    release_index(&states);
+
+    file = NULL;
+    file_size = 0;
+    flushed_size = 0;
+}
+
+status state_store::index_records()
+{
+    uint64 offset = sizeof(store_file_header);
+    store_record_header header;
+
+    while (offset + sizeof(store_record_header) <= file_size)
+    {
+        // A record that cannot be read says nothing about whether the file is 
+        // whole, so it must not lead to truncating it.
+        if (base_failed(read_file(offset, &header, sizeof(store_record_header))))
+        {
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+
+        uint64 contents = offset + sizeof(store_record_header);
+        bool valid = (STORE_RECORD_PAGE == header.kind && STORE_PAGE_SIZE == header.size) || 
+                     (STORE_RECORD_STATE == header.kind && STORE_STATE_PAGE_COUNT * sizeof(uint64) == header.size);
+
+        if (!valid || contents + header.size > file_size)
+        {
+            break;
+        }
+
+        if (base_failed(insert_index_entry((STORE_RECORD_PAGE == header.kind) ? &pages : &states, header.hash, contents)))
+        {
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+
+        offset = contents + header.size;
+    }
+
+    // Whatever follows the last whole record was cut short, and is written 
+    // over by the next record.
+    if (offset < file_size)
+    {
+        unmap_file();
+        file_size = offset;
+        flushed_size = offset;
+
+#if defined (__linux__)
+        if (ftruncate(fileno(file), file_size))
+        {
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+#endif
+    }
+
+    return BASE_SUCCESS;
+}
+
+status state_store::append_record(uint64 hash, uint32 kind, const void *data, uint32 size, uint64 *output_offset)
+{
+    store_record_header header;
+
+    header.hash = hash;
+    header.kind = kind;
+    header.size = size;
+
+    if (1 != fwrite(&header, sizeof(store_record_header), 1, file) || 1 != fwrite(data, size, 1, file))
+    {
+        // Part of the record may have been written, and the next one goes 
+        // in its place.
+        discard_records(file_size);
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+
+    *output_offset = file_size + sizeof(store_record_header);
+    file_size += sizeof(store_record_header) + size;
+
+    return BASE_SUCCESS;
+}
+
+status state_store::read_file(uint64 offset, void *output, uint32 size)
+{
+    if (offset + size > file_size)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    // Records written since the last read may still be buffered. Write errors
+    // usually only surface here, and whatever was not flushed is given up.
+    if (offset + size > flushed_size)
+    {
+        if (fflush(file))
+        {
+            discard_records(flushed_size);
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+
+        flushed_size = file_size;
+    }
+
+#if defined (__linux__)
+    // The mapping extends past the end of the file, and pages appended later
+    // become readable through it without mapping again.
+    if (offset + size > mapping_size)
+    {
+        unmap_file();
+
+        uint64 size_to_map = file_size + file_size / 2 + STORE_MAPPING_RESERVE;
+        void *view = mmap(NULL, size_to_map, PROT_READ, MAP_SHARED, fileno(file), 0);
+
+        if (MAP_FAILED == view)
+        {
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+
+        mapping = (uint8 *) view;
+        mapping_size = size_to_map;
+    }
+
+    memcpy(output, mapping + offset, size);
+#else
+    bool read = !STORE_SEEK(file, offset, SEEK_SET) && 1 == fread(output, size, 1, file);
+
+    STORE_SEEK(file, file_size, SEEK_SET);
+
+    if (!read)
+    {
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+#endif
+
+    return BASE_SUCCESS;
+}
+
+status state_store::discard_records(uint64 size)
+{
+    // Forgets every record from the offset on, after writing them may have 
+    // failed, and positions the file so that the next record replaces them.
+    // If even that fails the store is closed rather than left inconsistent.
+    if (size < file_size && 
+        (base_failed(drop_index_entries(&pages, size)) || base_failed(drop_index_entries(&states, size))))
+    {
+        close();
+        return base_post_error(BASE_ERROR_OUTOFMEMORY);
+    }
+
+    file_size = size;
+    flushed_size = min(flushed_size, size);
+    clearerr(file);
+
+    if (STORE_SEEK(file, size, SEEK_SET))
+    {
+        close();
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+
+#if defined (__linux__)
+    // Anything past the offset is no longer part of the pack.
+    if (ftruncate(fileno(file), size))
+    {
+        close();
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+#endif
+
+    return BASE_SUCCESS;
+}
+
+void state_store::unmap_file()
+{
+#if defined (__linux__)
+    if (mapping)
+    {
+        munmap(mapping, mapping_size);
+    }
+#endif
+
+    mapping = NULL;
+    mapping_size = 0;
+}
+
+status state_store::put(const famicom_state *input, uint64 *output_key)
+{
+    if (!input || !output_key)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!file)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    uint64 key = compute_hash64(input, sizeof(famicom_state));
+
+    if (!find_index_entry(&states, key)->offset)
+    {
+        const uint8 *data = (const uint8 *) input;
+        uint8 last_page[STORE_PAGE_SIZE];
+        uint64 offset = 0;
+
+        for (uint32 i = 0; i < STORE_STATE_PAGE_COUNT; i++)
+        {
+            const uint8 *page = data + i * STORE_PAGE_SIZE;
+            uint32 page_size = min((uint32) STORE_PAGE_SIZE, (uint32) (sizeof(famicom_state) - i * STORE_PAGE_SIZE));
+
+            // The last page is padded out with zeros.
+            if (page_size < STORE_PAGE_SIZE)
+            {
+                memset(last_page, 0, STORE_PAGE_SIZE);
+                memcpy(last_page, page, page_size);
+                page = last_page;
+            }
+
+            page_hashes[i] = compute_hash64(page, STORE_PAGE_SIZE);
+            store_index_entry *entry = find_index_entry(&pages, page_hashes[i]);
+
+            if (entry->offset)
+            {
+                // A page is only shared once its contents are confirmed. Two pages
+                // that collide cannot both be stored under the hash.
+                uint8 stored_page[STORE_PAGE_SIZE];
+
+                if (base_failed(read_file(entry->offset, stored_page, STORE_PAGE_SIZE)))
+                {
+                    return base_post_error(BASE_ERROR_IO_FAILURE);
+                }
+
+                if (memcmp(stored_page, page, STORE_PAGE_SIZE))
+                {
+                    return base_post_error(BASE_ERROR_INVALID_RESOURCE);
+                }
+
+                continue;
+            }
+
+            if (base_failed(append_record(page_hashes[i], STORE_RECORD_PAGE, page, STORE_PAGE_SIZE, &offset)))
+            {
+                return base_post_error(BASE_ERROR_IO_FAILURE);
+            }
+
+            if (base_failed(insert_index_entry(&pages, page_hashes[i], offset)))
+            {
+                return base_post_error(BASE_ERROR_OUTOFMEMORY);
+            }
+        }
+
+        // The state is written after all of its pages, so a state that made it
+        // into the file is always whole.
+        if (base_failed(append_record(key, STORE_RECORD_STATE, page_hashes, sizeof(page_hashes), &offset)))
+        {
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+
+        if (base_failed(insert_index_entry(&states, key, offset)))
+        {
+            return base_post_error(BASE_ERROR_OUTOFMEMORY);
+        }
+    }
+
+    *output_key = key;
+
+    stats.put_count++;
+    stats.put_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+status state_store::get(uint64 key, famicom_state *output)
+{
+    if (!output)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (!file)
+    {
+        return base_post_error(BASE_ERROR_NOT_READY);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    store_index_entry *entry = find_index_entry(&states, key);
+
+    if (!entry->offset)
+    {
+        return base_post_error(BASE_ERROR_INVALIDARG);
+    }
+
+    if (base_failed(read_file(entry->offset, page_hashes, sizeof(page_hashes))))
+    {
+        return base_post_error(BASE_ERROR_IO_FAILURE);
+    }
+
+    uint8 *data = (uint8 *) output;
+
+    for (uint32 i = 0; i < STORE_STATE_PAGE_COUNT; i++)
+    {
+        uint32 page_size = min((uint32) STORE_PAGE_SIZE, (uint32) (sizeof(famicom_state) - i * STORE_PAGE_SIZE));
+        store_index_entry *page = find_index_entry(&pages, page_hashes[i]);
+
+        if (!page->offset || base_failed(read_file(page->offset, data + i * STORE_PAGE_SIZE, page_size)))
+        {
+            return base_post_error(BASE_ERROR_IO_FAILURE);
+        }
+    }
+
+    stats.get_count++;
+    stats.get_seconds += std::chrono::duration<float64>(std::chrono::steady_clock::now() - begin).count();
+
+    return BASE_SUCCESS;
+}
+
+bool state_store::contains(uint64 key)
+{
+    return file && find_index_entry(&states, key)->offset;
+}
+
+void state_store::query_stats(store_stats *output)
+{
+    *output = stats;
+
+    output->state_count = states.count;
+    output->page_count = pages.count;
+    output->file_size = file_size;
+}
+
+} // namespace nes
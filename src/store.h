@@ -0,0 +1,158 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// store.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __STATE_STORE_H__
+#define __STATE_STORE_H__
+
+#include "base.h"
+#include "nes.h"
+
+#include <stdio.h>
+
+#define STORE_FILE_MAGIC                    (0x4B50534E)   // 'NSPK'
+#define STORE_FILE_VERSION                  (1)
+#define STORE_PAGE_SIZE                     (256)
+#define STORE_STATE_PAGE_COUNT              ((sizeof(famicom_state) + STORE_PAGE_SIZE - 1) / STORE_PAGE_SIZE)
+
+#define STORE_RECORD_PAGE                   (0)
+#define STORE_RECORD_STATE                  (1)
+
+namespace nes {
+
+using namespace base;
+
+typedef struct store_file_header
+{
+    uint32 magic;
+    uint32 version;
+    uint32 page_size;
+    uint32 state_version;       // FAMICOM_STATE_VERSION of every state within
+    uint32 state_size;
+    uint32 reserved[3];
+
+} store_file_header;
+
+// Precedes every record. A page record holds STORE_PAGE_SIZE bytes, and a 
+// state record holds the hashes of its pages in order.
+typedef struct store_record_header
+{
+    uint64 hash;                // of the page, or of the whole state
+    uint32 kind;
+    uint32 size;
+
+} store_record_header;
+
+typedef struct store_index_entry
+{
+    uint64 hash;
+    uint64 offset;              // of the record contents, zero when unused
+
+} store_index_entry;
+
+typedef struct store_index
+{
+    store_index_entry *entries;
+    uint32 capacity;            // a power of two
+    uint32 count;
+
+} store_index;
+
+typedef struct store_stats
+{
+    uint32 state_count;
+    uint32 page_count;          // distinct pages
+    uint64 file_size;
+    uint64 put_count;           // states stored, repeats included
+    uint64 get_count;
+    float64 open_seconds;       // spent indexing the file
+    float64 put_seconds;
+    float64 get_seconds;
+
+} store_stats;
+
+// Keeps machine states on disk, split into pages that are each stored once
+// under their hash. States from the same game mostly share their rom chr,
+// cleared memory and nametables, so a new state usually adds only the few 
+// pages it changed. The pack file is only ever appended to, and a state is 
+// addressed by the hash of its contents, so storing the same state again adds
+// nothing. Reads go through a mapping of the file. Hashes are 64 bits. A page
+// whose hash is already stored is compared byte for byte before it is shared,
+// and put fails on a collision. A state whose key is already stored is taken
+// to be the same state without comparing, so two different states that share
+// a 64 bit hash would share a key.
+//
+// Opening a pack indexes every record in it. A record cut short by a crash 
+// is dropped along with anything after it.
+
+class state_store
+{
+    FILE *file;
+    uint64 file_size;
+    uint64 flushed_size;        // written through to the file, and readable
+    uint8 *mapping;
+    uint64 mapping_size;
+
+    store_index pages;
+    store_index states;
+    uint64 page_hashes[STORE_STATE_PAGE_COUNT];
+
+    store_stats stats;
+
+public:
+
+    state_store();
+    ~state_store();
+
+    // Creates the file if it does not exist.
+    status open(const char *filename);
+    void close();
+
+    status put(const famicom_state *input, uint64 *output_key);
+    status get(uint64 key, famicom_state *output);
+    bool contains(uint64 key);
+
+    void query_stats(store_stats *output);
+
+private:
+
+    status index_records();
+    status append_record(uint64 hash, uint32 kind, const void *data, uint32 size, uint64 *output_offset);
+    status read_file(uint64 offset, void *output, uint32 size);
+    status discard_records(uint64 size);
+    void unmap_file();
+
+    BASE_DISABLE_COPY_AND_ASSIGN(state_store);
+};
+
+} // namespace nes
+
+#endif // __STATE_STORE_H__
@@ -0,0 +1,151 @@
+
+#include "topology.h"
+
+#include <thread>
+
+#if defined (__linux__)
+#include <pthread.h>
+#endif
+
+namespace nes {
+
+#if defined (__linux__)
+
+static void add_node_cpus(cpu_topology *output, uint8 node, const char *list, const cpu_set_t *allowed)
+{
+    // Lists look like "0-3,8-11".
+    uint32 added = 0;
+
+    while (*list >= '0' && *list <= '9')
+    {
+        char *end = NULL;
+        uint32 first = strtoul(list, &end, 10);
+        uint32 last = first;
+
+        if ('-' == *end)
+        {
+            last = strtoul(end + 1, &end, 10);
+        }
+
+        for (uint32 cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, allowed) && output->cpu_count < TOPOLOGY_MAX_CPUS)
+            {
+                output->cpus[output->cpu_count] = cpu;
+                output->cpu_nodes[output->cpu_count] = node;
+                output->cpu_count++;
+                added++;
+            }
+        }
+
+        list = (',' == *end) ? end + 1 : end;
+    }
+
+    output->node_count += !!added;
+}
+
+#endif
+
+void query_cpu_topology(cpu_topology *output)
+{
+    memset(output, 0, sizeof(cpu_topology));
+
+#if defined (__linux__)
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed))
+    {
+        CPU_ZERO(&allowed);
+
+        for (uint32 i = 0; i < std::thread::hardware_concurrency() && i < CPU_SETSIZE; i++)
+        {
+            CPU_SET(i, &allowed);
+        }
+    }
+
+    for (uint32 node = 0; node < TOPOLOGY_MAX_NODES; node++)
+    {
+        char filename[64];
+        char list[1 * BASE_KB];
+
+        snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%u/cpulist", node);
+
+        FILE *file = fopen(filename, "r");
+
+        if (!file)
+        {
+            continue;
+        }
+
+        if (fgets(list, sizeof(list), file))
+        {
+            add_node_cpus(output, node, list, &allowed);
+        }
+
+        fclose(file);
+    }
+
+    if (output->cpu_count)
+    {
+        output->nodes_detected = true;
+        return;
+    }
+
+    for (uint32 cpu = 0; cpu < CPU_SETSIZE && output->cpu_count < TOPOLOGY_MAX_CPUS; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+        {
+            output->cpus[output->cpu_count++] = cpu;
+        }
+    }
+#endif
+
+    if (!output->cpu_count)
+    {
+        output->cpu_count = max(1u, min(std::thread::hardware_concurrency(), (uint32) TOPOLOGY_MAX_CPUS));
+
+        for (uint32 i = 0; i < output->cpu_count; i++)
+        {
+            output->cpus[i] = i;
+        }
+    }
+
+    output->node_count = 1;
+}
+
+bool pin_current_thread(uint16 cpu)
+{
+#if defined (__linux__)
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    return 0 == pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+#elif defined (BASE_PLATFORM_WINDOWS)
+    return cpu < 64 && 0 != SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu);
+#else
+    return false;
+#endif
+}
+
+void save_thread_affinity(thread_affinity *output)
+{
+#if defined (__linux__)
+    output->valid = (0 == pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &output->cpus));
+#else
+    output->valid = false;
+#endif
+}
+
+void restore_thread_affinity(const thread_affinity *input)
+{
+#if defined (__linux__)
+    if (input->valid)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &input->cpus);
+    }
+#endif
+}
+
+} // namespace nes
@@ -0,0 +1,82 @@
+
+/*
+// Copyright (c) 1998-2008 Joe Bertolami. All Right Reserved.
+//
+// topology.h
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice, this
+//     list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+//   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+//   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+//   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+//   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+//   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+*/
+
+#ifndef __CPU_TOPOLOGY_H__
+#define __CPU_TOPOLOGY_H__
+
+#include "base.h"
+
+#if defined (__linux__)
+#include <sched.h>
+#endif
+
+#define TOPOLOGY_MAX_CPUS                   (256)
+#define TOPOLOGY_MAX_NODES                  (64)
+
+namespace nes {
+
+using namespace base;
+
+// The cpus this process may run on, grouped by the memory node they belong
+// to. Nodes are read from sysfs on Linux. Elsewhere, or when sysfs is not 
+// available, every cpu is assumed to share node zero.
+typedef struct cpu_topology
+{
+    uint32 cpu_count;
+    uint32 node_count;          // nodes with at least one of our cpus
+    uint16 cpus[TOPOLOGY_MAX_CPUS];
+    uint8 cpu_nodes[TOPOLOGY_MAX_CPUS];
+    bool nodes_detected;
+
+} cpu_topology;
+
+typedef struct thread_affinity
+{
+#if defined (__linux__)
+    cpu_set_t cpus;
+#endif
+    bool valid;
+
+} thread_affinity;
+
+void query_cpu_topology(cpu_topology *output);
+
+// Restricts the calling thread to a single cpu. Returns false where that is
+// not supported.
+bool pin_current_thread(uint16 cpu);
+
+void save_thread_affinity(thread_affinity *output);
+void restore_thread_affinity(const thread_affinity *input);
+
+} // namespace nes
+
+#endif // __CPU_TOPOLOGY_H__